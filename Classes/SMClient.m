@@ -75,6 +75,7 @@ static SMClient *defaultClient = nil;
         self.passwordFieldName = passwordFieldName;
         
         self.session = [[SMUserSession alloc] initWithAPIVersion:appAPIVersion apiHost:apiHost publicKey:publicKey userSchema:userSchema];
+        self.session.userIdName = userIdName;
         self.coreDataStore = nil;
 
         if ([SMClient defaultClient] == nil)
@@ -18,6 +18,16 @@
 #import "SMUserSession.h"
 #import "SMResponseBlocks.h"
 
+@interface SMDataStore ()
+
+// Maps the key of each GET in flight to the callbacks waiting on it, under "waiters", and the schema it reads, under "schema".
+@property (nonatomic, strong) NSMutableDictionary *inFlightRequests;
+
+// Maps the key of a GET to the validators and body of its last successful response.
+@property (nonatomic, strong) NSCache *validatedResponses;
+
+@end
+
 /**
  Supplemental methods for <SMDataStore>.  In essence they add an extra layer of logic to existing `SMDataStore` methods for special conditions. 
  
@@ -33,6 +43,9 @@
 - (SMFullResponseSuccessBlock)SMFullResponseSuccessBlockForObjectId:(NSString *)theObjectId ofSchema:(NSString *)schema withSuccessBlock:(SMDataStoreObjectIdSuccessBlock)successBlock;
 
 
+- (SMFullResponseSuccessBlock)SMFullResponseSuccessBlockForSchema:(NSString *)schema withBulkSuccessBlock:(SMDataStoreBulkSuccessBlock)successBlock;
+
+
 - (SMFullResponseSuccessBlock)SMFullResponseSuccessBlockForSuccessBlock:(SMSuccessBlock)successBlock ;
 
 
@@ -48,6 +61,9 @@
 - (SMFullResponseFailureBlock)SMFullResponseFailureBlockForObjectId:(NSString *)theObjectId ofSchema:(NSString *)schema withFailureBlock:(SMDataStoreObjectIdFailureBlock)failureBlock;
 
 
+- (SMFullResponseFailureBlock)SMFullResponseFailureBlockForObjects:(NSArray *)objects ofSchema:(NSString *)schema withFailureBlock:(SMDataStoreBulkFailureBlock)failureBlock;
+
+
 - (SMFullResponseFailureBlock)SMFullResponseFailureBlockForFailureBlock:(SMFailureBlock)failureBlock;
 
 
@@ -63,5 +79,42 @@
 
 - (void)queueRequest:(NSURLRequest *)request options:(SMRequestOptions *)options onSuccess:(SMFullResponseSuccessBlock)onSuccess onFailure:(SMFullResponseFailureBlock)onFailure;
 
+/**
+ Queues a create, update or delete of objects in a schema like <queueRequest:options:onSuccess:onFailure:>.  The cached results of the schema, and of the schemas of any related objects named by the request's `X-StackMob-Relations` header, are removed when the write is queued and again when it completes, since a query which overlapped the write may have read the objects as they were before it.  GETs of those schemas already in flight stop accepting new callbacks.
+ */
+- (void)queueWriteRequest:(NSURLRequest *)request toSchema:(NSString *)schema options:(SMRequestOptions *)options onSuccess:(SMFullResponseSuccessBlock)onSuccess onFailure:(SMFullResponseFailureBlock)onFailure;
+
+/**
+ Returns the key which identifies a request for coalescing and revalidation: its method, URL and headers, other than `Authorization` and the conditional headers.
+ */
+- (NSString *)keyForRequest:(NSURLRequest *)request;
+
+/**
+ Returns the request with `If-None-Match` or `If-Modified-Since` headers added if a response to an identical GET has been remembered, or the request itself otherwise.
+ */
+- (NSURLRequest *)conditionalRequestForRequest:(NSURLRequest *)request;
+
+/**
+ Remembers the validators of a successful response to a GET, its `ETag` and `Last-Modified` headers or, for a single object whose `lastmoddate` falls on a whole second, that field, along with the JSON body and `Content-Range` header, which a 304 Not Modified response leaves out.
+ */
+- (void)rememberResponse:(NSHTTPURLResponse *)response JSON:(id)JSON forRequest:(NSURLRequest *)request;
+
+/**
+ Returns the JSON body remembered for a request, which a 304 Not Modified response stands for, or nil.
+ */
+- (id)rememberedJSONForRequest:(NSURLRequest *)request;
+
+/**
+ Stops GETs of a schema which are in flight from accepting new callbacks, so reads made after a write to the schema are sent afresh.
+ */
+- (void)removeInFlightRequestsInSchema:(NSString *)schema;
+
+/**
+ Queues a GET like <queueRequest:options:onSuccess:onFailure:>, unless an identical GET is already in flight, in which case the callbacks wait on that request instead.
+ 
+ Requests are identical when their method, URL and headers, other than `Authorization`, match, and their options would retry them the same way.  Each waiting callback runs on the completion queue of its own request.
+ */
+- (void)queueCoalescedRequest:(NSURLRequest *)request options:(SMRequestOptions *)options onSuccess:(SMFullResponseSuccessBlock)onSuccess onFailure:(SMFullResponseFailureBlock)onFailure;
+
 
 @end
\ No newline at end of file
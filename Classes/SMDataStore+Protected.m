@@ -46,6 +46,16 @@
     };
 }
 
+- (SMFullResponseSuccessBlock)SMFullResponseSuccessBlockForSchema:(NSString *)schema withBulkSuccessBlock:(SMDataStoreBulkSuccessBlock)successBlock
+{
+    return ^void(NSURLRequest *request, NSHTTPURLResponse *response, id JSON)
+    {
+        if (successBlock) {
+            successBlock([JSON valueForKey:@"succeeded"], [JSON valueForKey:@"failed"], schema);
+        }
+    };
+}
+
 - (SMFullResponseSuccessBlock)SMFullResponseSuccessBlockForSuccessBlock:(SMSuccessBlock)successBlock 
 {
     return ^void(NSURLRequest *request, NSHTTPURLResponse *response, id JSON)
@@ -97,6 +107,16 @@
     };
 }
 
+- (SMFullResponseFailureBlock)SMFullResponseFailureBlockForObjects:(NSArray *)objects ofSchema:(NSString *)schema withFailureBlock:(SMDataStoreBulkFailureBlock)failureBlock
+{
+    return ^void(NSURLRequest *request, NSHTTPURLResponse *response, NSError *error, id JSON)
+    {
+        if (failureBlock) {
+            failureBlock([self errorFromResponse:response JSON:JSON], objects, schema);
+        }
+    };
+}
+
 - (SMFullResponseFailureBlock)SMFullResponseFailureBlockForFailureBlock:(SMFailureBlock)failureBlock
 {
     return ^void(NSURLRequest *request, NSHTTPURLResponse *response, NSError *error, id JSON)
@@ -140,48 +160,85 @@
         
         SMFullResponseSuccessBlock urlSuccessBlock = [self SMFullResponseSuccessBlockForSchema:schema withSuccessBlock:successBlock];
         SMFullResponseFailureBlock urlFailureBlock = [self SMFullResponseFailureBlockForObjectId:theObjectId ofSchema:schema withFailureBlock:failureBlock];
-        [self queueRequest:request options:options onSuccess:urlSuccessBlock onFailure:urlFailureBlock];
+        [self queueCoalescedRequest:request options:options onSuccess:urlSuccessBlock onFailure:urlFailureBlock];
     }
 }
 
-- (void)refreshAndRetry:(NSURLRequest *)request onSuccess:(SMFullResponseSuccessBlock)onSuccess onFailure:(SMFullResponseFailureBlock)onFailure
+- (void)refreshAndRetry:(NSURLRequest *)request options:(SMRequestOptions *)originalOptions onSuccess:(SMFullResponseSuccessBlock)onSuccess onFailure:(SMFullResponseFailureBlock)onFailure
 {
-    if (self.session.refreshing) {
-        if (onFailure) {
-            NSError *error = [[NSError alloc] initWithDomain:SMErrorDomain code:SMErrorRefreshTokenInProgress userInfo:nil];
-            onFailure(request, nil, error, nil);
-        }
+    __block SMRequestOptions *options = [SMRequestOptions options];
+    [options setTryRefreshToken:NO];
+    [options setCompletionQueue:originalOptions.completionQueue];
+    if (![self.session requestIsSignedWithCurrentToken:request] && [self.session accessTokenHasExpired]) {
+        // A refresh completed while this request was in flight and its token is still good, so sending the request again, which signs it again, is enough.
+        [self queueRequest:request options:options onSuccess:onSuccess onFailure:onFailure];
     } else {
-        __block SMRequestOptions *options = [SMRequestOptions options];
-        [options setTryRefreshToken:NO];
+        // Requests arriving while a refresh is in progress wait for it, and are all replayed once it completes.
         [self.session refreshTokenOnSuccess:^(NSDictionary *userObject) {
-            [self queueRequest:[self.session signRequest:request] options:options onSuccess:onSuccess onFailure:onFailure];
+            [self queueRequest:request options:options onSuccess:onSuccess onFailure:onFailure];
         } onFailure:^(NSError *theError) {
-            [self queueRequest:[self.session signRequest:request] options:options onSuccess:onSuccess onFailure:onFailure];
+            [self queueRequest:request options:options onSuccess:onSuccess onFailure:onFailure];
         }];
     }
 }
 
+/*
+ Returns a 304 Not Modified response with the Content-Range of the response it stands for, which a 304 doesn't repeat but performCount: reads its total from.
+ */
+static NSHTTPURLResponse *notModifiedResponseWithRememberedContentRange(NSHTTPURLResponse *response, NSDictionary *validatedResponse)
+{
+    NSString *contentRange = [validatedResponse objectForKey:@"Content-Range"];
+    if (contentRange == nil) {
+        return response;
+    }
+    NSMutableDictionary *headers = [NSMutableDictionary dictionaryWithDictionary:[response allHeaderFields]];
+    [headers setObject:contentRange forKey:@"Content-Range"];
+    return [[NSHTTPURLResponse alloc] initWithURL:[response URL] statusCode:[response statusCode] HTTPVersion:@"HTTP/1.1" headerFields:headers];
+}
+
 - (void)queueRequest:(NSURLRequest *)request options:(SMRequestOptions *)options onSuccess:(SMFullResponseSuccessBlock)onSuccess onFailure:(SMFullResponseFailureBlock)onFailure
 {
     if (![self.session accessTokenHasExpired] && self.session.refreshToken != nil && options.tryRefreshToken) {
-        [self refreshAndRetry:request onSuccess:onSuccess onFailure:onFailure];
+        [self refreshAndRetry:request options:options onSuccess:onSuccess onFailure:onFailure];
     } 
     else {
+        dispatch_queue_t completionQueue = options.completionQueue ? options.completionQueue : self.completionQueue;
+        SMFullResponseSuccessBlock successBlock = onSuccess;
+        if ([[request HTTPMethod] isEqualToString:@"GET"]) {
+            request = [self conditionalRequestForRequest:request];
+            successBlock = ^(NSURLRequest *request, NSHTTPURLResponse *response, id JSON) {
+                [self rememberResponse:response JSON:JSON forRequest:request];
+                if (onSuccess) {
+                    onSuccess(request, response, JSON);
+                }
+            };
+        }
         SMFullResponseFailureBlock retryBlock = ^(NSURLRequest *request, NSHTTPURLResponse *response, NSError *error, id JSON) {
-            if ([response statusCode] == SMErrorUnauthorized && options.tryRefreshToken) {
-                [self refreshAndRetry:request onSuccess:onSuccess onFailure:onFailure];
+            // AFNetworking only accepts 2xx status codes, so a 304 Not Modified arrives here.
+            NSDictionary *validatedResponse = [response statusCode] == SMErrorNotModified ? [self.validatedResponses objectForKey:[self keyForRequest:request]] : nil;
+            if (validatedResponse) {
+                if (onSuccess) {
+                    onSuccess(request, notModifiedResponseWithRememberedContentRange(response, validatedResponse), [validatedResponse objectForKey:@"JSON"]);
+                }
+            } else if ([response statusCode] == SMErrorNotModified) {
+                // The remembered body was evicted while the request was in flight, so ask for it again.
+                NSMutableURLRequest *unconditionalRequest = [request mutableCopy];
+                [unconditionalRequest setValue:nil forHTTPHeaderField:@"If-None-Match"];
+                [unconditionalRequest setValue:nil forHTTPHeaderField:@"If-Modified-Since"];
+                [self queueRequest:unconditionalRequest options:options onSuccess:onSuccess onFailure:onFailure];
+            } else if ([response statusCode] == SMErrorUnauthorized && options.tryRefreshToken) {
+                [self refreshAndRetry:request options:options onSuccess:onSuccess onFailure:onFailure];
             } else if ([response statusCode] == SMErrorServiceUnavailable && options.numberOfRetries > 0) {
                 NSString *retryAfter = [[response allHeaderFields] valueForKey:@"Retry-After"];
                 if (retryAfter) {
                     [options setNumberOfRetries:(options.numberOfRetries - 1)];
                     double delayInSeconds = [retryAfter doubleValue];
                     dispatch_time_t popTime = dispatch_time(DISPATCH_TIME_NOW, delayInSeconds * NSEC_PER_SEC);
-                    dispatch_after(popTime, dispatch_get_main_queue(), ^(void){
+                    dispatch_after(popTime, completionQueue ? completionQueue : dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(void){
                         if (options.retryBlock) {
                             options.retryBlock(request, response, error, JSON, options, onSuccess, onFailure);
                         } else {
-                            [self queueRequest:[self.session signRequest:request] options:options onSuccess:onSuccess onFailure:onFailure];
+                            [self queueRequest:request options:options onSuccess:onSuccess onFailure:onFailure];
                         }
                     });
                 } else {
@@ -193,12 +250,222 @@
             
         };
         
-        AFJSONRequestOperation *op = [SMJSONRequestOperation JSONRequestOperationWithRequest:request success:onSuccess failure:retryBlock];
+        SMJSONRequestOperation *op = (SMJSONRequestOperation *)[SMJSONRequestOperation JSONRequestOperationWithRequest:request success:successBlock failure:retryBlock];
+        // The request is signed as it starts, so every retry is signed afresh.  The MAC covers the port, so sign with the client for the request's scheme.
+        op.signingClient = [self.session oauthClientWithHTTPS:[[[request URL] scheme] isEqualToString:@"https"]];
+        if (completionQueue) {
+            op.successCallbackQueue = completionQueue;
+            op.failureCallbackQueue = completionQueue;
+        }
         [[self.session oauthClientWithHTTPS:FALSE] enqueueHTTPRequestOperation:op];
     }
     
 }
 
+/*
+ Returns the schema written to, along with the schemas of related objects created with it, which are named by the request's X-StackMob-Relations header as path=schema pairs joined by &.
+ */
+static NSSet *schemasWrittenByRequest(NSURLRequest *request, NSString *schema)
+{
+    NSMutableSet *schemas = [NSMutableSet setWithObject:schema];
+    NSString *relations = [request valueForHTTPHeaderField:@"X-StackMob-Relations"];
+    for (NSString *relation in [relations componentsSeparatedByString:@"&"]) {
+        NSRange separator = [relation rangeOfString:@"="];
+        if (separator.location != NSNotFound) {
+            [schemas addObject:[relation substringFromIndex:NSMaxRange(separator)]];
+        }
+    }
+    return schemas;
+}
+
+- (void)queueWriteRequest:(NSURLRequest *)request toSchema:(NSString *)schema options:(SMRequestOptions *)options onSuccess:(SMFullResponseSuccessBlock)onSuccess onFailure:(SMFullResponseFailureBlock)onFailure
+{
+    SMResultCache *resultCache = self.resultCache;
+    NSSet *schemas = schema ? schemasWrittenByRequest(request, schema) : nil;
+    for (NSString *writtenSchema in schemas) {
+        [resultCache removeResultsInSchema:writtenSchema];
+        // Reads of the schema sent before the write mustn't answer reads made after it.
+        [self removeInFlightRequestsInSchema:writtenSchema];
+    }
+    [self queueRequest:request options:options onSuccess:^(NSURLRequest *request, NSHTTPURLResponse *response, id JSON) {
+        for (NSString *writtenSchema in schemas) {
+            [resultCache removeResultsInSchema:writtenSchema];
+        }
+        if (onSuccess) {
+            onSuccess(request, response, JSON);
+        }
+    } onFailure:^(NSURLRequest *request, NSHTTPURLResponse *response, NSError *error, id JSON) {
+        // A write which failed may still have reached StackMob.
+        for (NSString *writtenSchema in schemas) {
+            [resultCache removeResultsInSchema:writtenSchema];
+        }
+        if (onFailure) {
+            onFailure(request, response, error, JSON);
+        }
+    }];
+}
+
+
 
+- (NSString *)keyForRequest:(NSURLRequest *)request
+{
+    // The Authorization header is signed with a fresh nonce for every request, so it never matches, and the conditional headers are added by queueRequest itself.
+    NSSet *ignoredHeaders = [NSSet setWithObjects:@"authorization", @"if-none-match", @"if-modified-since", nil];
+    NSMutableArray *components = [NSMutableArray arrayWithObjects:[request HTTPMethod], [[request URL] absoluteString], nil];
+    NSDictionary *headers = [request allHTTPHeaderFields];
+    for (NSString *header in [[headers allKeys] sortedArrayUsingSelector:@selector(caseInsensitiveCompare:)]) {
+        if (![ignoredHeaders containsObject:[header lowercaseString]]) {
+            [components addObject:[NSString stringWithFormat:@"%@: %@", [header lowercaseString], [headers objectForKey:header]]];
+        }
+    }
+    return [components componentsJoinedByString:@"\n"];
+}
+
+static NSString *HTTPDateStringFromDate(NSDate *date)
+{
+    static NSDateFormatter *formatter = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        formatter = [[NSDateFormatter alloc] init];
+        [formatter setLocale:[[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"]];
+        [formatter setTimeZone:[NSTimeZone timeZoneWithAbbreviation:@"GMT"]];
+        [formatter setDateFormat:@"EEE, dd MMM yyyy HH:mm:ss 'GMT'"];
+    });
+    // Responses complete on any completion queue, and NSDateFormatter isn't thread safe.
+    @synchronized(formatter) {
+        return [formatter stringFromDate:date];
+    }
+}
+
+- (NSURLRequest *)conditionalRequestForRequest:(NSURLRequest *)request
+{
+    NSDictionary *validatedResponse = [self.validatedResponses objectForKey:[self keyForRequest:request]];
+    if (validatedResponse == nil) {
+        return request;
+    }
+    NSMutableURLRequest *conditionalRequest = [request mutableCopy];
+    [conditionalRequest setValue:[validatedResponse objectForKey:@"ETag"] forHTTPHeaderField:@"If-None-Match"];
+    [conditionalRequest setValue:[validatedResponse objectForKey:@"Last-Modified"] forHTTPHeaderField:@"If-Modified-Since"];
+    // The response is validated here, so the URL loading system mustn't answer from its own cache.
+    [conditionalRequest setCachePolicy:NSURLRequestReloadIgnoringLocalCacheData];
+    return conditionalRequest;
+}
+
+- (void)rememberResponse:(NSHTTPURLResponse *)response JSON:(id)JSON forRequest:(NSURLRequest *)request
+{
+    if (JSON == nil) {
+        return;
+    }
+    NSString *etag = [[response allHeaderFields] valueForKey:@"ETag"];
+    NSString *lastModified = [[response allHeaderFields] valueForKey:@"Last-Modified"];
+    if (lastModified == nil && [JSON isKindOfClass:[NSDictionary class]]) {
+        // lastmoddate is in milliseconds since the epoch, and HTTP dates only have whole seconds, so it can only stand in for Last-Modified when it falls on a second.  Otherwise a later change within the same second would be taken as unmodified.
+        NSNumber *lastmoddate = [JSON objectForKey:@"lastmoddate"];
+        if ([lastmoddate isKindOfClass:[NSNumber class]] && [lastmoddate longLongValue] % 1000 == 0) {
+            lastModified = HTTPDateStringFromDate([NSDate dateWithTimeIntervalSince1970:[lastmoddate doubleValue] / 1000]);
+        }
+    }
+    NSString *key = [self keyForRequest:request];
+    if (etag == nil && lastModified == nil) {
+        [self.validatedResponses removeObjectForKey:key];
+        return;
+    }
+    NSMutableDictionary *validatedResponse = [NSMutableDictionary dictionaryWithObject:JSON forKey:@"JSON"];
+    [validatedResponse setValue:etag forKey:@"ETag"];
+    [validatedResponse setValue:lastModified forKey:@"Last-Modified"];
+    [validatedResponse setValue:[[response allHeaderFields] valueForKey:@"Content-Range"] forKey:@"Content-Range"];
+    [self.validatedResponses setObject:validatedResponse forKey:key];
+}
+
+- (id)rememberedJSONForRequest:(NSURLRequest *)request
+{
+    return [[self.validatedResponses objectForKey:[self keyForRequest:request]] objectForKey:@"JSON"];
+}
+
+/*
+ Returns the first path component of a request's URL, the schema a GET reads from.
+ */
+static NSString *schemaOfRequest(NSURLRequest *request)
+{
+    NSArray *pathComponents = [[[request URL] path] pathComponents];
+    return [pathComponents count] > 1 ? [[pathComponents objectAtIndex:1] lowercaseString] : @"";
+}
+
+- (void)removeInFlightRequestsInSchema:(NSString *)schema
+{
+    NSArray *schemaComponents = [schema pathComponents];
+    if ([schemaComponents count] == 0) {
+        return;
+    }
+    NSString *lowercaseSchema = [[schemaComponents objectAtIndex:0] lowercaseString];
+    NSMutableDictionary *inFlightRequests = self.inFlightRequests;
+    @synchronized(inFlightRequests) {
+        NSSet *keys = [inFlightRequests keysOfEntriesPassingTest:^BOOL(id key, id inFlightRequest, BOOL *stop) {
+            return [[inFlightRequest objectForKey:@"schema"] isEqualToString:lowercaseSchema];
+        }];
+        [inFlightRequests removeObjectsForKeys:[keys allObjects]];
+    }
+}
+
+- (void)queueCoalescedRequest:(NSURLRequest *)request options:(SMRequestOptions *)options onSuccess:(SMFullResponseSuccessBlock)onSuccess onFailure:(SMFullResponseFailureBlock)onFailure
+{
+    // Requests which would be retried differently can't share a response.
+    NSString *key = [NSString stringWithFormat:@"%@\ntry refresh token: %d\nretries: %ld\nretry block: %p", [self keyForRequest:request], options.tryRefreshToken, (long)options.numberOfRetries, options.retryBlock];
+    dispatch_queue_t completionQueue = options.completionQueue ? options.completionQueue : self.completionQueue;
+    if (completionQueue == NULL) {
+        completionQueue = dispatch_get_main_queue();
+    }
+    NSMutableDictionary *waiter = [NSMutableDictionary dictionaryWithCapacity:3];
+    [waiter setValue:[onSuccess copy] forKey:@"success"];
+    [waiter setValue:[onFailure copy] forKey:@"failure"];
+    dispatch_retain(completionQueue);
+    [waiter setObject:[NSValue valueWithPointer:(__bridge const void *)completionQueue] forKey:@"queue"];
+    
+    NSMutableDictionary *inFlightRequests = self.inFlightRequests;
+    NSMutableArray *waiters = [NSMutableArray arrayWithObject:waiter];
+    @synchronized(inFlightRequests) {
+        NSMutableArray *existingWaiters = [[inFlightRequests objectForKey:key] objectForKey:@"waiters"];
+        if (existingWaiters) {
+            [existingWaiters addObject:waiter];
+            return;
+        }
+        [inFlightRequests setObject:[NSDictionary dictionaryWithObjectsAndKeys:waiters, @"waiters", schemaOfRequest(request), @"schema", nil] forKey:key];
+    }
+    
+    // A write to the schema may have removed the request from inFlightRequests, and a later identical request taken its place, so only remove it if it is still this one.  Waiters which joined before the write still get its response.
+    NSArray *(^removeWaiters)(void) = ^NSArray *{
+        @synchronized(inFlightRequests) {
+            if ([[inFlightRequests objectForKey:key] objectForKey:@"waiters"] == waiters) {
+                [inFlightRequests removeObjectForKey:key];
+            }
+            return [waiters copy];
+        }
+    };
+    SMFullResponseSuccessBlock fanOutSuccess = ^(NSURLRequest *theRequest, NSHTTPURLResponse *response, id JSON) {
+        for (NSDictionary *aWaiter in removeWaiters()) {
+            SMFullResponseSuccessBlock success = [aWaiter objectForKey:@"success"];
+            dispatch_queue_t queue = (__bridge dispatch_queue_t)[[aWaiter objectForKey:@"queue"] pointerValue];
+            if (success) {
+                dispatch_async(queue, ^{
+                    success(theRequest, response, JSON);
+                });
+            }
+            dispatch_release(queue);
+        }
+    };
+    SMFullResponseFailureBlock fanOutFailure = ^(NSURLRequest *theRequest, NSHTTPURLResponse *response, NSError *error, id JSON) {
+        for (NSDictionary *aWaiter in removeWaiters()) {
+            SMFullResponseFailureBlock failure = [aWaiter objectForKey:@"failure"];
+            dispatch_queue_t queue = (__bridge dispatch_queue_t)[[aWaiter objectForKey:@"queue"] pointerValue];
+            if (failure) {
+                dispatch_async(queue, ^{
+                    failure(theRequest, response, error, JSON);
+                });
+            }
+            dispatch_release(queue);
+        }
+    };
+    [self queueRequest:request options:options onSuccess:fanOutSuccess onFailure:fanOutFailure];
+}
 
 @end
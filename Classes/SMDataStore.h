@@ -28,6 +28,7 @@
 @class SMUserSession;
 @class SMRequestOptions;
 @class SMCustomCodeRequest;
+@class SMResultCache;
 
 /**
  `SMDataStore` exposes an interface for performing CRUD operations on known StackMob objects and for executing a <SMQuery>.
@@ -35,12 +36,28 @@
  As a direct interface to StackMob, `SMDataStore` uses StackMob's terminology:
  - Operations are performed against a specific _schema_ (usually also the name of a model class or of an entity in a managed object model).
  - Objects sent via the API are expressed as a dictionary of _fields_.
+ 
+ Identical reads and queries made while one is already in flight share its request.  A data store also remembers the `ETag` or `Last-Modified` date (or an object's `lastmoddate`) of recent responses, and asks StackMob for the same data again with a conditional request; when StackMob answers 304 Not Modified, the remembered response is passed to the success block.
  */
 @interface SMDataStore : NSObject
 
 @property(nonatomic, readonly, copy) NSString *apiVersion;
 @property(nonatomic, readwrite, strong) SMUserSession *session;
 
+/**
+ The dispatch queue on which success and failure blocks, and any 503 retries, are run for requests made with this data store.  The `completionQueue` of a request's <SMRequestOptions> takes precedence.
+ 
+ If neither is set, success and failure blocks run on the main queue and retries are scheduled on a global queue.
+ */
+@property(nonatomic, readwrite, assign) dispatch_queue_t completionQueue;
+
+/**
+ An optional cache for the results of <performQuery:options:onSuccess:onFailure:>.  Default is `nil`, meaning every query is sent to StackMob.
+ 
+ While a query's results are cached, an identical query (same schema, conditions, range, ordering and request headers) gets them without a network request.  Creating, updating or deleting objects through this data store removes the cached results for their schema, and for the schemas of related objects created along with them, both when the request is sent and when it completes, and a query which was in flight during a write doesn't cache its results.  Results can differ between logged in users, so they are cached separately for each `userIdentifier` of the session, and a user is never served results cached for another.
+ */
+@property(nonatomic, readwrite, strong) SMResultCache *resultCache;
+
 ///-------------------------------
 /// @name Initialize
 ///-------------------------------
@@ -90,6 +107,34 @@
            onSuccess:(SMDataStoreSuccessBlock)successBlock
            onFailure:(SMDataStoreFailureBlock)failureBlock;
 
+/**
+ Create multiple new objects in your StackMob datastore with a single request.
+ 
+ @param objects An array of dictionaries describing the objects to create on StackMob. Keys should map to valid StackMob fields. Values should be JSON serializable objects.
+ @param schema The StackMob schema in which to create the new objects.
+ @param successBlock A block to invoke after the request completes. Passed the object ids which were created, a description of each object which could not be created, and the schema.
+ @param failureBlock A block to invoke if the data store fails to perform the request. Passed the error returned by StackMob, the array sent with this create request, and the schema in which the objects were to be created.
+ */
+- (void)createObjects:(NSArray *)objects
+             inSchema:(NSString *)schema
+            onSuccess:(SMDataStoreBulkSuccessBlock)successBlock
+            onFailure:(SMDataStoreBulkFailureBlock)failureBlock;
+
+/**
+ Create multiple new objects in your StackMob datastore with a single request (with request options).
+ 
+ @param objects An array of dictionaries describing the objects to create on StackMob. Keys should map to valid StackMob fields. Values should be JSON serializable objects.
+ @param schema The StackMob schema in which to create the new objects.
+ @param options An options object contains headers and other configuration for this request
+ @param successBlock A block to invoke after the request completes. Passed the object ids which were created, a description of each object which could not be created, and the schema.
+ @param failureBlock A block to invoke if the data store fails to perform the request. Passed the error returned by StackMob, the array sent with this create request, and the schema in which the objects were to be created.
+ */
+- (void)createObjects:(NSArray *)objects
+             inSchema:(NSString *)schema
+              options:(SMRequestOptions *)options
+            onSuccess:(SMDataStoreBulkSuccessBlock)successBlock
+            onFailure:(SMDataStoreBulkFailureBlock)failureBlock;
+
 /** 
  Read an existing object from your StackMob datastore.
  
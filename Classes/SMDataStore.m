@@ -27,7 +27,9 @@
 #import "SMUserSession.h"
 #import "SMCustomCodeRequest.h"
 #import "SMResponseBlocks.h"
+#import "SMResultCache.h"
 
+#define SM_MAX_VALIDATED_RESPONSES 256
 
 
 @interface SMDataStore ()
@@ -40,6 +42,10 @@
 
 @synthesize apiVersion = _SM_apiVersion;
 @synthesize session = _SM_session;
+@synthesize completionQueue = _SM_completionQueue;
+@synthesize resultCache = _SM_resultCache;
+@synthesize inFlightRequests = _SM_inFlightRequests;
+@synthesize validatedResponses = _SM_validatedResponses;
 
 
 - (id)initWithAPIVersion:(NSString *)apiVersion session:(SMUserSession *)session
@@ -48,10 +54,33 @@
     if (self) {
         self.apiVersion = apiVersion;
 		self.session = session;
+        self.inFlightRequests = [NSMutableDictionary dictionary];
+        self.validatedResponses = [[NSCache alloc] init];
+        [self.validatedResponses setCountLimit:SM_MAX_VALIDATED_RESPONSES];
     }
     return self;
 }
 
+- (void)setCompletionQueue:(dispatch_queue_t)completionQueue
+{
+    if (completionQueue != _SM_completionQueue) {
+        if (_SM_completionQueue) {
+            dispatch_release(_SM_completionQueue);
+        }
+        if (completionQueue) {
+            dispatch_retain(completionQueue);
+        }
+        _SM_completionQueue = completionQueue;
+    }
+}
+
+- (void)dealloc
+{
+    if (_SM_completionQueue) {
+        dispatch_release(_SM_completionQueue);
+    }
+}
+
 - (void)createObject:(NSDictionary *)theObject inSchema:(NSString *)schema onSuccess:(SMDataStoreSuccessBlock)successBlock onFailure:(SMDataStoreFailureBlock)failureBlock
 {
     [self createObject:theObject inSchema:schema options:[SMRequestOptions options] onSuccess:successBlock onFailure:failureBlock];
@@ -71,7 +100,32 @@
         }];
         SMFullResponseSuccessBlock urlSuccessBlock = [self SMFullResponseSuccessBlockForSchema:schema withSuccessBlock:successBlock];
         SMFullResponseFailureBlock urlFailureBlock = [self SMFullResponseFailureBlockForObject:theObject ofSchema:schema withFailureBlock:failureBlock];
-        [self queueRequest:request options:options onSuccess:urlSuccessBlock onFailure:urlFailureBlock];
+        [self queueWriteRequest:request toSchema:schema options:options onSuccess:urlSuccessBlock onFailure:urlFailureBlock];
+    }
+}
+
+- (void)createObjects:(NSArray *)objects inSchema:(NSString *)schema onSuccess:(SMDataStoreBulkSuccessBlock)successBlock onFailure:(SMDataStoreBulkFailureBlock)failureBlock
+{
+    [self createObjects:objects inSchema:schema options:[SMRequestOptions options] onSuccess:successBlock onFailure:failureBlock];
+}
+
+- (void)createObjects:(NSArray *)objects inSchema:(NSString *)schema options:(SMRequestOptions *)options onSuccess:(SMDataStoreBulkSuccessBlock)successBlock onFailure:(SMDataStoreBulkFailureBlock)failureBlock
+{
+    if (objects == nil || schema == nil) {
+        if (failureBlock) {
+            NSError *error = [[NSError alloc] initWithDomain:SMErrorDomain code:SMErrorInvalidArguments userInfo:nil];
+            failureBlock(error, objects, schema);
+        }
+    } else {
+        // The body is an array, which requestWithMethod:path:parameters: can't encode, so set it directly.  The MAC signature doesn't cover the body.
+        NSMutableURLRequest *request = [[self.session oauthClientWithHTTPS:options.isSecure] requestWithMethod:@"POST" path:schema parameters:nil];
+        [request setHTTPBody:[NSJSONSerialization dataWithJSONObject:objects options:0 error:nil]];
+        [options.headers enumerateKeysAndObjectsUsingBlock:^(id headerField, id headerValue, BOOL *stop) {
+            [request setValue:headerValue forHTTPHeaderField:headerField];
+        }];
+        SMFullResponseSuccessBlock urlSuccessBlock = [self SMFullResponseSuccessBlockForSchema:schema withBulkSuccessBlock:successBlock];
+        SMFullResponseFailureBlock urlFailureBlock = [self SMFullResponseFailureBlockForObjects:objects ofSchema:schema withFailureBlock:failureBlock];
+        [self queueWriteRequest:request toSchema:schema options:options onSuccess:urlSuccessBlock onFailure:urlFailureBlock];
     }
 }
 
@@ -111,7 +165,7 @@
 
         SMFullResponseSuccessBlock urlSuccessBlock = [self SMFullResponseSuccessBlockForSchema:schema withSuccessBlock:successBlock];
         SMFullResponseFailureBlock urlFailureBlock = [self SMFullResponseFailureBlockForObject:updatedFields ofSchema:schema withFailureBlock:failureBlock];
-        [self queueRequest:request options:options onSuccess:urlSuccessBlock onFailure:urlFailureBlock];
+        [self queueWriteRequest:request toSchema:schema options:options onSuccess:urlSuccessBlock onFailure:urlFailureBlock];
     }
 }
 
@@ -159,20 +213,23 @@
         
         SMFullResponseSuccessBlock urlSuccessBlock = [self SMFullResponseSuccessBlockForObjectId:theObjectId ofSchema:schema withSuccessBlock:successBlock];
         SMFullResponseFailureBlock urlFailureBlock = [self SMFullResponseFailureBlockForObjectId:theObjectId ofSchema:schema withFailureBlock:failureBlock];
-        [self queueRequest:request options:options onSuccess:urlSuccessBlock onFailure:urlFailureBlock];
+        [self queueWriteRequest:request toSchema:schema options:options onSuccess:urlSuccessBlock onFailure:urlFailureBlock];
     }
 }
 
 - (NSMutableURLRequest *)requestFromQuery:(SMQuery *)query options:(SMRequestOptions *)options
 {
     NSDictionary *requestHeaders    = [query requestHeaders];
-    NSDictionary *requestParameters = [query requestParameters];
-    NSString *requestPath           = [query schemaName];
+    NSString *queryString           = [query queryString];
+    NSString *requestPath           = [queryString length] > 0 ? [NSString stringWithFormat:@"%@?%@", [query schemaName], queryString] : [query schemaName];
     
-    NSMutableURLRequest *request = [[self.session oauthClientWithHTTPS:options.isSecure] requestWithMethod:@"GET" path:requestPath parameters:requestParameters];
+    NSMutableURLRequest *request = [[self.session oauthClientWithHTTPS:options.isSecure] requestWithMethod:@"GET" path:requestPath parameters:nil];
     [requestHeaders enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL *stop) {
         [request setValue:(NSString *)obj forHTTPHeaderField:(NSString *)key];
     }];
+    [options.headers enumerateKeysAndObjectsUsingBlock:^(id headerField, id headerValue, BOOL *stop) {
+        [request setValue:headerValue forHTTPHeaderField:headerField]; 
+    }];
     return request;
 }
 
@@ -181,18 +238,57 @@
     [self performQuery:query options:[SMRequestOptions options] onSuccess:successBlock onFailure:failureBlock];
 }
 
+// Headers from the options, such as X-StackMob-Select, change the results just as the query's own headers do.  So does the logged in user, whose results are kept under keys of their own.
+- (NSString *)resultCacheKeyForQuery:(SMQuery *)query options:(SMRequestOptions *)options
+{
+    NSString *key = [query fingerprint];
+    if ([options.headers count] > 0) {
+        SMQuery *keyQuery = [query copy];
+        NSMutableDictionary *requestHeaders = [NSMutableDictionary dictionaryWithDictionary:keyQuery.requestHeaders];
+        [requestHeaders addEntriesFromDictionary:options.headers];
+        keyQuery.requestHeaders = requestHeaders;
+        key = [keyQuery fingerprint];
+    }
+    NSString *userIdentifier = self.session.userIdentifier;
+    if (userIdentifier) {
+        // The key names a file on disk.
+        NSString *escapedIdentifier = (__bridge_transfer NSString *)CFURLCreateStringByAddingPercentEscapes(NULL, (__bridge CFStringRef)userIdentifier, NULL, CFSTR("/:.%"), kCFStringEncodingUTF8);
+        key = [NSString stringWithFormat:@"%@-%@", key, escapedIdentifier];
+    }
+    return key;
+}
+
 - (void)performQuery:(SMQuery *)query options:(SMRequestOptions *)options onSuccess:(SMResultsSuccessBlock)successBlock onFailure:(SMFailureBlock)failureBlock
 {
+    SMResultCache *resultCache = self.resultCache;
+    NSString *cacheKey = resultCache ? [self resultCacheKeyForQuery:query options:options] : nil;
+    NSString *schema = [query schemaName];
+    if (cacheKey) {
+        NSArray *cachedResults = [resultCache resultsForKey:cacheKey inSchema:schema];
+        if (cachedResults) {
+            dispatch_queue_t completionQueue = options.completionQueue ? options.completionQueue : self.completionQueue;
+            dispatch_async(completionQueue ? completionQueue : dispatch_get_main_queue(), ^{
+                successBlock(cachedResults);
+            });
+            return;
+        }
+    }
+    
     NSMutableURLRequest *request = [self requestFromQuery:query options:options];
+    // A write to the schema while the query is in flight leaves its results out of date.
+    NSUInteger generation = cacheKey ? [resultCache generationOfSchema:schema] : 0;
     
     SMFullResponseSuccessBlock urlSuccessBlock = ^(NSURLRequest *request, NSHTTPURLResponse *response, id JSON) {
+        if (cacheKey && [JSON isKindOfClass:[NSArray class]]) {
+            [resultCache setResults:JSON forKey:cacheKey inSchema:schema generation:generation];
+        }
         successBlock((NSArray *)JSON);
     };
     SMFullResponseFailureBlock urlFailureBlock = ^(NSURLRequest *request, NSHTTPURLResponse *response, NSError *error, id JSON) {
         NSLog(@"Query failed with error: %@, response: %@, JSON: %@", error, response, JSON);
         failureBlock(error);
     };   
-    [self queueRequest:request options:options onSuccess:urlSuccessBlock onFailure:urlFailureBlock];
+    [self queueCoalescedRequest:request options:options onSuccess:urlSuccessBlock onFailure:urlFailureBlock];
 }
 
 - (void)performCount:(SMQuery *)query onSuccess:(SMCountSuccessBlock)successBlock onFailure:(SMFailureBlock)failureBlock
@@ -202,9 +298,7 @@
 
 - (void)performCount:(SMQuery *)query options:(SMRequestOptions *)options onSuccess:(SMCountSuccessBlock)successBlock onFailure:(SMFailureBlock)failureBlock
 {
-    SMQuery *countQuery = [[SMQuery alloc] initWithSchema:query.schemaName];
-    countQuery.requestParameters = query.requestParameters;
-    countQuery.requestHeaders = [query.requestHeaders copy];
+    SMQuery *countQuery = [query copy];
     [countQuery fromIndex:0 toIndex:0];
     NSMutableURLRequest *request = [self requestFromQuery:countQuery options:options];  
     SMFullResponseSuccessBlock urlSuccessBlock = ^(NSURLRequest *request, NSHTTPURLResponse *response, id JSON) {
@@ -238,7 +332,7 @@
 
 - (void)retryCustomCodeRequest:(NSURLRequest *)request options:(SMRequestOptions *)options onSuccess:(SMFullResponseSuccessBlock)successBlock onFailure:(SMFullResponseFailureBlock)failureBlock
 {
-    [self queueRequest:[self.session signRequest:request] options:options onSuccess:successBlock onFailure:failureBlock];
+    [self queueRequest:request options:options onSuccess:successBlock onFailure:failureBlock];
 }
 
 @end
@@ -32,12 +32,14 @@ typedef enum {
     SMErrorTemporaryPasswordResetRequired = -101,
     SMErrorNoCountAvailable = -102,
     SMErrorRefreshTokenInProgress = -103,
+    SMErrorBatchSaveFailed = -104,
     //Success messages. These shouldn't normally be encountered
     SMErrorOK = 200,
     SMErrorCreated = 201,
     SMErrorPartialContent = 206,
     SMErrorMovedPermanently = 301,
     SMErrorFound = 302,
+    SMErrorNotModified = 304,
     //HTTP errors
     SMErrorBadRequest = 400,
     SMErrorUnauthorized = 401,
@@ -16,6 +16,16 @@
 
 #import "AFJSONRequestOperation.h"
 
+@class SMOAuth2Client;
+
+/**
+ The operation requests to StackMob are sent with.  When it has a <signingClient>, the request is signed as the operation starts, rather than when it is created, so time spent waiting in the operation queue can't make its timestamp stale.
+ */
 @interface SMJSONRequestOperation : AFJSONRequestOperation
 
+/**
+ The client whose credentials sign the request when the operation starts.  If nil, the request is sent as it is.
+ */
+@property (nonatomic, strong) SMOAuth2Client *signingClient;
+
 @end
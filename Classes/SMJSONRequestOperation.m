@@ -15,9 +15,25 @@
  */
 
 #import "SMJSONRequestOperation.h"
+#import "SMOAuth2Client.h"
 
 @implementation SMJSONRequestOperation
 
+@synthesize signingClient = _SM_signingClient;
+
+- (id)initWithRequest:(NSURLRequest *)urlRequest {
+    // Keep a mutable request, so start can sign it in place.
+    return [super initWithRequest:[urlRequest mutableCopy]];
+}
+
+- (void)start {
+    if (self.signingClient && ![self isCancelled]) {
+        NSAssert([self.request isKindOfClass:[NSMutableURLRequest class]], @"The request should be the mutable copy made in initWithRequest:");
+        [self.signingClient signRequest:(NSMutableURLRequest *)self.request];
+    }
+    [super start];
+}
+
 + (NSSet *)acceptableContentTypes {
     NSSet *defaultAcceptableContentTypes = [super acceptableContentTypes];
     return [defaultAcceptableContentTypes setByAddingObject:@"application/vnd.stackmob+json"];
@@ -46,25 +46,29 @@
                 publicKey:(NSString *)publicKey;
 
 /**
- Creates a signed request using the given parameters.
+ Creates a request using the given parameters.
+ 
+ The request is not signed.  Requests sent through <SMDataStore> are signed by their <SMJSONRequestOperation> just before they are sent; sign requests sent any other way with <signRequest:>.
  
  @param method The HTTP verb to use, either `POST`,`GET`, `PUT`, or `DELETE`.
  @param path The REST path.
  @param parameters A dictionary to be used as the body of the request.
  
- @return A signed request to be placed on an operation queue.
+ @return A request to be placed on an operation queue.
  */
 - (NSMutableURLRequest *)requestWithMethod:(NSString *)method 
                                        path:(NSString *)path 
                                  parameters:(NSDictionary *)parameters;
 
 /**
- Creates a signed request for a custom code method using the given parameters.
+ Creates a request for a custom code method using the given parameters.
+ 
+ Like <requestWithMethod:path:parameters:>, the request is not signed.
  
- @param request An instance of <SMCustomCodeRequest> representing the request to sign.
+ @param request An instance of <SMCustomCodeRequest> representing the request to make.
  @param options Options to be applied to the request.
  
- @return A signed request to be placed on an operation queue.
+ @return A request to be placed on an operation queue.
  */
 - (NSMutableURLRequest *)customCodeRequest:(SMCustomCodeRequest *)request options:(SMRequestOptions *)options;
 
@@ -89,10 +93,17 @@
  */
 - (NSString *)getPort;
 
+/**
+ Returns a nonce which is never repeated: a random 64-bit prefix chosen once per process followed by a counter shared by all clients.
+ 
+ @return A nonce for the MAC header.
+ */
+- (NSString *)nextNonce;
+
 /**
  Creates the MAC header for OAuth2 authorization.
  
- The current timestamp and a random nonce are used.
+ The current timestamp and a nonce from <nextNonce> are used.
  
  @param method The HTTP verb to use, either `POST`,`GET`, `PUT`, or `DELETE`.
  @param path The REST path.
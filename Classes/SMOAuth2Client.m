@@ -16,11 +16,24 @@
 
 #import "SMOAuth2Client.h"
 #import <CommonCrypto/CommonHMAC.h>
+#import <libkern/OSAtomic.h>
 #import "SMVersion.h"
 #import "SMCustomCodeRequest.h"
 #import "SMRequestOptions.h"
 #import "Base64EncodedStringFromData.h"
 
+#define SM_MAC_STRING_BUFFER_LENGTH 256
+
+@interface SMOAuth2Client ()
+
+/*
+ The signing context: the bytes of everything in the MAC base string which doesn't change between requests, computed when the client is created or its macKey is set.
+ */
+@property (atomic, strong) NSData *macKeyBytes;
+@property (nonatomic, strong) NSData *baseStringSuffixBytes;
+
+@end
+
 @implementation SMOAuth2Client
 
 @synthesize version = _SM_version;
@@ -28,6 +41,8 @@
 @synthesize apiHost = _SM_apiHost;
 @synthesize accessToken = _SM_accessToken;
 @synthesize macKey = _SM_macKey;
+@synthesize macKeyBytes = _SM_macKeyBytes;
+@synthesize baseStringSuffixBytes = _SM_baseStringSuffixBytes;
 
 - (id)initWithAPIVersion:(NSString *)version
                    scheme:(NSString *)scheme
@@ -44,10 +59,18 @@
         [self setDefaultHeader:@"X-StackMob-API-Key" value:self.publicKey];
         [self setDefaultHeader:@"User-Agent" value:[NSString stringWithFormat:@"StackMob/%@ (%@/%@; %@;)", SDK_VERSION, [[UIDevice currentDevice] model], [[UIDevice currentDevice] systemVersion], [[NSLocale currentLocale] localeIdentifier]]];
         self.parameterEncoding = AFJSONParameterEncoding;
+        // The base string ends with the host and port, newline separated, and two more newlines.
+        self.baseStringSuffixBytes = [[NSString stringWithFormat:@"\n%@\n%@\n\n", [[self baseURL] host], [self getPort]] dataUsingEncoding:NSUTF8StringEncoding];
     }
     return self;
 }
 
+- (void)setMacKey:(NSString *)macKey
+{
+    _SM_macKey = [macKey copy];
+    self.macKeyBytes = [_SM_macKey dataUsingEncoding:NSUTF8StringEncoding];
+}
+
 - (NSMutableURLRequest *)requestWithMethod:(NSString *)method 
                                        path:(NSString *)path 
                                  parameters:(NSDictionary *)parameters
@@ -57,7 +80,6 @@
     if ([method isEqualToString:@"POST"] || [method isEqualToString:@"PUT"]) {
         [request setValue:@"application/json" forHTTPHeaderField:@"Content-Type"];
     }
-    [self signRequest:request];
     return request;
 }
 
@@ -85,15 +107,14 @@
         [request setHTTPBody:[aRequest.requestBody dataUsingEncoding:NSUTF8StringEncoding]];
     }
     
-    [self signRequest:request];
     return request;
 }
 
 - (void)signRequest:(NSMutableURLRequest *)request
 {
     if ([self hasValidCredentials]) {
-        NSString *queryString = [[request URL] query] == nil ? @"" : [NSString stringWithFormat:@"&%@", [[request URL] query]];
-        NSString *pathAndQuery = [NSString stringWithFormat:@"%@%@", [[request URL] path], queryString];
+        NSString *query = [[request URL] query];
+        NSString *pathAndQuery = query == nil ? [[request URL] path] : [NSString stringWithFormat:@"%@&%@", [[request URL] path], query];
         NSString *macHeader = [self createMACHeaderForHttpMethod:[request HTTPMethod] path:pathAndQuery];
         [request setValue:macHeader forHTTPHeaderField:@"Authorization"];
     }
@@ -115,37 +136,73 @@
     }
 }
 
-- (NSString *)createMACHeaderForHttpMethod:(NSString *)method path:(NSString *)path timestamp:(double)timestamp nonce:(NSString *)nonce
+/*
+ Feeds the UTF-8 bytes of a string to an HMAC without copying the string to the heap.
+ */
+static void HmacUpdateWithString(CCHmacContext *context, NSString *string)
 {
+    const char *bytes = CFStringGetCStringPtr((__bridge CFStringRef)string, kCFStringEncodingUTF8);
+    if (bytes) {
+        CCHmacUpdate(context, bytes, strlen(bytes));
+        return;
+    }
+    char buffer[SM_MAC_STRING_BUFFER_LENGTH];
+    NSRange remaining = NSMakeRange(0, [string length]);
+    while (remaining.length > 0) {
+        NSUInteger usedLength = 0;
+        [string getBytes:buffer maxLength:sizeof(buffer) usedLength:&usedLength encoding:NSUTF8StringEncoding options:0 range:remaining remainingRange:&remaining];
+        if (usedLength == 0) {
+            break;
+        }
+        CCHmacUpdate(context, buffer, usedLength);
+    }
+}
 
-    NSString *host = [[self baseURL] host];
-    NSString *port = [self getPort];
-    
-    // create base
-    NSArray *baseArray = [NSArray arrayWithObjects:[NSString stringWithFormat:@"%.f", timestamp], nonce, method, path, host, port, nil];
-    unichar newline = 0x0A;
-    NSString *baseString = [baseArray componentsJoinedByString:[NSString stringWithFormat:@"%C", newline]];
-    baseString = [baseString stringByAppendingString:[NSString stringWithFormat:@"%C", newline]];
-    baseString = [baseString stringByAppendingString:[NSString stringWithFormat:@"%C", newline]];
+- (NSString *)createMACHeaderForHttpMethod:(NSString *)method path:(NSString *)path timestamp:(double)timestamp nonce:(NSString *)nonce
+{
+    NSData *keyBytes = self.macKeyBytes;
+    static const char newline = 0x0A;
     
-    const char *keyCString = [self.macKey cStringUsingEncoding:NSUTF8StringEncoding];
-    const char *baseCString = [baseString cStringUsingEncoding:NSUTF8StringEncoding];
+    // the base is timestamp, nonce, method, path, host and port, each followed by a newline, and one more newline
+    char timestampString[32];
+    int timestampLength = snprintf(timestampString, sizeof(timestampString), "%.f", timestamp);
     
+    CCHmacContext context;
+    CCHmacInit(&context, kCCHmacAlgSHA1, [keyBytes bytes], [keyBytes length]);
+    CCHmacUpdate(&context, timestampString, timestampLength);
+    CCHmacUpdate(&context, &newline, 1);
+    HmacUpdateWithString(&context, nonce);
+    CCHmacUpdate(&context, &newline, 1);
+    HmacUpdateWithString(&context, method);
+    CCHmacUpdate(&context, &newline, 1);
+    HmacUpdateWithString(&context, path);
+    CCHmacUpdate(&context, [self.baseStringSuffixBytes bytes], [self.baseStringSuffixBytes length]);
     
-    char buffer[CC_SHA1_DIGEST_LENGTH];
-    CCHmac(kCCHmacAlgSHA1, keyCString, strlen(keyCString), baseCString, strlen(baseCString), buffer); 
-    NSData *digestData = [NSData dataWithBytes:buffer length:CC_SHA1_DIGEST_LENGTH];
-    NSString *mac = Base64EncodedStringFromData(digestData); 
+    uint8_t digest[CC_SHA1_DIGEST_LENGTH];
+    CCHmacFinal(&context, digest);
+    char mac[Base64EncodedLength(CC_SHA1_DIGEST_LENGTH) + 1];
+    Base64EncodeBytes(digest, CC_SHA1_DIGEST_LENGTH, mac);
+    mac[Base64EncodedLength(CC_SHA1_DIGEST_LENGTH)] = '\0';
     //return 'MAC id="' + id + '",ts="' + ts + '",nonce="' + nonce + '",mac="' + mac + '"'
-    unichar quotes = 0x22;
-    NSString *returnString = [NSString stringWithFormat:@"MAC id=%C%@%C,ts=%C%.f%C,nonce=%C%@%C,mac=%C%@%C", quotes, self.accessToken, quotes, quotes, timestamp, quotes, quotes, nonce, quotes, quotes, mac, quotes];
-    return returnString; 
+    return [NSString stringWithFormat:@"MAC id=\"%@\",ts=\"%s\",nonce=\"%@\",mac=\"%s\"", self.accessToken, timestampString, nonce, mac];
 }
 
 
+- (NSString *)nextNonce
+{
+    // A random prefix per process, so nonces from different launches don't collide, and a counter, so nonces within one never do.
+    static uint64_t prefix;
+    static volatile int64_t counter = 0;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        prefix = ((uint64_t)arc4random() << 32) | arc4random();
+    });
+    return [NSString stringWithFormat:@"n%016llx%llx", prefix, (unsigned long long)OSAtomicIncrement64(&counter)];
+}
+
 - (NSString *)createMACHeaderForHttpMethod:(NSString *)method path:(NSString *)path
 {
-    return [self createMACHeaderForHttpMethod:method path:path timestamp:[[NSDate date] timeIntervalSince1970] nonce:[NSString stringWithFormat:@"n%d", arc4random() % 10000]];
+    return [self createMACHeaderForHttpMethod:method path:path timestamp:[[NSDate date] timeIntervalSince1970] nonce:[self nextNonce]];
 }
 
 @end
@@ -24,14 +24,23 @@
  `SMQuery` uses StackMob's terminology:
  - Queries are performed against a specific _schema_ (usually also the name of a model class or of an entity in a managed object model)
  - Queries may select or order based on the _values_ of the _fields_ of an object belonging to their _schema_.
+ 
+ Copies of a query share none of its parameters or headers, so conditions added to a copy do not affect the original.
  */
-@interface SMQuery : NSObject
+@interface SMQuery : NSObject <NSCopying>
 ///-------------------------------
 /// @name Properties
 ///-------------------------------
 
+/**
+ conditions holds the conditions of the query in the order they were added, each as an `NSArray` of the parameter key and its value, i.e. for a request that looks like `GET /something?key=value`, it holds the condition `[key, value]`.  See <addConditionForKey:value:> for how a parameter constrained more than once is handled.
+ */
+@property (readonly) NSArray *conditions;
+
 /** 
  requestParameters holds the HTTP request parameters i.e. for a request that looks like `GET /something?key=value`, it holds a dictionary entry mapping `key` to `value`.
+ 
+ This is a view of <conditions>; if a parameter is repeated, only its last value appears.  Setting it replaces the conditions with its entries, in order of their keys.
  */
 @property (nonatomic, strong) NSDictionary *requestParameters;
 
@@ -64,6 +73,19 @@
  */
 - (id)initWithSchema:(NSString *)schema;
 
+/**
+ Returns the conditions serialized as a URL query string, e.g. `key1=value1&key2=value2`.
+ 
+ The serialization is deterministic: conditions are ordered by parameter key, with repeated parameters kept in the order they were added, and values are percent escaped.  Queries with the same conditions therefore serialize identically however they were built.
+ */
+- (NSString *)queryString;
+
+/**
+ Returns a stable fingerprint of the query: a hex encoded SHA-1 digest of the schema, the <queryString> and the request headers (such as `Range` and `X-StackMob-OrderBy`) sorted by name.
+ 
+ Two queries which would produce the same request have the same fingerprint, however their conditions were built, so the fingerprint is suitable as a key for caching results.
+ */
+- (NSString *)fingerprint;
 
 
 #pragma mark - Where clauses
@@ -71,6 +93,16 @@
 /// @name Where Clauses
 ///-------------------------------
 
+/**
+ Adds a condition on a raw request parameter, such as `field[lt]`.  The where clauses below are built on this method.
+ 
+ A repeated bound on a field (`[lt]`, `[lte]`, `[gt]` or `[gte]`) keeps whichever of the two values is tighter, and repeated `[ne]` conditions are all kept and sent as a repeated parameter, with exact repeats dropped.  Any other parameter, such as equality, `[in]`, `[within]` or `[near]`, takes the value it was last given.  A nil value removes every condition on the parameter.
+ 
+ @param key The request parameter.
+ @param value The value of the request parameter.
+ */
+- (void)addConditionForKey:(NSString *)key value:(id)value;
+
 /**
  Add the query criteria: field == value.
  
@@ -15,6 +15,8 @@
  */
 
 #import "SMQuery.h"
+#import "AFHTTPClient.h"
+#import <CommonCrypto/CommonDigest.h>
 
 #define CONCAT(prefix, suffix) ([NSString stringWithFormat:@"%@%@", prefix, suffix])
 
@@ -23,9 +25,15 @@
 
 // TODO: header keys to #defines?
 
+@interface SMQuery ()
+
+@property (nonatomic, strong) NSMutableArray *mutableConditions;
+
+@end
+
 @implementation SMQuery
 
-@synthesize requestParameters = _requestParameters;
+@synthesize mutableConditions = _mutableConditions;
 @synthesize requestHeaders = _requestHeaders;
 @synthesize schemaName = _schemaName;
 
@@ -40,54 +48,156 @@
     self = [super init];
     if (self) {
         _schemaName = schema;
-        _requestParameters = [NSMutableDictionary dictionaryWithCapacity:1];
+        _mutableConditions = [NSMutableArray arrayWithCapacity:1];
         _requestHeaders = [NSMutableDictionary dictionaryWithCapacity:1];
     }
     return self;
 }
 
+- (id)copyWithZone:(NSZone *)zone
+{
+    SMQuery *copy = [[SMQuery allocWithZone:zone] initWithSchema:self.schemaName];
+    copy.mutableConditions = [self.mutableConditions mutableCopy];
+    copy.requestHeaders = [self.requestHeaders mutableCopy];
+    return copy;
+}
+
+- (NSArray *)conditions
+{
+    return [self.mutableConditions copy];
+}
+
+- (NSDictionary *)requestParameters
+{
+    NSMutableDictionary *requestParameters = [NSMutableDictionary dictionaryWithCapacity:[self.mutableConditions count]];
+    for (NSArray *condition in self.mutableConditions) {
+        [requestParameters setObject:[condition objectAtIndex:1] forKey:[condition objectAtIndex:0]];
+    }
+    return requestParameters;
+}
+
+- (void)setRequestParameters:(NSDictionary *)requestParameters
+{
+    self.mutableConditions = [NSMutableArray arrayWithCapacity:[requestParameters count]];
+    for (NSString *key in [[requestParameters allKeys] sortedArrayUsingSelector:@selector(compare:)]) {
+        [self.mutableConditions addObject:[NSArray arrayWithObjects:key, [requestParameters objectForKey:key], nil]];
+    }
+}
+
+static BOOL isComparable(id value, id otherValue)
+{
+    for (Class class in [NSArray arrayWithObjects:[NSNumber class], [NSString class], [NSDate class], nil]) {
+        if ([value isKindOfClass:class] && [otherValue isKindOfClass:class]) {
+            return YES;
+        }
+    }
+    return NO;
+}
+
+- (void)addConditionForKey:(NSString *)key value:(id)value
+{
+    if (value == nil) {
+        NSIndexSet *conditionsOnKey = [self.mutableConditions indexesOfObjectsPassingTest:^BOOL(id condition, NSUInteger idx, BOOL *stop) {
+            return [[condition objectAtIndex:0] isEqualToString:key];
+        }];
+        [self.mutableConditions removeObjectsAtIndexes:conditionsOnKey];
+        return;
+    }
+    
+    BOOL isUpperBound = [key hasSuffix:@"[lt]"] || [key hasSuffix:@"[lte]"];
+    BOOL isLowerBound = [key hasSuffix:@"[gt]"] || [key hasSuffix:@"[gte]"];
+    // Only bounds and exclusions combine; a field can't equal two values, or be in, within or near two places at once.
+    BOOL combines = isUpperBound || isLowerBound || [key hasSuffix:@"[ne]"];
+    
+    for (NSUInteger i = 0; i < [self.mutableConditions count]; i++) {
+        NSArray *condition = [self.mutableConditions objectAtIndex:i];
+        if (![[condition objectAtIndex:0] isEqualToString:key]) {
+            continue;
+        }
+        id existingValue = [condition objectAtIndex:1];
+        if (!combines) {
+            [self.mutableConditions replaceObjectAtIndex:i withObject:[NSArray arrayWithObjects:key, value, nil]];
+            return;
+        }
+        if ([existingValue isEqual:value]) {
+            return;
+        }
+        if ((isUpperBound || isLowerBound) && isComparable(existingValue, value)) {
+            NSComparisonResult order = [value compare:existingValue];
+            if ((isUpperBound && order == NSOrderedAscending) || (isLowerBound && order == NSOrderedDescending)) {
+                [self.mutableConditions replaceObjectAtIndex:i withObject:[NSArray arrayWithObjects:key, value, nil]];
+            }
+            return;
+        }
+    }
+    
+    [self.mutableConditions addObject:[NSArray arrayWithObjects:key, value, nil]];
+}
+
+- (NSString *)queryString
+{
+    NSArray *sortedConditions = [self.mutableConditions sortedArrayWithOptions:NSSortStable usingComparator:^NSComparisonResult(id condition, id otherCondition) {
+        return [[condition objectAtIndex:0] compare:[otherCondition objectAtIndex:0]];
+    }];
+    NSMutableArray *components = [NSMutableArray arrayWithCapacity:[sortedConditions count]];
+    for (NSArray *condition in sortedConditions) {
+        [components addObject:[NSString stringWithFormat:@"%@=%@", [condition objectAtIndex:0], AFURLEncodedStringFromStringWithEncoding([[condition objectAtIndex:1] description], NSUTF8StringEncoding)]];
+    }
+    return [components componentsJoinedByString:@"&"];
+}
+
+- (NSString *)fingerprint
+{
+    NSMutableArray *components = [NSMutableArray arrayWithObjects:self.schemaName, [self queryString], nil];
+    for (NSString *header in [[self.requestHeaders allKeys] sortedArrayUsingSelector:@selector(caseInsensitiveCompare:)]) {
+        [components addObject:[NSString stringWithFormat:@"%@: %@", [header lowercaseString], [self.requestHeaders objectForKey:header]]];
+    }
+    NSData *canonicalData = [[components componentsJoinedByString:@"\n"] dataUsingEncoding:NSUTF8StringEncoding];
+    
+    unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+    CC_SHA1([canonicalData bytes], (CC_LONG)[canonicalData length], digest);
+    NSMutableString *fingerprint = [NSMutableString stringWithCapacity:CC_SHA1_DIGEST_LENGTH * 2];
+    for (int i = 0; i < CC_SHA1_DIGEST_LENGTH; i++) {
+        [fingerprint appendFormat:@"%02x", digest[i]];
+    }
+    return fingerprint;
+}
+
 // TODO: == and != maybe should do something smart with nil, like map it into key[null] = ...
 - (void)where:(NSString *)field isEqualTo:(id)value
 {
-    [self.requestParameters setValue:value 
-                              forKey:field];
+    [self addConditionForKey:field value:value];
 }
 
 - (void)where:(NSString *)field isNotEqualTo:(id)value
 {
-    [self.requestParameters setValue:value
-                              forKey:CONCAT(field, @"[ne]")];
+    [self addConditionForKey:CONCAT(field, @"[ne]") value:value];
 }
 
 - (void)where:(NSString *)field isLessThan:(id)value
 {
-    [self.requestParameters setValue:value
-                              forKey:CONCAT(field, @"[lt]")];
+    [self addConditionForKey:CONCAT(field, @"[lt]") value:value];
 }
 
 - (void)where:(NSString *)field isLessThanOrEqualTo:(id)value
 {
-    [self.requestParameters setValue:value
-                              forKey:CONCAT(field, @"[lte]")];
+    [self addConditionForKey:CONCAT(field, @"[lte]") value:value];
 }
 
 - (void)where:(NSString *)field isGreaterThan:(id)value
 {
-    [self.requestParameters setValue:value
-                              forKey:CONCAT(field, @"[gt]")];
+    [self addConditionForKey:CONCAT(field, @"[gt]") value:value];
 }
 
 - (void)where:(NSString *)field isGreaterThanOrEqualTo:(id)value
 {
-    [self.requestParameters setValue:value
-                              forKey:CONCAT(field, @"[gte]")];
+    [self addConditionForKey:CONCAT(field, @"[gte]") value:value];
 }
 
 - (void)where:(NSString *)field isIn:(NSArray *)valuesArray
 {
     NSString *possibleValues = [valuesArray componentsJoinedByString:@","];
-    [self.requestParameters setValue:possibleValues
-                              forKey:CONCAT(field, @"[in]")];
+    [self addConditionForKey:CONCAT(field, @"[in]") value:possibleValues];
 }
 
 - (void)where:(NSString *)field isWithin:(CLLocationDistance)miles milesOf:(CLLocationCoordinate2D)point
@@ -98,8 +208,7 @@
                              point.longitude, 
                              radius];
     
-    [self.requestParameters setValue:withinParam
-                              forKey:CONCAT(field, @"[within]")];
+    [self addConditionForKey:CONCAT(field, @"[within]") value:withinParam];
 }
 
 - (void)where:(NSString *)field isWithin:(CLLocationDistance)meters metersOf:(CLLocationCoordinate2D)point
@@ -109,8 +218,7 @@
                              point.latitude, 
                              point.longitude, 
                              radius];
-    [self.requestParameters setValue:withinParam
-                              forKey:CONCAT(field, @"[within]")];
+    [self addConditionForKey:CONCAT(field, @"[within]") value:withinParam];
 }
 
 - (void)where:(NSString *)field isWithinBoundsWithSWCorner:(CLLocationCoordinate2D)sw andNECorner:(CLLocationCoordinate2D)ne
@@ -120,8 +228,7 @@
                              sw.longitude,
                              ne.latitude,
                              ne.longitude];                            
-    [self.requestParameters setValue:withinParam
-                              forKey:CONCAT(field, @"[within]")];
+    [self addConditionForKey:CONCAT(field, @"[within]") value:withinParam];
 }
 
 // TODO: how do we highlight to the user that this is going to add a 'distance' field and will ignore order by criteria
@@ -129,8 +236,7 @@
     NSString *nearParam = [NSString stringWithFormat:@"%f,%f",
                            point.latitude, point.longitude];
     
-    [self.requestParameters setValue:nearParam 
-                              forKey:CONCAT(field, @"[near]")];
+    [self addConditionForKey:CONCAT(field, @"[near]") value:nearParam];
 }
 
 - (void)fromIndex:(NSUInteger)start toIndex:(NSUInteger)end
@@ -64,6 +64,13 @@
  */
 @property (nonatomic, strong) SMFailureRetryBlock retryBlock;
 
+/**
+ The dispatch queue on which the request's success and failure blocks, and any 503 retries, are run.  Overrides the `completionQueue` of the <SMDataStore> the request is made with.
+ 
+ If neither is set, success and failure blocks run on the main queue and retries are scheduled on a global queue.
+ */
+@property (nonatomic, assign) dispatch_queue_t completionQueue;
+
 ///-------------------------------
 /// @name Initialize
 ///-------------------------------
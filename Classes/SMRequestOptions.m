@@ -23,6 +23,7 @@
 @synthesize tryRefreshToken = _SM_tryRefreshToken;
 @synthesize numberOfRetries = _SM_numberOfRetries;
 @synthesize retryBlock = _SM_retryBlock;
+@synthesize completionQueue = _SM_completionQueue;
 
 
 + (SMRequestOptions *)options
@@ -65,12 +66,20 @@
 
 - (void)setExpandDepth:(NSUInteger)depth
 {
-    [self.headers setValue:[NSString stringWithFormat:@"%d", depth] forKey:@"X-StackMob-Expand"];
+    [self setHeaderValue:[NSString stringWithFormat:@"%d", depth] forKey:@"X-StackMob-Expand"];
 }
 
 - (void)restrictReturnedFieldsTo:(NSArray *)fields
 {
-    [self.headers setValue:[fields componentsJoinedByString:@","] forKey:@"X-StackMob-Select"];
+    [self setHeaderValue:[fields componentsJoinedByString:@","] forKey:@"X-StackMob-Select"];
+}
+
+// headers may be nil or immutable, so build a new dictionary rather than setting the value in place
+- (void)setHeaderValue:(NSString *)value forKey:(NSString *)key
+{
+    NSMutableDictionary *headers = [NSMutableDictionary dictionaryWithDictionary:self.headers];
+    [headers setValue:value forKey:key];
+    self.headers = headers;
 }
 
 - (void)addSMErrorServiceUnavailableRetryBlock:(SMFailureRetryBlock)retryBlock
@@ -78,4 +87,24 @@
     self.retryBlock = retryBlock;
 }
 
+- (void)setCompletionQueue:(dispatch_queue_t)completionQueue
+{
+    if (completionQueue != _SM_completionQueue) {
+        if (_SM_completionQueue) {
+            dispatch_release(_SM_completionQueue);
+        }
+        if (completionQueue) {
+            dispatch_retain(completionQueue);
+        }
+        _SM_completionQueue = completionQueue;
+    }
+}
+
+- (void)dealloc
+{
+    if (_SM_completionQueue) {
+        dispatch_release(_SM_completionQueue);
+    }
+}
+
 @end
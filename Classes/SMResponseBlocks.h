@@ -81,6 +81,24 @@ typedef void (^SMDataStoreFailureBlock)(NSError *theError, NSDictionary* theObje
  */
 typedef void (^SMDataStoreObjectIdFailureBlock)(NSError *theError, NSString* theObjectId, NSString *schema);
 
+/** 
+ The block parameters expected for a success response from a call to the data store which creates multiple objects in one request.
+ 
+ @param succeeded An array of the object ids which were created.
+ @param failed An array describing each object StackMob could not create.
+ @param schema The schema to which the objects belong.
+ */
+typedef void (^SMDataStoreBulkSuccessBlock)(NSArray *succeeded, NSArray *failed, NSString *schema);
+
+/** 
+ The block parameters expected for a failure response from a call to the data store which creates multiple objects in one request.
+ 
+ @param theError An error object describing the failure.
+ @param objects The dictionary representations of the objects sent as part of the failed operation.
+ @param schema The schema to which the objects belong.
+ */
+typedef void (^SMDataStoreBulkFailureBlock)(NSError *theError, NSArray *objects, NSString *schema);
+
 /** 
  The block parameters expected for a success response from query count call.
  
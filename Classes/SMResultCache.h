@@ -0,0 +1,103 @@
+/*
+ * Copyright 2012 StackMob
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#import <Foundation/Foundation.h>
+
+/**
+ `SMResultCache` keeps the results of queries for a limited time, in memory and on disk, so that identical queries made within its <timeToLive> are answered without a network request.
+ 
+ Set an instance as the `resultCache` of an <SMDataStore> to put it in front of <SMDataStore performQuery:options:onSuccess:onFailure:>.  Results are keyed by the fingerprint of the query (see <SMQuery fingerprint>) and filed under the query's schema; writes made through the data store remove every cached result for the schemas they touch.  The data store keeps each logged in user's results under separate keys.
+ 
+ Results on disk live in the application's Caches directory, separately for each cache name, and survive a relaunch until they expire.
+ */
+@interface SMResultCache : NSObject
+
+/**
+ The name of the cache, which also names its directory on disk.
+ */
+@property (nonatomic, readonly, copy) NSString *name;
+
+/**
+ How long, in seconds, results are served after they were stored.
+ */
+@property (nonatomic, readonly) NSTimeInterval timeToLive;
+
+/**
+ The number of lookups answered from the cache.
+ */
+@property (readonly) NSUInteger hitCount;
+
+/**
+ The number of lookups which found no unexpired results.
+ */
+@property (readonly) NSUInteger missCount;
+
+/**
+ Initializes a result cache.
+ 
+ @param name The name of the cache.  Caches with the same name share their results on disk.
+ @param timeToLive How long, in seconds, results are served after they were stored.
+ */
+- (id)initWithName:(NSString *)name timeToLive:(NSTimeInterval)timeToLive;
+
+/**
+ Returns the unexpired results stored for a key, or nil, and counts a hit or a miss.
+ 
+ @param key The key the results were stored under, usually a query fingerprint.
+ @param schema The schema the results belong to.
+ */
+- (NSArray *)resultsForKey:(NSString *)key inSchema:(NSString *)schema;
+
+/**
+ Returns the current generation of a schema, which changes whenever its results are removed.  Take it when starting a query, and pass it to <setResults:forKey:inSchema:generation:> when the query finishes.
+ 
+ @param schema The schema.
+ */
+- (NSUInteger)generationOfSchema:(NSString *)schema;
+
+/**
+ Stores results for a key.  The results are written to disk in the background.
+ 
+ @param results The results, an array of object dictionaries.
+ @param key The key to store the results under, usually a query fingerprint.
+ @param schema The schema the results belong to.
+ */
+- (void)setResults:(NSArray *)results forKey:(NSString *)key inSchema:(NSString *)schema;
+
+/**
+ Stores results for a key like <setResults:forKey:inSchema:>, unless the schema's results were removed since generation was taken, in which case the results may predate a write and are dropped.
+ 
+ @param results The results, an array of object dictionaries.
+ @param key The key to store the results under, usually a query fingerprint.
+ @param schema The schema the results belong to.
+ @param generation The generation of the schema when the query which returned the results started.
+ */
+- (void)setResults:(NSArray *)results forKey:(NSString *)key inSchema:(NSString *)schema generation:(NSUInteger)generation;
+
+/**
+ Removes every result stored for a schema, in memory and on disk.
+ 
+ @param schema The schema.
+ */
+- (void)removeResultsInSchema:(NSString *)schema;
+
+/**
+ Removes every result in the cache, in memory and on disk.
+ */
+- (void)removeAllResults;
+
+@end
@@ -0,0 +1,215 @@
+/*
+ * Copyright 2012 StackMob
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#import "SMResultCache.h"
+
+#define SM_RESULT_CACHE_DIRECTORY @"com.stackmob.resultcache"
+#define SM_RESULT_CACHE_DATE_KEY @"date"
+#define SM_RESULT_CACHE_RESULTS_KEY @"results"
+
+@interface SMResultCache ()
+
+@property (nonatomic, readwrite, copy) NSString *name;
+@property (nonatomic, readwrite) NSTimeInterval timeToLive;
+@property (readwrite) NSUInteger hitCount;
+@property (readwrite) NSUInteger missCount;
+@property (nonatomic, strong) NSString *path;
+@property (nonatomic, strong) NSCache *memoryCache;
+// Maps each schema to the memory cache keys filed under it, so a write can evict them.
+@property (nonatomic, strong) NSMutableDictionary *keysBySchema;
+// The generation each schema's results were last removed in, and the generation all results were last removed in.
+@property (nonatomic, strong) NSMutableDictionary *generationsBySchema;
+@property (nonatomic) NSUInteger removeAllGeneration;
+@property (nonatomic) NSUInteger lastGeneration;
+@property (nonatomic, readwrite, assign) dispatch_queue_t queue;
+
+@end
+
+@implementation SMResultCache
+
+@synthesize name = _SM_name;
+@synthesize timeToLive = _SM_timeToLive;
+@synthesize hitCount = _SM_hitCount;
+@synthesize missCount = _SM_missCount;
+@synthesize path = _SM_path;
+@synthesize memoryCache = _SM_memoryCache;
+@synthesize keysBySchema = _SM_keysBySchema;
+@synthesize generationsBySchema = _SM_generationsBySchema;
+@synthesize removeAllGeneration = _SM_removeAllGeneration;
+@synthesize lastGeneration = _SM_lastGeneration;
+@synthesize queue = _SM_queue;
+
+- (id)initWithName:(NSString *)name timeToLive:(NSTimeInterval)timeToLive
+{
+    self = [super init];
+    if (self) {
+        self.name = name;
+        self.timeToLive = timeToLive;
+        NSString *cachesDirectory = [NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES) lastObject];
+        self.path = [[cachesDirectory stringByAppendingPathComponent:SM_RESULT_CACHE_DIRECTORY] stringByAppendingPathComponent:name];
+        self.memoryCache = [[NSCache alloc] init];
+        self.keysBySchema = [NSMutableDictionary dictionary];
+        self.generationsBySchema = [NSMutableDictionary dictionary];
+        self.queue = dispatch_queue_create("com.stackmob.resultcache", NULL);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    if (_SM_queue) {
+        dispatch_release(_SM_queue);
+    }
+}
+
+- (NSString *)pathForKey:(NSString *)key inSchema:(NSString *)schema
+{
+    return [[self.path stringByAppendingPathComponent:schema] stringByAppendingPathComponent:key];
+}
+
+- (NSString *)memoryKeyForKey:(NSString *)key inSchema:(NSString *)schema
+{
+    return [NSString stringWithFormat:@"%@/%@", schema, key];
+}
+
+- (BOOL)entryHasExpired:(NSDictionary *)entry
+{
+    NSDate *date = [entry objectForKey:SM_RESULT_CACHE_DATE_KEY];
+    return date == nil || -[date timeIntervalSinceNow] > self.timeToLive;
+}
+
+- (NSArray *)resultsForKey:(NSString *)key inSchema:(NSString *)schema
+{
+    __block NSArray *results = nil;
+    dispatch_sync(self.queue, ^{
+        NSString *memoryKey = [self memoryKeyForKey:key inSchema:schema];
+        NSDictionary *entry = [self.memoryCache objectForKey:memoryKey];
+        if (entry == nil) {
+            NSData *data = [NSData dataWithContentsOfFile:[self pathForKey:key inSchema:schema]];
+            if (data) {
+                @try {
+                    entry = [NSKeyedUnarchiver unarchiveObjectWithData:data];
+                }
+                @catch (NSException *exception) {
+                    entry = nil;
+                }
+            }
+            if (entry) {
+                [self.memoryCache setObject:entry forKey:memoryKey];
+                [self fileMemoryKey:memoryKey inSchema:schema];
+            }
+        }
+        if (entry && [self entryHasExpired:entry]) {
+            [self.memoryCache removeObjectForKey:memoryKey];
+            [[NSFileManager defaultManager] removeItemAtPath:[self pathForKey:key inSchema:schema] error:nil];
+            entry = nil;
+        }
+        results = [entry objectForKey:SM_RESULT_CACHE_RESULTS_KEY];
+        if (results) {
+            self.hitCount++;
+        } else {
+            self.missCount++;
+        }
+    });
+    return results;
+}
+
+- (void)fileMemoryKey:(NSString *)memoryKey inSchema:(NSString *)schema
+{
+    NSMutableSet *keys = [self.keysBySchema objectForKey:schema];
+    if (keys == nil) {
+        keys = [NSMutableSet set];
+        [self.keysBySchema setObject:keys forKey:schema];
+    }
+    [keys addObject:memoryKey];
+}
+
+// Must be called on the queue.
+- (NSUInteger)currentGenerationOfSchema:(NSString *)schema
+{
+    return MAX([[self.generationsBySchema objectForKey:schema] unsignedIntegerValue], self.removeAllGeneration);
+}
+
+- (NSUInteger)generationOfSchema:(NSString *)schema
+{
+    __block NSUInteger generation = 0;
+    dispatch_sync(self.queue, ^{
+        generation = [self currentGenerationOfSchema:schema];
+    });
+    return generation;
+}
+
+- (void)setResults:(NSArray *)results forKey:(NSString *)key inSchema:(NSString *)schema
+{
+    [self setResults:results forKey:key inSchema:schema generation:[self generationOfSchema:schema]];
+}
+
+- (void)setResults:(NSArray *)results forKey:(NSString *)key inSchema:(NSString *)schema generation:(NSUInteger)generation
+{
+    if (results == nil || key == nil || schema == nil) {
+        return;
+    }
+    NSDictionary *entry = [NSDictionary dictionaryWithObjectsAndKeys:[NSDate date], SM_RESULT_CACHE_DATE_KEY, results, SM_RESULT_CACHE_RESULTS_KEY, nil];
+    __block BOOL stale = NO;
+    dispatch_sync(self.queue, ^{
+        stale = [self currentGenerationOfSchema:schema] != generation;
+        if (stale) {
+            return;
+        }
+        NSString *memoryKey = [self memoryKeyForKey:key inSchema:schema];
+        [self.memoryCache setObject:entry forKey:memoryKey];
+        [self fileMemoryKey:memoryKey inSchema:schema];
+    });
+    if (stale) {
+        return;
+    }
+    // Writing to disk doesn't hold up the caller; the queue is serial, so a later removal still wins.
+    dispatch_async(self.queue, ^{
+        NSString *path = [self pathForKey:key inSchema:schema];
+        [[NSFileManager defaultManager] createDirectoryAtPath:[path stringByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:nil];
+        [[NSKeyedArchiver archivedDataWithRootObject:entry] writeToFile:path atomically:YES];
+    });
+}
+
+- (void)removeResultsInSchema:(NSString *)schema
+{
+    if (schema == nil) {
+        return;
+    }
+    dispatch_sync(self.queue, ^{
+        for (NSString *memoryKey in [self.keysBySchema objectForKey:schema]) {
+            [self.memoryCache removeObjectForKey:memoryKey];
+        }
+        [self.keysBySchema removeObjectForKey:schema];
+        self.lastGeneration++;
+        [self.generationsBySchema setObject:[NSNumber numberWithUnsignedInteger:self.lastGeneration] forKey:schema];
+        [[NSFileManager defaultManager] removeItemAtPath:[self.path stringByAppendingPathComponent:schema] error:nil];
+    });
+}
+
+- (void)removeAllResults
+{
+    dispatch_sync(self.queue, ^{
+        [self.memoryCache removeAllObjects];
+        [self.keysBySchema removeAllObjects];
+        self.lastGeneration++;
+        self.removeAllGeneration = self.lastGeneration;
+        [[NSFileManager defaultManager] removeItemAtPath:self.path error:nil];
+    });
+}
+
+@end
@@ -25,7 +25,7 @@
  An `SMUserSession` holds all the OAuth2 credentials and configurations for the current client.  It is responsible for:
  
  * Saving and clearing credentials.
- * Re-authenticating a session using a refresh token.
+ * Re-authenticating a session using a refresh token, in the background shortly before the access token expires, or when a request comes back unauthorized.
  * Declaring whether a given request should be https or not.
  
  @note You should not need to instantiate your own `SMUserSession` instance.  One is initialized when creating an <SMClient> and is used to monitor authentication for all requests sent through that client.
@@ -42,6 +42,21 @@
 @property (atomic) BOOL refreshing;
 @property (nonatomic, copy) NSString *oauthStorageKey;
 
+/**
+ The name of the field in the user schema which uniquely identifies each user.  Set by <SMClient>.
+ */
+@property (nonatomic, copy) NSString *userIdName;
+
+/**
+ The value of <userIdName> for the user the current tokens belong to, or nil when no user is logged in.  Saved with the tokens, so it survives relaunches, and cleared by <clearSessionInfo>.
+ */
+@property (nonatomic, copy) NSString *userIdentifier;
+
+/**
+ How long before the access token expires to refresh it in the background, so requests don't wait on a refresh.  Default is 60 seconds.  Tokens which live no longer than the margin are refreshed halfway through their lifetime instead.  Set to 0 to only refresh once the token has expired or a request comes back unauthorized.
+ */
+@property (nonatomic) NSTimeInterval tokenRefreshMargin;
+
 /**
  Internal method used by `SMUserSession` to check if the expiration date on the current access token has expired.
  
@@ -57,6 +72,8 @@
 /**
  Makes a request to refresh the current user session using the refresh token.
  
+ Only one refresh is made at a time.  If a refresh is already in progress, no new request is made and the blocks are called with the result of the refresh in progress once it completes.
+ 
  @param successBlock Upon success provides the user object.
  @param failureBlock Upon failure to refresh the session, provides the error.
  */
@@ -115,6 +132,15 @@
  */
 - (void)saveAccessTokenInfo:(NSDictionary *)result;
 
+/**
+ Returns whether the request was signed with the current access token.  Requests signed before the last refresh return `NO`, and can be signed again rather than triggering another refresh.  Unsigned requests, or any request when there is no access token, return `YES`.
+ 
+ @param request The request to check.
+ 
+ @return `NO` if the request's Authorization header names a different access token, otherwise `YES`.
+ */
+- (BOOL)requestIsSignedWithCurrentToken:(NSURLRequest *)request;
+
 /**
  Signs the request.
  
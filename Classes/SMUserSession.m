@@ -22,7 +22,16 @@
 #define EXPIRES_IN @"expires_in"
 #define MAC_KEY @"mac_key"
 #define REFRESH_TOKEN @"refresh_token"
+#define USER_IDENTIFIER @"user_identifier"
 
+#define SM_DEFAULT_TOKEN_REFRESH_MARGIN 60.0
+
+@interface SMUserSession ()
+
+@property (nonatomic, strong) NSMutableArray *refreshWaiters;
+@property (atomic) NSUInteger refreshGeneration;
+
+@end
 
 @implementation SMUserSession
 
@@ -35,6 +44,11 @@
 @synthesize refreshToken = _SM_refreshToken;
 @synthesize refreshing = _SM_refreshing;
 @synthesize oauthStorageKey = _SM_oauthStorageKey;
+@synthesize refreshWaiters = _SM_refreshWaiters;
+@synthesize refreshGeneration = _SM_refreshGeneration;
+@synthesize tokenRefreshMargin = _SM_tokenRefreshMargin;
+@synthesize userIdName = _SM_userIdName;
+@synthesize userIdentifier = _SM_userIdentifier;
 
 - (id)initWithAPIVersion:(NSString *)version 
                  apiHost:(NSString *)apiHost 
@@ -52,7 +66,10 @@
         [self.tokenClient setDefaultHeader:@"Content-Type" value:@"application/x-www-form-urlencoded"];
         [self.tokenClient setDefaultHeader:@"User-Agent" value:[NSString stringWithFormat:@"StackMob/%@ (%@/%@; %@;)", SDK_VERSION, [[UIDevice currentDevice] model], [[UIDevice currentDevice] systemVersion], [[NSLocale currentLocale] localeIdentifier]]];
         self.userSchema = userSchema;
+        self.userIdName = DEFAULT_USER_ID_NAME;
         self.refreshing = NO;
+        self.refreshWaiters = [NSMutableArray array];
+        _SM_tokenRefreshMargin = SM_DEFAULT_TOKEN_REFRESH_MARGIN;
         self.oauthStorageKey = [NSString stringWithFormat:@"%@.oauth", publicKey];
         [self saveAccessTokenInfo:[[NSUserDefaults standardUserDefaults] dictionaryForKey:self.oauthStorageKey]];
         
@@ -86,18 +103,90 @@
             NSError *error = [[NSError alloc] initWithDomain:SMErrorDomain code:SMErrorInvalidArguments userInfo:nil];
             failureBlock(error);
         }
-    } else if (self.refreshing) {
-        if (failureBlock) {
-            NSError *error = [[NSError alloc] initWithDomain:SMErrorDomain code:SMErrorRefreshTokenInProgress userInfo:nil];
-            failureBlock(error);
-        }
     } else {
-        self.refreshing = YES;//Don't ever trigger two refreshToken calls
-        [self doTokenRequestWithEndpoint:@"refreshToken" credentials:[NSDictionary dictionaryWithObjectsAndKeys:self.refreshToken, @"refresh_token", nil] options:[SMRequestOptions options] onSuccess:successBlock onFailure:failureBlock]; 
+        BOOL startRefresh = NO;
+        NSMutableDictionary *waiter = [NSMutableDictionary dictionary];
+        [waiter setValue:[successBlock copy] forKey:@"success"];
+        [waiter setValue:[failureBlock copy] forKey:@"failure"];
+        @synchronized(self.refreshWaiters) {
+            [self.refreshWaiters addObject:waiter];
+            //Don't ever trigger two refreshToken calls, callers arriving during a refresh wait for its result
+            startRefresh = !self.refreshing;
+            self.refreshing = YES;
+        }
+        if (startRefresh) {
+            [self doTokenRequestWithEndpoint:@"refreshToken" credentials:[NSDictionary dictionaryWithObjectsAndKeys:self.refreshToken, @"refresh_token", nil] options:[SMRequestOptions options] onSuccess:^(NSDictionary *userObject) {
+                [self finishRefreshWithUserObject:userObject error:nil];
+            } onFailure:^(NSError *theError) {
+                [self finishRefreshWithUserObject:nil error:theError];
+            }];
+        }
     }
     
 }
 
+- (void)finishRefreshWithUserObject:(NSDictionary *)userObject error:(NSError *)error
+{
+    NSArray *waiters = nil;
+    @synchronized(self.refreshWaiters) {
+        waiters = [self.refreshWaiters copy];
+        [self.refreshWaiters removeAllObjects];
+        self.refreshing = NO;
+    }
+    for (NSDictionary *waiter in waiters) {
+        if (error) {
+            void (^failureBlock)(NSError *) = [waiter objectForKey:@"failure"];
+            if (failureBlock) {
+                failureBlock(error);
+            }
+        } else {
+            void (^successBlock)(NSDictionary *) = [waiter objectForKey:@"success"];
+            if (successBlock) {
+                successBlock(userObject);
+            }
+        }
+    }
+}
+
+- (void)setTokenRefreshMargin:(NSTimeInterval)tokenRefreshMargin
+{
+    _SM_tokenRefreshMargin = tokenRefreshMargin;
+    [self scheduleTokenRefresh];
+}
+
+- (void)scheduleTokenRefresh
+{
+    // Any refresh scheduled for earlier credentials is abandoned when it fires.
+    NSUInteger generation;
+    @synchronized(self) {
+        generation = ++_SM_refreshGeneration;
+    }
+    if (self.refreshToken == nil || self.expiration == nil || self.tokenRefreshMargin <= 0) {
+        return;
+    }
+    // Never sooner than halfway through the remaining lifetime, or a token which lives no longer than the margin would be refreshed again as soon as it arrives.
+    NSTimeInterval lifetime = [self.expiration timeIntervalSinceNow];
+    NSTimeInterval delay = MAX(MAX(lifetime - self.tokenRefreshMargin, lifetime / 2), 0);
+    __weak SMUserSession *weakSelf = self;
+    // Wall time, so that a refresh due while the device slept happens as soon as it wakes.
+    dispatch_after(dispatch_walltime(NULL, delay * NSEC_PER_SEC), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
+        SMUserSession *session = weakSelf;
+        if (session && session.refreshGeneration == generation) {
+            [session refreshTokenOnSuccess:nil onFailure:nil];
+        }
+    });
+}
+
+- (BOOL)requestIsSignedWithCurrentToken:(NSURLRequest *)request
+{
+    NSString *authorization = [request valueForHTTPHeaderField:@"Authorization"];
+    NSString *accessToken = self.regularOAuthClient.accessToken;
+    if (authorization == nil || accessToken == nil) {
+        return YES;
+    }
+    return [authorization hasPrefix:[NSString stringWithFormat:@"MAC id=\"%@\"", accessToken]];
+}
+
 - (void)doTokenRequestWithEndpoint:(NSString *)endpoint
                        credentials:(NSDictionary *)credentials 
                        options:(SMRequestOptions *)options
@@ -116,7 +205,6 @@
         successBlock([self parseTokenResults:JSON]);
     };
     SMFullResponseFailureBlock failureHandler = ^void(NSURLRequest *req, NSHTTPURLResponse *response, NSError *error, id JSON) {
-        self.refreshing = NO;
         int statusCode = response.statusCode;
         NSString *domain = HTTPErrorDomain;
         if ([[JSON valueForKey:@"error_description"] isEqualToString:@"Temporary password reset required."]) {
@@ -134,6 +222,9 @@
     NSMutableDictionary *resultsToSave = [result mutableCopy];
     NSNumber *expires = [result valueForKey:EXPIRES_IN];
     [resultsToSave setObject:[NSDate dateWithTimeIntervalSinceNow:expires.intValue] forKey:EXPIRES_IN];
+    // A response without the user object leaves the user the tokens belong to unchanged.
+    id userId = [[[result valueForKey:@"stackmob"] valueForKey:@"user"] valueForKey:self.userIdName];
+    [resultsToSave setValue:userId ? [userId description] : self.userIdentifier forKey:USER_IDENTIFIER];
     [self saveAccessTokenInfo:resultsToSave];
     [[NSUserDefaults standardUserDefaults] setObject:resultsToSave forKey:self.oauthStorageKey];
     return [[result valueForKey:@"stackmob"] valueForKey:@"user"];   
@@ -147,11 +238,12 @@
     NSString *macKey = [result valueForKey:MAC_KEY];
     self.expiration = expiration;
     self.refreshToken = refreshToken;
+    self.userIdentifier = [result valueForKey:USER_IDENTIFIER];
     self.regularOAuthClient.accessToken = accessToken;
     self.regularOAuthClient.macKey = macKey;
     self.secureOAuthClient.accessToken = accessToken;
     self.secureOAuthClient.macKey = macKey;
-    self.refreshing = NO;
+    [self scheduleTokenRefresh];
 }
 
 - (NSURLRequest *) signRequest:(NSURLRequest *)request
@@ -47,6 +47,41 @@
  */
 @property(nonatomic, strong) NSManagedObjectContext *managedObjectContext;
 
+/**
+ Whether saves should group inserted objects by schema and send them to StackMob in batches, rather than one request per object.  Updates and deletes are sent together and waited on once.  Default is `NO`.
+ 
+ Must be set before the <persistentStoreCoordinator> is first accessed.  See <SMIncrementalStore> for how failures are reported.
+ */
+@property(nonatomic) BOOL batchSaves;
+
+/**
+ The maximum number of requests a save keeps in flight to StackMob at once.  Default is 4.
+ 
+ Must be set before the <persistentStoreCoordinator> is first accessed.
+ */
+@property(nonatomic) NSUInteger maxConcurrentSaveRequests;
+
+/**
+ The largest number of objects a fetch downloads in one request.  Fetches for more objects, or with no `fetchLimit`, are downloaded one page at a time.  Default is 0, which downloads every fetch in a single request.
+ 
+ Must be set before the <persistentStoreCoordinator> is first accessed.
+ */
+@property(nonatomic) NSUInteger fetchPageSize;
+
+/**
+ A directory in which to keep the last known results of fetches, so the first fetch of each kind after launch is answered from disk while it is repeated against StackMob in the background.  Default is `nil`, which keeps nothing on disk.
+ 
+ The Caches directory is a good home.  See <SMIncrementalStore> for how revalidated fetches are announced.  Must be set before the <persistentStoreCoordinator> is first accessed.
+ */
+@property(nonatomic, copy) NSString *offlineStorePath;
+
+/**
+ A file in which to keep saved changes until StackMob has accepted them.  When set, `save:` returns as soon as the changes are written to this file and they are sent to StackMob in the background.  Default is `nil`, which makes `save:` wait for StackMob.
+ 
+ The Application Support directory is a good home, since the file holds changes StackMob hasn't seen yet.  See <SMIncrementalStore> for ordering, retries and how rejected changes are announced.  Must be set before the <persistentStoreCoordinator> is first accessed.
+ */
+@property(nonatomic, copy) NSString *outboxPath;
+
 ///-------------------------------
 /// @name Initialize
 ///-------------------------------
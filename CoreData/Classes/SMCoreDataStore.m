@@ -21,6 +21,8 @@
 @interface SMCoreDataStore ()
 
 @property(nonatomic, readwrite, strong)NSManagedObjectModel *managedObjectModel;
+
+- (NSDictionary *)incrementalStoreOptions;
     
 
 @end
@@ -30,12 +32,18 @@
 @synthesize persistentStoreCoordinator = _persistentStoreCoordinator;
 @synthesize managedObjectModel = _managedObjectModel;
 @synthesize managedObjectContext = _managedObjectContext;
+@synthesize batchSaves = _batchSaves;
+@synthesize maxConcurrentSaveRequests = _maxConcurrentSaveRequests;
+@synthesize fetchPageSize = _fetchPageSize;
+@synthesize offlineStorePath = _offlineStorePath;
+@synthesize outboxPath = _outboxPath;
 
 - (id)initWithAPIVersion:(NSString *)apiVersion session:(SMUserSession *)session managedObjectModel:(NSManagedObjectModel *)managedObjectModel
 {
     self = [super initWithAPIVersion:apiVersion session:session];
     if (self) {
         _managedObjectModel = managedObjectModel;
+        _maxConcurrentSaveRequests = SM_DEFAULT_MAX_CONCURRENT_SAVE_REQUESTS;
     }
     
     return self;
@@ -50,7 +58,7 @@
         [_persistentStoreCoordinator addPersistentStoreWithType:SMIncrementalStoreType
                                    configuration:nil 
                                              URL:nil
-                                            options:[NSDictionary dictionaryWithObject:self forKey:SM_DataStoreKey] 
+                                            options:[self incrementalStoreOptions] 
                                            error:&error];
         if (error != nil) {
             [NSException raise:SMExceptionAddPersistentStore format:@"Error creating persistent store: %@", error];
@@ -61,6 +69,19 @@
     
 }
 
+- (NSDictionary *)incrementalStoreOptions
+{
+    NSMutableDictionary *options = [NSMutableDictionary dictionaryWithObjectsAndKeys:
+                                    self, SM_DataStoreKey,
+                                    [NSNumber numberWithBool:self.batchSaves], SM_BatchSavesKey,
+                                    [NSNumber numberWithUnsignedInteger:self.maxConcurrentSaveRequests], SM_MaxConcurrentSaveRequestsKey,
+                                    [NSNumber numberWithUnsignedInteger:self.fetchPageSize], SM_FetchPageSizeKey,
+                                    nil];
+    [options setValue:self.offlineStorePath forKey:SM_OfflineStorePathKey];
+    [options setValue:self.outboxPath forKey:SM_OutboxPathKey];
+    return options;
+}
+
 - (NSManagedObjectContext *)managedObjectContext
 {
     if (_managedObjectContext == nil) {
@@ -28,10 +28,38 @@
  @param fetchRequest The fetch request to be translated.
  @param error If an error occurs during the translation, it is placed here as an instance of `SMError`.
  
- @return An instance of `SMQuery` representing the received fetch request.
+ @return An instance of `SMQuery` representing the received fetch request.  If the fetch request needs more than one query, returns nil and sets an error.
  */
 + (SMQuery *)queryForFetchRequest:(NSFetchRequest *)fetchRequest 
                             error:(NSError *__autoreleasing *)error;
+/**
+ Given a fetch request, returns the queries to be sent to StackMob whose combined results answer it.
+ 
+ StackMob queries can only AND conditions together, so a predicate using OR, or NOT over a compound predicate, is expanded into one query per alternative.  The results of the queries must be merged, removing duplicates by primary key, and then sorted and limited according to the fetch request.  When there is more than one query, each returns at most `fetchOffset` + `fetchLimit` objects and the offset is left to be applied to the merged results.
+ 
+ @param fetchRequest The fetch request to be translated.
+ @param error If an error occurs during the translation, it is placed here as an instance of `SMError`.
+ 
+ @return An array of `SMQuery` whose results together match the fetch request, or nil if it cannot be translated.
+ */
++ (NSArray *)queriesForFetchRequest:(NSFetchRequest *)fetchRequest 
+                              error:(NSError *__autoreleasing *)error;
+
+/**
+ Given a fetch request, plans the queries to be sent to StackMob, leaving whatever StackMob can't evaluate to a residual predicate.
+ 
+ The terms of the predicate's outermost conjunction which StackMob supports are translated as by <queriesForFetchRequest:error:>.  The remaining terms, such as `BEGINSWITH`, `CONTAINS`, `LIKE`, case insensitive or key path to key path comparisons, and negated ordering comparisons on optional attributes, are combined into the residual predicate, which must be evaluated on the device over the results of the queries.  When there is a residual predicate, the queries return every match and `fetchOffset` and `fetchLimit` must be applied after filtering.
+ 
+ @param fetchRequest The fetch request to be translated.
+ @param residualPredicate Set to the part of the predicate StackMob can't evaluate, or nil if there is none.  If `NULL`, unsupported predicates are an error.
+ @param error If an error occurs during the translation, it is placed here as an instance of `SMError`.
+ 
+ @return An array of `SMQuery` whose results together, once filtered by the residual predicate, match the fetch request, or nil if it cannot be translated.
+ */
++ (NSArray *)queriesForFetchRequest:(NSFetchRequest *)fetchRequest 
+                  residualPredicate:(NSPredicate *__autoreleasing *)residualPredicate 
+                              error:(NSError *__autoreleasing *)error;
+
 /**
  Given a fetch request with a predicate, returns the equivalent query to be sent to StackMob.
  
@@ -45,4 +73,32 @@
                   predicate:(NSPredicate *)predicate 
                       error:(NSError *__autoreleasing *)error;
 
+/**
+ Given a predicate, returns the queries to be sent to StackMob whose combined results match it.  See <queriesForFetchRequest:error:>.
+ 
+ @param entityDescription The description of the entity to be translated.
+ @param predicate The predicate to be translated.
+ @param error If an error occurs during the translation, it is placed here as an instance of `SMError`.
+ 
+ @return An array of `SMQuery` whose results together match the predicate, or nil if it cannot be translated.
+ */
++ (NSArray *)queriesForEntity:(NSEntityDescription *)entityDescription 
+                    predicate:(NSPredicate *)predicate 
+                        error:(NSError *__autoreleasing *)error;
+
+/**
+ Given a predicate, plans the queries to be sent to StackMob, leaving whatever StackMob can't evaluate to a residual predicate.  See <queriesForFetchRequest:residualPredicate:error:>.
+ 
+ @param entityDescription The description of the entity to be translated.
+ @param predicate The predicate to be translated.
+ @param residualPredicate Set to the part of the predicate StackMob can't evaluate, or nil if there is none.  If `NULL`, unsupported predicates are an error.
+ @param error If an error occurs during the translation, it is placed here as an instance of `SMError`.
+ 
+ @return An array of `SMQuery` whose results together, once filtered by the residual predicate, match the predicate, or nil if it cannot be translated.
+ */
++ (NSArray *)queriesForEntity:(NSEntityDescription *)entityDescription 
+                    predicate:(NSPredicate *)predicate 
+            residualPredicate:(NSPredicate *__autoreleasing *)residualPredicate 
+                        error:(NSError *__autoreleasing *)error;
+
 @end
\ No newline at end of file
@@ -16,6 +16,12 @@
 
 #import "SMIncrementalStore+Query.h"
 #import "SMError.h"
+#import "NSArray+Enumerable.h"
+#import "SMQueryPlan.h"
+
+#define SM_MAX_QUERIES_PER_PREDICATE 32
+
+#define SM_MAX_CACHED_QUERY_PLANS 256
 
 @implementation SMIncrementalStore (Query)
 
@@ -54,28 +60,21 @@ void buildInQuery(SMQuery *__autoreleasing *query, id lhs, id rhs, NSError *__au
     return;
 }
 
-void buildQueryForPredicate(SMQuery *__autoreleasing *query, NSPredicate *predicate, NSError *__autoreleasing *error);
-
-void buildQueryForCompoundPredicate(SMQuery *__autoreleasing *query, NSCompoundPredicate *compoundPredicate, NSError *__autoreleasing *error)
+BOOL validateComparisonPredicate(NSComparisonPredicate *comparisonPredicate, NSError *__autoreleasing *error)
 {
-    if ([compoundPredicate compoundPredicateType] != NSAndPredicateType) {
-        setErrorWithReason(@"Predicate type not supported.", error);
-        return;
+    if (comparisonPredicate.leftExpression.expressionType != NSKeyPathExpressionType) {
+        setErrorWithReason(@"LHS must be usable as a remote keypath", error);
+        return NO;
+    } else if (comparisonPredicate.rightExpression.expressionType != NSConstantValueExpressionType) {
+        setErrorWithReason(@"RHS must be a constant-valued expression", error);
+        return NO;
     }
-    
-    for (int i = 0; i < [[compoundPredicate subpredicates] count]; i++) {
-        NSPredicate *subpredicate = [[compoundPredicate subpredicates] objectAtIndex:i];
-        buildQueryForPredicate(query, subpredicate, error);
-    } 
+    return YES;
 }
 
 void buildQueryForComparisonPredicate(SMQuery *__autoreleasing *query, NSComparisonPredicate *comparisonPredicate, NSError *__autoreleasing *error) 
 {        
-    if (comparisonPredicate.leftExpression.expressionType != NSKeyPathExpressionType) {
-        setErrorWithReason(@"LHS must be usable as a remote keypath", error);
-        return;
-    } else if (comparisonPredicate.rightExpression.expressionType != NSConstantValueExpressionType) {
-        setErrorWithReason(@"RHS must be a constant-valued expression", error);
+    if (!validateComparisonPredicate(comparisonPredicate, error)) {
         return;
     }
     
@@ -113,54 +112,475 @@ void buildQueryForComparisonPredicate(SMQuery *__autoreleasing *query, NSCompari
     }
 }
 
-void buildQueryForPredicate(SMQuery *__autoreleasing *query, NSPredicate *predicate, NSError *__autoreleasing *error)
-{    
+NSArray *buildQueriesForPredicate(NSEntityDescription *entityDescription, NSArray *queries, NSPredicate *predicate, BOOL negated, NSError *__autoreleasing *error);
+
+NSComparisonPredicate *comparisonPredicateWithType(NSComparisonPredicate *comparisonPredicate, NSPredicateOperatorType type, id rhs)
+{
+    return (NSComparisonPredicate *)[NSComparisonPredicate predicateWithLeftExpression:comparisonPredicate.leftExpression
+                                                                        rightExpression:[NSExpression expressionForConstantValue:rhs]
+                                                                               modifier:NSDirectPredicateModifier
+                                                                                   type:type
+                                                                                options:comparisonPredicate.options];
+}
+
+/*
+ Whether the field compared against may be nil or missing from a StackMob object.  Only a required attribute of the entity is known to always have a value.
+ */
+BOOL isNullableKeyPath(NSEntityDescription *entityDescription, NSString *keyPath)
+{
+    NSAttributeDescription *attribute = [[entityDescription attributesByName] objectForKey:keyPath];
+    return attribute == nil || [attribute isOptional];
+}
+
+/*
+ Whether the comparison orders lhs against rhs.  An object without a value for lhs fails both such a comparison and its opposite, so NOT (lhs < rhs) only becomes lhs >= rhs when lhs always has a value.
+ */
+BOOL isOrderingComparisonPredicate(NSComparisonPredicate *comparisonPredicate)
+{
+    switch (comparisonPredicate.predicateOperatorType) {
+        case NSLessThanPredicateOperatorType:
+        case NSLessThanOrEqualToPredicateOperatorType:
+        case NSGreaterThanPredicateOperatorType:
+        case NSGreaterThanOrEqualToPredicateOperatorType:
+        case NSBetweenPredicateOperatorType:
+            return YES;
+        default:
+            return NO;
+    }
+}
+
+/*
+ StackMob has no negated operators, so NOT (lhs op rhs) is rewritten as the opposite comparison.  NOT BETWEEN becomes the disjunction of the two ranges outside the bounds.  NOT IN is only supported for a single value.  Negated ordering comparisons are only supported on required attributes, since objects without a value for lhs wouldn't match the opposite comparison.
+ */
+NSArray *buildQueriesForNegatedComparisonPredicate(NSEntityDescription *entityDescription, NSArray *queries, NSComparisonPredicate *comparisonPredicate, NSError *__autoreleasing *error)
+{
+    if (!validateComparisonPredicate(comparisonPredicate, error)) {
+        return nil;
+    }
+    if (isOrderingComparisonPredicate(comparisonPredicate) && isNullableKeyPath(entityDescription, comparisonPredicate.leftExpression.keyPath)) {
+        setErrorWithReason(@"NOT of an ordering comparison is only supported on required attributes", error);
+        return nil;
+    }
+    
+    id rhs = comparisonPredicate.rightExpression.constantValue;
+    NSPredicate *negatedPredicate = nil;
+    
+    switch (comparisonPredicate.predicateOperatorType) {
+        case NSEqualToPredicateOperatorType:
+            negatedPredicate = comparisonPredicateWithType(comparisonPredicate, NSNotEqualToPredicateOperatorType, rhs);
+            break;
+        case NSNotEqualToPredicateOperatorType:
+            negatedPredicate = comparisonPredicateWithType(comparisonPredicate, NSEqualToPredicateOperatorType, rhs);
+            break;
+        case NSLessThanPredicateOperatorType:
+            negatedPredicate = comparisonPredicateWithType(comparisonPredicate, NSGreaterThanOrEqualToPredicateOperatorType, rhs);
+            break;
+        case NSLessThanOrEqualToPredicateOperatorType:
+            negatedPredicate = comparisonPredicateWithType(comparisonPredicate, NSGreaterThanPredicateOperatorType, rhs);
+            break;
+        case NSGreaterThanPredicateOperatorType:
+            negatedPredicate = comparisonPredicateWithType(comparisonPredicate, NSLessThanOrEqualToPredicateOperatorType, rhs);
+            break;
+        case NSGreaterThanOrEqualToPredicateOperatorType:
+            negatedPredicate = comparisonPredicateWithType(comparisonPredicate, NSLessThanPredicateOperatorType, rhs);
+            break;
+        case NSBetweenPredicateOperatorType:
+            if (![rhs isKindOfClass:[NSArray class]] || [rhs count] != 2) {
+                setErrorWithReason(@"RHS must be an NSArray", error);
+                return nil;
+            }
+            negatedPredicate = [NSCompoundPredicate orPredicateWithSubpredicates:[NSArray arrayWithObjects:
+                                                                                  comparisonPredicateWithType(comparisonPredicate, NSLessThanPredicateOperatorType, [rhs objectAtIndex:0]),
+                                                                                  comparisonPredicateWithType(comparisonPredicate, NSGreaterThanPredicateOperatorType, [rhs objectAtIndex:1]),
+                                                                                  nil]];
+            break;
+        case NSInPredicateOperatorType:
+            if (![rhs isKindOfClass:[NSArray class]] || [rhs count] != 1) {
+                setErrorWithReason(@"NOT IN is only supported for a single value", error);
+                return nil;
+            }
+            negatedPredicate = comparisonPredicateWithType(comparisonPredicate, NSNotEqualToPredicateOperatorType, [rhs objectAtIndex:0]);
+            break;
+        default:
+            setErrorWithReason(@"Predicate type not supported.", error);
+            return nil;
+    }
+    
+    return buildQueriesForPredicate(entityDescription, queries, negatedPredicate, NO, error);
+}
+
+/*
+ StackMob queries can only AND their conditions together, so predicates are expanded into the OR of several queries, one per conjunction.  NOT is pushed down to the comparisons with De Morgan's laws, which swap AND and OR.
+ 
+ Each query in queries is ANDed with predicate, and the resulting queries returned.  Returns nil if the predicate can't be translated.
+ */
+NSArray *buildQueriesForCompoundPredicate(NSEntityDescription *entityDescription, NSArray *queries, NSCompoundPredicate *compoundPredicate, BOOL negated, NSError *__autoreleasing *error)
+{
+    NSArray *subpredicates = [compoundPredicate subpredicates];
+    
+    if ([compoundPredicate compoundPredicateType] == NSNotPredicateType) {
+        return buildQueriesForPredicate(entityDescription, queries, [subpredicates objectAtIndex:0], !negated, error);
+    }
+    
+    BOOL isConjunction = ([compoundPredicate compoundPredicateType] == NSAndPredicateType) != negated;
+    if (isConjunction) {
+        for (NSPredicate *subpredicate in subpredicates) {
+            queries = buildQueriesForPredicate(entityDescription, queries, subpredicate, negated, error);
+            if (queries == nil) {
+                return nil;
+            }
+        }
+        return queries;
+    }
+    
+    NSMutableArray *disjunction = [NSMutableArray array];
+    for (NSPredicate *subpredicate in subpredicates) {
+        NSArray *copies = [queries map:^id(id query) {
+            return [query copy];
+        }];
+        NSArray *subqueries = buildQueriesForPredicate(entityDescription, copies, subpredicate, negated, error);
+        if (subqueries == nil) {
+            return nil;
+        }
+        [disjunction addObjectsFromArray:subqueries];
+    }
+    
+    if ([disjunction count] > SM_MAX_QUERIES_PER_PREDICATE) {
+        setErrorWithReason(@"Predicate expands to too many queries", error);
+        return nil;
+    }
+    return disjunction;
+}
+
+NSArray *buildQueriesForPredicate(NSEntityDescription *entityDescription, NSArray *queries, NSPredicate *predicate, BOOL negated, NSError *__autoreleasing *error)
+{
+    if ([predicate isKindOfClass:[NSCompoundPredicate class]]) {
+        return buildQueriesForCompoundPredicate(entityDescription, queries, (NSCompoundPredicate *)predicate, negated, error);
+    }
+    else if ([predicate isKindOfClass:[NSComparisonPredicate class]]) {
+        if (negated) {
+            return buildQueriesForNegatedComparisonPredicate(entityDescription, queries, (NSComparisonPredicate *)predicate, error);
+        }
+        for (SMQuery *query in queries) {
+            SMQuery *conjunction = query;
+            buildQueryForComparisonPredicate(&conjunction, (NSComparisonPredicate *)predicate, error);
+            if (*error != nil) {
+                return nil;
+            }
+        }
+    }
+    return queries;
+}
+
+BOOL isPushablePredicate(NSEntityDescription *entityDescription, NSPredicate *predicate, BOOL negated);
+
+/*
+ Whether StackMob can evaluate the comparison itself: a field compared to a constant, case and diacritic sensitively, with an operator it has (or whose negation it has).  Negated ordering comparisons on fields which may lack a value are left to the device, which matches those objects.
+ */
+BOOL isPushableComparisonPredicate(NSEntityDescription *entityDescription, NSComparisonPredicate *comparisonPredicate, BOOL negated)
+{
+    if (comparisonPredicate.leftExpression.expressionType != NSKeyPathExpressionType ||
+        comparisonPredicate.rightExpression.expressionType != NSConstantValueExpressionType ||
+        comparisonPredicate.comparisonPredicateModifier != NSDirectPredicateModifier ||
+        comparisonPredicate.options != 0) {
+        return NO;
+    }
+    if (negated && isOrderingComparisonPredicate(comparisonPredicate) && isNullableKeyPath(entityDescription, comparisonPredicate.leftExpression.keyPath)) {
+        return NO;
+    }
+    
+    id rhs = comparisonPredicate.rightExpression.constantValue;
+    switch (comparisonPredicate.predicateOperatorType) {
+        case NSEqualToPredicateOperatorType:
+        case NSNotEqualToPredicateOperatorType:
+        case NSLessThanPredicateOperatorType:
+        case NSLessThanOrEqualToPredicateOperatorType:
+        case NSGreaterThanPredicateOperatorType:
+        case NSGreaterThanOrEqualToPredicateOperatorType:
+            return YES;
+        case NSBetweenPredicateOperatorType:
+            return [rhs isKindOfClass:[NSArray class]] && [rhs count] == 2;
+        case NSInPredicateOperatorType:
+            return [rhs isKindOfClass:[NSArray class]] && (!negated || [rhs count] == 1);
+        default:
+            return NO;
+    }
+}
+
+BOOL isPushablePredicate(NSEntityDescription *entityDescription, NSPredicate *predicate, BOOL negated)
+{
     if ([predicate isKindOfClass:[NSCompoundPredicate class]]) {
-        buildQueryForCompoundPredicate(query, (NSCompoundPredicate *)predicate, error);
+        NSCompoundPredicate *compoundPredicate = (NSCompoundPredicate *)predicate;
+        if ([compoundPredicate compoundPredicateType] == NSNotPredicateType) {
+            return isPushablePredicate(entityDescription, [[compoundPredicate subpredicates] objectAtIndex:0], !negated);
+        }
+        for (NSPredicate *subpredicate in [compoundPredicate subpredicates]) {
+            if (!isPushablePredicate(entityDescription, subpredicate, negated)) {
+                return NO;
+            }
+        }
+        return YES;
     }
     else if ([predicate isKindOfClass:[NSComparisonPredicate class]]) {
-        buildQueryForComparisonPredicate(query, (NSComparisonPredicate *)predicate, error);
+        return isPushableComparisonPredicate(entityDescription, (NSComparisonPredicate *)predicate, negated);
+    }
+    return NO;
+}
+
+/*
+ Splits predicate into the terms of its outermost conjunction, looking through NOT with De Morgan's laws, and sorts them into those StackMob can evaluate and the residual ones which must be evaluated on the device.
+ */
+void splitPredicate(NSEntityDescription *entityDescription, NSPredicate *predicate, BOOL negated, NSMutableArray *pushable, NSMutableArray *residual)
+{
+    if ([predicate isKindOfClass:[NSCompoundPredicate class]]) {
+        NSCompoundPredicate *compoundPredicate = (NSCompoundPredicate *)predicate;
+        if ([compoundPredicate compoundPredicateType] == NSNotPredicateType) {
+            splitPredicate(entityDescription, [[compoundPredicate subpredicates] objectAtIndex:0], !negated, pushable, residual);
+            return;
+        }
+        BOOL isConjunction = ([compoundPredicate compoundPredicateType] == NSAndPredicateType) != negated;
+        if (isConjunction) {
+            for (NSPredicate *subpredicate in [compoundPredicate subpredicates]) {
+                splitPredicate(entityDescription, subpredicate, negated, pushable, residual);
+            }
+            return;
+        }
+    }
+    
+    NSPredicate *term = negated ? [NSCompoundPredicate notPredicateWithSubpredicate:predicate] : predicate;
+    if (isPushablePredicate(entityDescription, predicate, negated)) {
+        [pushable addObject:term];
+    } else {
+        [residual addObject:term];
     }
 }
 
+NSPredicate *conjunctionOfPredicates(NSArray *predicates)
+{
+    if ([predicates count] == 0) {
+        return nil;
+    }
+    return [predicates count] == 1 ? [predicates lastObject] : [NSCompoundPredicate andPredicateWithSubpredicates:predicates];
+}
+
+#pragma mark - Query plans
+
+/*
+ Appends the structure of predicate to key, leaving out the constants compared against, which are appended to constants in order instead.  Returns NO if a constant is nil, since nil can't be bound to a plan.
+ 
+ The structure includes the count of array constants, since BETWEEN and IN translate differently depending on it.
+ */
+BOOL appendPredicateStructure(NSPredicate *predicate, NSMutableString *key, NSMutableArray *constants)
+{
+    if ([predicate isKindOfClass:[NSCompoundPredicate class]]) {
+        NSCompoundPredicate *compoundPredicate = (NSCompoundPredicate *)predicate;
+        [key appendFormat:@"(%d", (int)[compoundPredicate compoundPredicateType]];
+        for (NSPredicate *subpredicate in [compoundPredicate subpredicates]) {
+            [key appendString:@","];
+            if (!appendPredicateStructure(subpredicate, key, constants)) {
+                return NO;
+            }
+        }
+        [key appendString:@")"];
+        return YES;
+    }
+    
+    if ([predicate isKindOfClass:[NSComparisonPredicate class]]) {
+        NSComparisonPredicate *comparisonPredicate = (NSComparisonPredicate *)predicate;
+        NSExpression *rhs = comparisonPredicate.rightExpression;
+        [key appendFormat:@"[%@|%d|%d|%d|", comparisonPredicate.leftExpression, (int)comparisonPredicate.predicateOperatorType, (int)comparisonPredicate.comparisonPredicateModifier, (int)comparisonPredicate.options];
+        if (comparisonPredicate.predicateOperatorType == NSCustomSelectorPredicateOperatorType) {
+            [key appendString:NSStringFromSelector(comparisonPredicate.customSelector)];
+        }
+        if (rhs.expressionType != NSConstantValueExpressionType) {
+            [key appendFormat:@"%@]", rhs];
+            return YES;
+        }
+        id constant = rhs.constantValue;
+        if (constant == nil) {
+            return NO;
+        }
+        if ([constant isKindOfClass:[NSArray class]]) {
+            [key appendFormat:@"$%lu]", (unsigned long)[constant count]];
+        } else {
+            [key appendString:@"$]"];
+        }
+        [constants addObject:constant];
+        return YES;
+    }
+    
+    [key appendString:[predicate predicateFormat]];
+    return YES;
+}
+
+/*
+ Returns predicate with each constant compared against replaced by its plan parameter, numbered in the same order as appendPredicateStructure collects them.
+ */
+NSPredicate *templateForPredicate(NSPredicate *predicate, NSUInteger *nextIndex)
+{
+    if ([predicate isKindOfClass:[NSCompoundPredicate class]]) {
+        NSCompoundPredicate *compoundPredicate = (NSCompoundPredicate *)predicate;
+        NSMutableArray *subpredicates = [NSMutableArray arrayWithCapacity:[[compoundPredicate subpredicates] count]];
+        for (NSPredicate *subpredicate in [compoundPredicate subpredicates]) {
+            [subpredicates addObject:templateForPredicate(subpredicate, nextIndex)];
+        }
+        return [[NSCompoundPredicate alloc] initWithType:[compoundPredicate compoundPredicateType] subpredicates:subpredicates];
+    }
+    
+    if ([predicate isKindOfClass:[NSComparisonPredicate class]]) {
+        NSComparisonPredicate *comparisonPredicate = (NSComparisonPredicate *)predicate;
+        if (comparisonPredicate.rightExpression.expressionType != NSConstantValueExpressionType) {
+            return predicate;
+        }
+        NSUInteger index = (*nextIndex)++;
+        id constant = comparisonPredicate.rightExpression.constantValue;
+        id parameter = nil;
+        if ([constant isKindOfClass:[NSArray class]]) {
+            NSMutableArray *elements = [NSMutableArray arrayWithCapacity:[constant count]];
+            for (NSUInteger element = 0; element < [constant count]; element++) {
+                [elements addObject:[SMQueryPlan parameterForConstantAtIndex:index element:element]];
+            }
+            parameter = elements;
+        } else {
+            parameter = [SMQueryPlan parameterForConstantAtIndex:index element:NSNotFound];
+        }
+        NSExpression *rhs = [NSExpression expressionForConstantValue:parameter];
+        if (comparisonPredicate.predicateOperatorType == NSCustomSelectorPredicateOperatorType) {
+            return [NSComparisonPredicate predicateWithLeftExpression:comparisonPredicate.leftExpression rightExpression:rhs customSelector:comparisonPredicate.customSelector];
+        }
+        return [NSComparisonPredicate predicateWithLeftExpression:comparisonPredicate.leftExpression
+                                                  rightExpression:rhs
+                                                         modifier:comparisonPredicate.comparisonPredicateModifier
+                                                             type:comparisonPredicate.predicateOperatorType
+                                                          options:comparisonPredicate.options];
+    }
+    
+    return predicate;
+}
+
+NSArray *translatePredicate(NSEntityDescription *entityDescription, NSPredicate *predicate, NSPredicate *__autoreleasing *residualPredicate, NSError *__autoreleasing *error)
+{
+    SMQuery *query = [[SMQuery alloc] initWithEntity:entityDescription];
+    if (residualPredicate == NULL) {
+        return buildQueriesForPredicate(entityDescription, [NSArray arrayWithObject:query], predicate, NO, error);
+    }
+    
+    NSMutableArray *pushable = [NSMutableArray array];
+    NSMutableArray *residual = [NSMutableArray array];
+    if (predicate != nil) {
+        splitPredicate(entityDescription, predicate, NO, pushable, residual);
+    }
+    *residualPredicate = conjunctionOfPredicates(residual);
+    return buildQueriesForPredicate(entityDescription, [NSArray arrayWithObject:query], conjunctionOfPredicates(pushable), NO, error);
+}
+
+/*
+ Predicates which only differ in their constants translate the same way, so the translation of each predicate structure is kept as a plan, and later predicates with the same structure only have their constants bound into it.  Predicates which fail to translate are not cached, and are translated again each time.
+ */
+NSArray *translatePredicateWithPlanCache(NSEntityDescription *entityDescription, NSPredicate *predicate, NSPredicate *__autoreleasing *residualPredicate, NSError *__autoreleasing *error)
+{
+    static NSCache *planCache = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        planCache = [[NSCache alloc] init];
+        [planCache setCountLimit:SM_MAX_CACHED_QUERY_PLANS];
+    });
+    
+    if (predicate == nil) {
+        return translatePredicate(entityDescription, predicate, residualPredicate, error);
+    }
+    
+    NSMutableString *key = [NSMutableString stringWithFormat:@"%@|%@|", [entityDescription name], residualPredicate == NULL ? @"S" : @"R"];
+    NSMutableArray *constants = [NSMutableArray array];
+    if (!appendPredicateStructure(predicate, key, constants)) {
+        return translatePredicate(entityDescription, predicate, residualPredicate, error);
+    }
+    
+    SMQueryPlan *plan = [planCache objectForKey:key];
+    if (plan == nil) {
+        NSUInteger nextIndex = 0;
+        NSPredicate *templateResidualPredicate = nil;
+        NSArray *templateQueries = translatePredicate(entityDescription, templateForPredicate(predicate, &nextIndex), residualPredicate == NULL ? NULL : &templateResidualPredicate, error);
+        if (templateQueries == nil) {
+            return nil;
+        }
+        plan = [[SMQueryPlan alloc] initWithSchema:[[templateQueries lastObject] schemaName] queries:templateQueries residualPredicate:templateResidualPredicate];
+        [planCache setObject:plan forKey:key];
+    }
+    
+    return [plan queriesWithConstants:constants residualPredicate:residualPredicate];
+}
+
+#pragma mark - Translating fetch requests
+
 + (SMQuery *)queryForFetchRequest:(NSFetchRequest *)fetchRequest 
                             error:(NSError *__autoreleasing *)error {
     
-    SMQuery *query = [SMIncrementalStore queryForEntity:fetchRequest.entity 
-                                              predicate:fetchRequest.predicate
-                                                  error:error];
-    
-    if (*error != nil) {
+    NSArray *queries = [SMIncrementalStore queriesForFetchRequest:fetchRequest error:error];
+    if (queries == nil) {
+        return nil;
+    }
+    if ([queries count] != 1) {
+        setErrorWithReason(@"Predicate requires more than one query", error);
         return nil;
     }
+    return [queries lastObject];
+}
+
++ (NSArray *)queriesForFetchRequest:(NSFetchRequest *)fetchRequest 
+                              error:(NSError *__autoreleasing *)error {
+    
+    return [SMIncrementalStore queriesForFetchRequest:fetchRequest residualPredicate:NULL error:error];
+}
+
++ (NSArray *)queriesForFetchRequest:(NSFetchRequest *)fetchRequest 
+                  residualPredicate:(NSPredicate *__autoreleasing *)residualPredicate 
+                              error:(NSError *__autoreleasing *)error {
     
-    // Limit / pagination
+    NSArray *queries = [SMIncrementalStore queriesForEntity:fetchRequest.entity 
+                                                  predicate:fetchRequest.predicate
+                                          residualPredicate:residualPredicate
+                                                      error:error];
     
-    if (fetchRequest.fetchBatchSize) { // The default is 0, which means "everything"
-        setErrorWithReason(@"NSFetchRequest fetchBatchSize not supported", error);
+    if (queries == nil) {
         return nil;
     }
     
-    NSUInteger fetchOffset = fetchRequest.fetchOffset;
-    NSUInteger fetchLimit = fetchRequest.fetchLimit;
-    NSString *rangeHeader;
+    BOOL hasResidualPredicate = residualPredicate != NULL && *residualPredicate != nil;
     
-    if (fetchOffset) {
-        if (fetchLimit) {
-            rangeHeader = [NSString stringWithFormat:@"objects=%i-%i", fetchOffset, fetchOffset+fetchLimit];
-        } else {
+    for (SMQuery *query in queries) {
+        
+        // Limit / pagination
+        
+        // fetchBatchSize is handled by SMIncrementalStore, which pages through the results of this query
+        
+        NSUInteger fetchOffset = fetchRequest.fetchOffset;
+        NSUInteger fetchLimit = fetchRequest.fetchLimit;
+        NSString *rangeHeader;
+        
+        if (hasResidualPredicate) {
+            // The offset and limit can only be applied once the residual predicate has filtered the results
+        } else if ([queries count] > 1) {
+            // The offset can only be applied once the results are merged, so each query returns up to offset+limit objects
+            if (fetchLimit) {
+                [query fromIndex:0 toIndex:fetchOffset+fetchLimit-1];
+            }
+        } else if (fetchLimit) {
+            // Range bounds are inclusive, so a limit of n ends at offset+n-1
+            [query fromIndex:fetchOffset toIndex:fetchOffset+fetchLimit-1];
+        } else if (fetchOffset) {
             rangeHeader = [NSString stringWithFormat:@"objects=%i-", fetchOffset];
+            [[query requestHeaders] setValue:rangeHeader forKey:@"Range"];
         }
-        [[query requestHeaders] setValue:rangeHeader forKey:@"Range"];
+        
+        // Ordering
+        
+        [fetchRequest.sortDescriptors enumerateObjectsUsingBlock:^(id obj, NSUInteger idx, BOOL *stop) {
+            [query orderByField:[obj key] ascending:[obj ascending]];
+        }];
     }
     
-    // Ordering
-    
-    [fetchRequest.sortDescriptors enumerateObjectsUsingBlock:^(id obj, NSUInteger idx, BOOL *stop) {
-        [query orderByField:[obj key] ascending:[obj ascending]];
-    }];
-    
-    return query;
+    return queries;
 }
 
 
@@ -168,10 +588,30 @@ void buildQueryForPredicate(SMQuery *__autoreleasing *query, NSPredicate *predic
                   predicate:(NSPredicate *)predicate 
                       error:(NSError *__autoreleasing *)error {
     
-    SMQuery *query = [[SMQuery alloc] initWithEntity:entityDescription];
-    buildQueryForPredicate(&query, predicate, error);
+    NSArray *queries = [SMIncrementalStore queriesForEntity:entityDescription predicate:predicate error:error];
+    if (queries == nil) {
+        return nil;
+    }
+    if ([queries count] != 1) {
+        setErrorWithReason(@"Predicate requires more than one query", error);
+        return nil;
+    }
+    return [queries lastObject];
+}
+
++ (NSArray *)queriesForEntity:(NSEntityDescription *)entityDescription 
+                    predicate:(NSPredicate *)predicate 
+                        error:(NSError *__autoreleasing *)error {
+    
+    return translatePredicateWithPlanCache(entityDescription, predicate, NULL, error);
+}
+
++ (NSArray *)queriesForEntity:(NSEntityDescription *)entityDescription 
+                    predicate:(NSPredicate *)predicate 
+            residualPredicate:(NSPredicate *__autoreleasing *)residualPredicate 
+                        error:(NSError *__autoreleasing *)error {
     
-    return query;
+    return translatePredicateWithPlanCache(entityDescription, predicate, residualPredicate, error);
 }
 
 @end
\ No newline at end of file
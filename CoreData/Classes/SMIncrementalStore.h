@@ -19,6 +19,18 @@
 
 extern NSString *const SMIncrementalStoreType;
 extern NSString *const SM_DataStoreKey;
+extern NSString *const SM_BatchSavesKey;
+extern NSString *const SM_MaxConcurrentSaveRequestsKey;
+extern NSString *const SM_FetchPageSizeKey;
+extern NSString *const SM_OfflineStorePathKey;
+extern NSString *const SM_OutboxPathKey;
+
+extern NSString *const SMIncrementalStoreDidRevalidateFetchNotification;
+extern NSString *const SMIncrementalStoreEntityNameKey;
+extern NSString *const SMIncrementalStoreWriteBehindFailedNotification;
+extern NSString *const SMIncrementalStoreOutboxEntryKey;
+
+#define SM_DEFAULT_MAX_CONCURRENT_SAVE_REQUESTS 4
 
 /**
  `SMIncrementalStore` is the foundation used to integrate StackMob into Core Data.
@@ -39,6 +51,46 @@ extern NSString *const SM_DataStoreKey;
  
  For more information on each method and StackMob's implementation see `SMIncrementalStore.m`.
  
+ ## Fetch Result Types ##
+ 
+ All four fetch result types are supported.  `NSCountResultType` fetches, including `countForFetchRequest:error:`, ask StackMob for the count alone rather than downloading the matching objects.  `NSDictionaryResultType` fetches only request the fields named in `propertiesToFetch` and return plain dictionaries without creating any managed objects.
+ 
+ ## Predicates ##
+ 
+ Fetch predicates may combine comparisons with AND, OR and NOT.  Since StackMob queries can only AND conditions together, a predicate using OR is sent as one query per alternative, run concurrently, and their results merged with duplicates removed by primary key before being sorted and limited on the device.  NOT is applied by negating the comparisons beneath it, except that a negated `<`, `<=`, `>`, `>=` or `BETWEEN` on an optional attribute is evaluated on the device, so that objects without a value for the attribute still match.
+ 
+ Parts of a predicate StackMob can't evaluate, such as `BEGINSWITH`, `CONTAINS`, `LIKE`, case insensitive or key path to key path comparisons, do not fail the fetch.  The rest of the predicate is still sent to StackMob, and the remaining terms are evaluated on the device over the objects it returns, before applying `fetchOffset` and `fetchLimit`.
+ 
+ Translating a predicate is planned once per entity and predicate structure.  Later predicates differing only in their constants reuse the plan, with their constants bound in.
+ 
+ ## Batched Saves ##
+ 
+ By default each inserted, updated and deleted object is sent to StackMob in its own request.  When the store is added with the option `SM_BatchSavesKey` set to `YES` (see the `batchSaves` property of <SMCoreDataStore>), inserted objects are grouped by schema and created with one request per batch, while updates and deletes are sent together and waited on once.  If any object fails to save, the error returned to `save:` has the code `SMErrorBatchSaveFailed` and holds one error per failed object under `NSDetailedErrorsKey`, each with the failed object under `NSAffectedObjectsErrorKey`.
+ 
+ In either mode, save requests are sent concurrently, with at most the number given by the option `SM_MaxConcurrentSaveRequestsKey` (4 by default, see the `maxConcurrentSaveRequests` property of <SMCoreDataStore>) in flight at a time.  When an unbatched save request fails, no further requests are started, though those already in flight complete, and the error returned is that of the first failed request.
+ 
+ ## Write-Behind Saves ##
+ 
+ When the store is added with the option `SM_OutboxPathKey` (see the `outboxPath` property of <SMCoreDataStore>), `save:` doesn't wait for StackMob.  The changes are serialized and written to a durable outbox file at that path, and `save:` returns as soon as they are on disk.  A background flusher then sends them to StackMob strictly in order, creating runs of new objects in the same schema with one request, and retrying with a growing delay while the network or StackMob is unavailable.  Writes still in the outbox when the app exits are sent after the next launch.  Writes are only sent while the user who made them is logged in, so a different user's token is never used for them.
+ 
+ Changes StackMob rejects, for example with a 400 or 403 response, are dropped and `SMIncrementalStoreWriteBehindFailedNotification` is posted with the store as its object, the error under `NSUnderlyingErrorKey`, and the outbox entry (a dictionary with the `operation`, `schema`, `objectId` and serialized `object`) under `SMIncrementalStoreOutboxEntryKey`.  Until the outbox has been flushed, fetches return StackMob's view of the data, without the pending changes.
+ 
+ ## Row Cache ##
+ 
+ Every object downloaded by a fetch, or read to fulfill a fault, is kept in an in-memory row cache keyed by its `NSManagedObjectID`, versioned by its StackMob `lastmoddate`.  Faults for cached objects are fulfilled without contacting StackMob, so faulting in the results of a fetch costs no further requests.  Relationship faults are resolved from the related object ids in the parent's cached row in the same way.
+ 
+ Each downloaded object fulfills one fault.  Faulting an object again, for example after `refreshObject:mergeChanges:`, reads it again from StackMob, so the refreshed object reflects changes made on the server.  The cache holds a bounded number of objects, evicting some once it is full, and an evicted object is read again when it is next faulted.
+ 
+ A `fetchLimit` downloads exactly that many objects, starting at `fetchOffset`.  When the store is added with the option `SM_FetchPageSizeKey` (see the `fetchPageSize` property of <SMCoreDataStore>), fetches for more objects than the page size are downloaded one page at a time and cached as they arrive, so that no single response holds the whole result.  This bounds the size of each response, not the memory the fetch uses: every object of the result is still returned, and rows beyond what the row cache holds are read again when faulted.  To load a large result as it is used, set a `fetchBatchSize`.
+ 
+ Fetch requests with a `fetchBatchSize` only download the ids of the matching objects, a range at a time, returned as faults.  The first time an object is faulted, the page of `fetchBatchSize` objects containing it is downloaded with a single ranged query and cached, so a long result list is loaded one page at a time as it is used.  The pages are only kept for the most recent batched fetches, and making a fetch again replaces its pages; objects of older fetches are read one at a time when faulted.  For stable pages, batched fetches should be sorted.
+ 
+ Fetch requests may set `relationshipKeyPathsForPrefetching` to load related objects into the cache up front.  For each level of the key paths, the related objects which are not yet cached are loaded with a single `isIn:` query per destination schema, so traversing the prefetched relationships costs no further requests.  Saving or deleting an object removes its row, and fetching it again replaces it.
+ 
+ ## Offline Store ##
+ 
+ When the store is added with the option `SM_OfflineStorePathKey` (see the `offlineStorePath` property of <SMCoreDataStore>), the rows each fetch returns are also kept on disk, one file per schema.  After launch, the first time a fetch is made it is answered straight from disk, without waiting on the network, and repeated against StackMob in the background.  When the fresh results have been cached, `SMIncrementalStoreDidRevalidateFetchNotification` is posted on the main thread with the store as its object and the fetched entity's name under `SMIncrementalStoreEntityNameKey`, so the fetch can be made again.  Fetches not yet on disk, and any fetch after the first, go to StackMob as usual.  Saving an object updates it on disk, and deleting it removes it.  Each user's rows are kept in their own directory, and the rows of every other user are deleted as soon as the logged in user changes or logs out.
+ 
  ## References ##
  
  [Apple's NSIncrementalStore class reference](http://developer.apple.com/library/ios/documentation/CoreData/Reference/NSIncrementalStore_Class/Reference/NSIncrementalStore.html)
@@ -20,16 +20,55 @@
 
 #import "SMIncrementalStore.h"
 #import "StackMob.h"
+#import "SMOfflineStore.h"
+#import "SMOutbox.h"
 
 
 NSString *const SMIncrementalStoreType = @"SMIncrementalStore";
 NSString *const SM_DataStoreKey = @"SM_DataStoreKey";
+NSString *const SM_BatchSavesKey = @"SM_BatchSavesKey";
+NSString *const SM_MaxConcurrentSaveRequestsKey = @"SM_MaxConcurrentSaveRequestsKey";
+NSString *const SM_FetchPageSizeKey = @"SM_FetchPageSizeKey";
+NSString *const SM_OfflineStorePathKey = @"SM_OfflineStorePathKey";
+
+static void *SMOfflineStoreUserContext = &SMOfflineStoreUserContext;
+NSString *const SM_OutboxPathKey = @"SM_OutboxPathKey";
+NSString *const SMIncrementalStoreDidRevalidateFetchNotification = @"SMIncrementalStoreDidRevalidateFetchNotification";
+NSString *const SMIncrementalStoreEntityNameKey = @"SMIncrementalStoreEntityNameKey";
+NSString *const SMIncrementalStoreWriteBehindFailedNotification = @"SMIncrementalStoreWriteBehindFailedNotification";
+NSString *const SMIncrementalStoreOutboxEntryKey = @"SMIncrementalStoreOutboxEntryKey";
+
+#define SM_MAX_OBJECTS_PER_BATCH 100
+
+#define SM_MAX_IDS_PER_PREFETCH_QUERY 100
+
+#define SM_MAX_CONCURRENT_FETCH_REQUESTS 4
+
+#define SM_MAX_IDS_PER_RANGE 500
+
+#define SM_MAX_BATCHED_FETCHES 8
+
+#define SM_MAX_CACHED_ROWS 2000
+
+#define SM_CacheValuesKey @"values"
+#define SM_CacheVersionKey @"version"
+#define SM_CacheFaultedKey @"faulted"
 
 @interface SMIncrementalStore () {
-    NSMutableDictionary *cache;
+    NSCache *cache;
+    NSMutableDictionary *pinnedRows;
+    NSMutableArray *batchedFetches;
+    NSMutableSet *revalidatedFetchKeys;
+    NSString *offlineStorePath;
+    dispatch_queue_t requestQueue;
 }
 
 @property (nonatomic, strong) SMDataStore *smDataStore;
+@property (nonatomic) BOOL batchSaves;
+@property (nonatomic) NSUInteger maxConcurrentSaveRequests;
+@property (nonatomic) NSUInteger fetchPageSize;
+@property (nonatomic, strong) SMOfflineStore *offlineStore;
+@property (nonatomic, strong) SMOutbox *outbox;
 
 - (id)handleSaveRequest:(NSPersistentStoreRequest *)request 
             withContext:(NSManagedObjectContext *)context 
@@ -48,18 +87,120 @@ NSString *const SM_DataStoreKey = @"SM_DataStoreKey";
 @implementation SMIncrementalStore
 
 @synthesize smDataStore = _smDataStore;
+@synthesize batchSaves = _batchSaves;
+@synthesize maxConcurrentSaveRequests = _maxConcurrentSaveRequests;
+@synthesize fetchPageSize = _fetchPageSize;
+@synthesize offlineStore = _offlineStore;
+@synthesize outbox = _outbox;
 
 
 - (id)initWithPersistentStoreCoordinator:(NSPersistentStoreCoordinator *)root configurationName:(NSString *)name URL:(NSURL *)url options:(NSDictionary *)options {
     
     self = [super initWithPersistentStoreCoordinator:root configurationName:name URL:url options:options];
     if (self) {
-        cache = [NSMutableDictionary dictionary];
+        cache = [[NSCache alloc] init];
+        [cache setCountLimit:SM_MAX_CACHED_ROWS];
+        pinnedRows = [NSMutableDictionary dictionary];
+        batchedFetches = [NSMutableArray array];
+        requestQueue = dispatch_queue_create("com.stackmob.incrementalstore.requests", DISPATCH_QUEUE_CONCURRENT);
         _smDataStore = [options objectForKey:SM_DataStoreKey];
+        _batchSaves = [[options objectForKey:SM_BatchSavesKey] boolValue];
+        NSNumber *maxConcurrentSaveRequests = [options objectForKey:SM_MaxConcurrentSaveRequestsKey];
+        _maxConcurrentSaveRequests = maxConcurrentSaveRequests ? MAX([maxConcurrentSaveRequests unsignedIntegerValue], (NSUInteger)1) : SM_DEFAULT_MAX_CONCURRENT_SAVE_REQUESTS;
+        _fetchPageSize = [[options objectForKey:SM_FetchPageSizeKey] unsignedIntegerValue];
+        offlineStorePath = [[options objectForKey:SM_OfflineStorePathKey] copy];
+        if (offlineStorePath) {
+            revalidatedFetchKeys = [NSMutableSet set];
+            // Switches stores as soon as the user logs out or another logs in, rather than on the next fetch or save.
+            [_smDataStore.session addObserver:self forKeyPath:@"userIdentifier" options:0 context:SMOfflineStoreUserContext];
+        }
+        NSString *outboxPath = [options objectForKey:SM_OutboxPathKey];
+        if (outboxPath) {
+            _outbox = [[SMOutbox alloc] initWithPath:outboxPath dataStore:_smDataStore];
+            // The outbox keeps flushing on its own queue, and may outlive the store.
+            __weak SMIncrementalStore *weakSelf = self;
+            _outbox.failureBlock = ^(NSDictionary *entry, NSError *theError) {
+                SMIncrementalStore *store = weakSelf;
+                if (store == nil) {
+                    return;
+                }
+                NSDictionary *userInfo = [NSDictionary dictionaryWithObjectsAndKeys:entry, SMIncrementalStoreOutboxEntryKey, theError, NSUnderlyingErrorKey, nil];
+                [[NSNotificationCenter defaultCenter] postNotificationName:SMIncrementalStoreWriteBehindFailedNotification object:store userInfo:userInfo];
+            };
+        }
     }
     return self;
 }
 
+- (void)dealloc
+{
+    if (offlineStorePath) {
+        [_smDataStore.session removeObserver:self forKeyPath:@"userIdentifier" context:SMOfflineStoreUserContext];
+    }
+    if (requestQueue) {
+        dispatch_release(requestQueue);
+    }
+}
+
+/*
+ Returns options for a request made by the store.  Core Data waits on the store's requests synchronously, often on the main thread, so their callbacks run on the store's own concurrent queue rather than the data store's completion queue.
+ */
+- (SMRequestOptions *)requestOptionsWithHeaders:(NSDictionary *)headers
+{
+    SMRequestOptions *options = [SMRequestOptions optionsWithHeaders:headers];
+    options.completionQueue = requestQueue;
+    return options;
+}
+
+- (void)observeValueForKeyPath:(NSString *)keyPath ofObject:(id)object change:(NSDictionary *)change context:(void *)context
+{
+    if (context == SMOfflineStoreUserContext) {
+        [self offlineStore];
+    } else {
+        [super observeValueForKeyPath:keyPath ofObject:object change:change context:context];
+    }
+}
+
+/*
+ Returns the name of the directory under the offline store path which holds a user's rows.
+ */
+static NSString *offlineDirectoryForUser(NSString *userIdentifier)
+{
+    if (userIdentifier == nil) {
+        return @"anonymous";
+    }
+    NSString *escapedIdentifier = (__bridge_transfer NSString *)CFURLCreateStringByAddingPercentEscapes(NULL, (__bridge CFStringRef)userIdentifier, NULL, CFSTR("/:.%"), kCFStringEncodingUTF8);
+    return [@"user-" stringByAppendingString:escapedIdentifier];
+}
+
+/*
+ Returns the offline store of the user logged in, kept in its own directory under the path given by SM_OfflineStorePathKey, or nil without that option.  Whenever the user changes, including on logout, the directories of every other user are deleted, so no user is ever shown rows fetched for another.
+ */
+- (SMOfflineStore *)offlineStore
+{
+    if (offlineStorePath == nil) {
+        return nil;
+    }
+    @synchronized(self) {
+        NSString *directory = offlineDirectoryForUser(self.smDataStore.session.userIdentifier);
+        if (_offlineStore == nil || ![[_offlineStore.path lastPathComponent] isEqualToString:directory]) {
+            // Stops writes the previous store still has scheduled.
+            [_offlineStore removeAllRows];
+            NSFileManager *fileManager = [NSFileManager defaultManager];
+            for (NSString *file in [fileManager contentsOfDirectoryAtPath:offlineStorePath error:nil]) {
+                if (![file isEqualToString:directory]) {
+                    [fileManager removeItemAtPath:[offlineStorePath stringByAppendingPathComponent:file] error:nil];
+                }
+            }
+            _offlineStore = [[SMOfflineStore alloc] initWithPath:[offlineStorePath stringByAppendingPathComponent:directory]];
+            @synchronized(revalidatedFetchKeys) {
+                [revalidatedFetchKeys removeAllObjects];
+            }
+        }
+        return _offlineStore;
+    }
+}
+
 /*
 Once a store has been created, the persistent store coordinator invokes loadMetadata: on it. In your implementation, if all goes well you should typically load the store metadata, call setMetadata: to store the metadata, and return YES. If an error occurs, however (if the store is invalid for some reason—for example, if the store URL is invalid, or the user doesn’t have read permission for the store URL), create an NSError object that describes the problem, assign it to the error parameter passed into the method, and return NO.
 
@@ -147,23 +288,27 @@ You should implement this method conservatively, and expect that unknown request
     DLog();
     NSSaveChangesRequest *saveRequest = [[NSSaveChangesRequest alloc] initWithInsertedObjects:[context insertedObjects] updatedObjects:[context updatedObjects] deletedObjects:[context deletedObjects] lockedObjects:nil];
     
+    if (self.outbox) {
+        return [self handleWriteBehindSaveRequest:saveRequest error:error] ? [NSArray array] : nil;
+    }
+    
     NSSet *insertedObjects = [saveRequest insertedObjects];
     if ([insertedObjects count] > 0) {
-        BOOL insertSuccess = [self handleInsertedObjects:insertedObjects inContext:context error:error];
+        BOOL insertSuccess = self.batchSaves ? [self handleBatchedInsertedObjects:insertedObjects inContext:context error:error] : [self handleInsertedObjects:insertedObjects inContext:context error:error];
         if (!insertSuccess) {
             return nil;
         }
     }
     NSSet *updatedObjects = [saveRequest updatedObjects];
     if ([updatedObjects count] > 0) {
-        BOOL updateSuccess = [self handleUpdatedObjects:updatedObjects inContext:context error:error];
+        BOOL updateSuccess = self.batchSaves ? [self handleBatchedUpdatedObjects:updatedObjects inContext:context error:error] : [self handleUpdatedObjects:updatedObjects inContext:context error:error];
         if (!updateSuccess) {
             return nil;
         }
     }
     NSSet *deletedObjects = [saveRequest deletedObjects];
     if ([deletedObjects count] > 0) {
-        BOOL deleteSuccess = [self handleDeletedObjects:deletedObjects inContext:context error:error];
+        BOOL deleteSuccess = self.batchSaves ? [self handleBatchedDeletedObjects:deletedObjects inContext:context error:error] : [self handleDeletedObjects:deletedObjects inContext:context error:error];
         if (!deleteSuccess) {
             return nil;
         }
@@ -173,117 +318,332 @@ You should implement this method conservatively, and expect that unknown request
 }
 
 - (BOOL)handleInsertedObjects:(NSSet *)insertedObjects inContext:(NSManagedObjectContext *)context error:(NSError *__autoreleasing *)error {
-    DLog();
-    __block BOOL success = NO;
     DLog(@"objects to be inserted are %@", insertedObjects);
-    [insertedObjects enumerateObjectsUsingBlock:^(id obj, BOOL *stop) {
-        syncWithSemaphore(^(dispatch_semaphore_t semaphore) {
-            NSDictionary *objDict = [obj sm_dictionarySerialization];
-            NSString *schemaName = [obj sm_schema];
-            DLog(@"serialized object is %@", objDict);
-            // add relationship headers if needed
-            NSMutableDictionary *headerDict = [NSMutableDictionary dictionary];
-            if ([self relationshipsPresentInSerializedDict:objDict object:obj]) {
-                [headerDict setObject:[obj sm_relationshipHeader] forKey:@"X-StackMob-Relations"];
-            }
-            
-            [self.smDataStore createObject:objDict inSchema:schemaName options:[SMRequestOptions optionsWithHeaders:headerDict] onSuccess:^(NSDictionary *theObject, NSString *schema) {
+    NSArray *requests = [self insertRequestsForObjects:[insertedObjects allObjects]];
+    return [self performSaveRequests:requests error:error];
+}
+
+- (BOOL)handleUpdatedObjects:(NSSet *)updatedObjects inContext:(NSManagedObjectContext *)context error:(NSError *__autoreleasing *)error {
+    DLog(@"objects to be updated are %@", updatedObjects);
+    NSArray *requests = [self updateRequestsForObjects:[updatedObjects allObjects]];
+    return [self performSaveRequests:requests error:error];
+}
+
+- (BOOL)handleDeletedObjects:(NSSet *)deletedObjects inContext:(NSManagedObjectContext *)context error:(NSError *__autoreleasing *)error {
+    DLog(@"objects to be deleted are %@", deletedObjects);
+    NSArray *requests = [self deleteRequestsForObjects:[deletedObjects allObjects]];
+    return [self performSaveRequests:requests error:error];
+}
+
+/*
+ Runs the given requests with at most maxConcurrentSaveRequests in flight, waiting once for all of them.  Once a request fails no more are started, so a failed save sends as few changes as it can.  If any failed, error is set to the failure of the earliest failed request in the array.
+ */
+- (BOOL)performSaveRequests:(NSArray *)requests error:(NSError *__autoreleasing *)error {
+    NSError *firstError = synchronousRequestsUntilFailure(requests, self.maxConcurrentSaveRequests);
+    if (firstError != nil) {
+        if (error != NULL) {
+            *error = (__bridge id)(__bridge_retained CFTypeRef)firstError;
+        }
+        return NO;
+    }
+    return YES;
+}
+
+#pragma mark - Save requests
+
+/*
+ The request builders below serialize every object up front, on the thread Core Data called us on.  The returned blocks only capture the serialized dictionaries, ids and schema names, since synchronousRequests may start them from another request's completion callback.
+ */
+- (NSArray *)insertRequestsForObjects:(NSArray *)objects {
+    NSMutableArray *requests = [NSMutableArray arrayWithCapacity:[objects count]];
+    for (id obj in objects) {
+        NSDictionary *objDict = [obj sm_dictionarySerialization];
+        NSString *schemaName = [obj sm_schema];
+        DLog(@"serialized object is %@", objDict);
+        // add relationship headers if needed
+        NSMutableDictionary *headerDict = [NSMutableDictionary dictionary];
+        if ([self relationshipsPresentInSerializedDict:objDict object:obj]) {
+            [headerDict setObject:[obj sm_relationshipHeader] forKey:@"X-StackMob-Relations"];
+        }
+        NSDictionary *savedRow = self.offlineStore ? [self rowForSavedObject:obj serialization:objDict] : nil;
+        NSString *primaryKeyField = [obj sm_primaryKeyField];
+        SynchronousRequestBlock request = ^(SynchronousRequestCompletionBlock completionBlock) {
+            [self.smDataStore createObject:objDict inSchema:schemaName options:[self requestOptionsWithHeaders:headerDict] onSuccess:^(NSDictionary *theObject, NSString *schema) {
                 DLog(@"SMIncrementalStore inserted object with id %@ on schema %@", theObject, schema);
-                success = YES;
-                // TO-DO OFFLINE-SUPPORT
-                //[self cacheInsert:theObject forEntity:[obj entity] inContext:context];
-                syncReturn(semaphore);
+                [self storeSavedRow:savedRow response:theObject inSchema:schemaName primaryKeyField:primaryKeyField];
+                completionBlock(nil);
             } onFailure:^(NSError *theError, NSDictionary *theObject, NSString *schema) {
                 DLog(@"SMIncrementalStore failed to insert object with id %@ on schema %@", theObject, schema);
                 DLog(@"the error userInfo is %@", [theError userInfo]);
-                success = NO;
-                *error = (__bridge id)(__bridge_retained CFTypeRef)theError;
-                syncReturn(semaphore);
+                completionBlock(theError);
             }];
-        });
-        if (success == NO)
-            *stop = YES;
-    }];
-    return success;
+        };
+        [requests addObject:[request copy]];
+    }
+    return requests;
 }
 
-- (BOOL)handleUpdatedObjects:(NSSet *)updatedObjects inContext:(NSManagedObjectContext *)context error:(NSError *__autoreleasing *)error {
-    DLog();
-    __block BOOL success = NO;
-    DLog(@"objects to be updated are %@", updatedObjects);
-    [updatedObjects enumerateObjectsUsingBlock:^(id obj, BOOL *stop) {
-        syncWithSemaphore(^(dispatch_semaphore_t semaphore) {
-            
-            NSDictionary *objDict = [obj sm_dictionarySerialization];
-            NSString *schemaName = [obj sm_schema];
-            DLog(@"serialized object is %@", objDict);
-            // if there are relationships present in the update, send as a POST
-            if ([self relationshipsPresentInSerializedDict:objDict object:obj]) {
-                NSDictionary *headerDict = [NSDictionary dictionaryWithObject:[obj sm_relationshipHeader] forKey:@"X-StackMob-Relations"];
-                [self.smDataStore createObject:objDict inSchema:schemaName options:[SMRequestOptions optionsWithHeaders:headerDict] onSuccess:^(NSDictionary *theObject, NSString *schema) {
+- (NSArray *)updateRequestsForObjects:(NSArray *)objects {
+    NSMutableArray *requests = [NSMutableArray arrayWithCapacity:[objects count]];
+    for (id obj in objects) {
+        NSDictionary *objDict = [obj sm_dictionarySerialization];
+        NSString *schemaName = [obj sm_schema];
+        NSString *objectId = [obj sm_objectId];
+        DLog(@"serialized object is %@", objDict);
+        // the cached row no longer matches, so the next fault will read the saved version
+        [self cachePurge:[obj objectID]];
+        NSDictionary *savedRow = self.offlineStore ? [self rowForSavedObject:obj serialization:objDict] : nil;
+        NSString *primaryKeyField = [obj sm_primaryKeyField];
+        SynchronousRequestBlock request = nil;
+        // if there are relationships present in the update, send as a POST
+        if ([self relationshipsPresentInSerializedDict:objDict object:obj]) {
+            NSDictionary *headerDict = [NSDictionary dictionaryWithObject:[obj sm_relationshipHeader] forKey:@"X-StackMob-Relations"];
+            request = ^(SynchronousRequestCompletionBlock completionBlock) {
+                [self.smDataStore createObject:objDict inSchema:schemaName options:[self requestOptionsWithHeaders:headerDict] onSuccess:^(NSDictionary *theObject, NSString *schema) {
                     DLog(@"SMIncrementalStore inserted object with id %@ on schema %@", theObject, schema);
-                    success = YES;
-                    // TO-DO OFFLINE-SUPPORT
-                    //[self cacheInsert:theObject forEntity:[obj entity] inContext:context];
-                    syncReturn(semaphore);
+                    [self storeSavedRow:savedRow response:theObject inSchema:schemaName primaryKeyField:primaryKeyField];
+                    completionBlock(nil);
                 } onFailure:^(NSError *theError, NSDictionary *theObject, NSString *schema) {
                     DLog(@"SMIncrementalStore failed to insert object with id %@ on schema %@", theObject, schema);
                     DLog(@"the error userInfo is %@", [theError userInfo]);
-                    success = NO;
-                    *error = (__bridge id)(__bridge_retained CFTypeRef)theError;
-                    syncReturn(semaphore);
+                    completionBlock(theError);
                 }];
-            } else {
-                [self.smDataStore updateObjectWithId:[obj sm_objectId] inSchema:schemaName update:objDict onSuccess:^(NSDictionary *theObject, NSString *schema) {
+            };
+        } else {
+            request = ^(SynchronousRequestCompletionBlock completionBlock) {
+                [self.smDataStore updateObjectWithId:objectId inSchema:schemaName update:objDict options:[self requestOptionsWithHeaders:nil] onSuccess:^(NSDictionary *theObject, NSString *schema) {
                     DLog(@"SMIncrementalStore updated object with id %@ on schema %@", theObject, schema);
-                    success = YES;
-                    // TO-DO OFFLINE-SUPPORT
-                    //[self cacheInsert:theObject forEntity:[obj entity] inContext:context];
-                    syncReturn(semaphore);
+                    [self storeSavedRow:savedRow response:theObject inSchema:schemaName primaryKeyField:primaryKeyField];
+                    completionBlock(nil);
                 } onFailure:^(NSError *theError, NSDictionary *theObject, NSString *schema) {
                     DLog(@"SMIncrementalStore failed to update object with id %@ on schema %@", theObject, schema);
                     DLog(@"the error userInfo is %@", [theError userInfo]);
-                    success = NO;
-                    *error = (__bridge id)(__bridge_retained CFTypeRef)theError;
-                    syncReturn(semaphore);
+                    completionBlock(theError);
                 }];
-            }
-            
-        });
-        if (success == NO)
-            *stop = YES;
-    }];
-    return success;
+            };
+        }
+        [requests addObject:[request copy]];
+    }
+    return requests;
 }
 
-- (BOOL)handleDeletedObjects:(NSSet *)deletedObjects inContext:(NSManagedObjectContext *)context error:(NSError *__autoreleasing *)error {
-    DLog();
-    __block BOOL success = NO;
-    DLog(@"objects to be deleted are %@", deletedObjects);
-    [deletedObjects enumerateObjectsUsingBlock:^(id obj, BOOL *stop) {        
-        syncWithSemaphore(^(dispatch_semaphore_t semaphore) {
-            NSString *schemaName = [obj sm_schema];
-            NSString *uuid = [obj sm_objectId];
-            [self.smDataStore deleteObjectId:uuid inSchema:schemaName onSuccess:^(NSString *theObjectId, NSString *schema) {
+- (NSArray *)deleteRequestsForObjects:(NSArray *)objects {
+    NSMutableArray *requests = [NSMutableArray arrayWithCapacity:[objects count]];
+    for (id obj in objects) {
+        NSString *schemaName = [obj sm_schema];
+        NSString *uuid = [obj sm_objectId];
+        [self cachePurge:[obj objectID]];
+        [self.offlineStore removeRowWithPrimaryKey:uuid inSchema:schemaName];
+        SynchronousRequestBlock request = ^(SynchronousRequestCompletionBlock completionBlock) {
+            [self.smDataStore deleteObjectId:uuid inSchema:schemaName options:[self requestOptionsWithHeaders:nil] onSuccess:^(NSString *theObjectId, NSString *schema) {
                 DLog(@"SMIncrementalStore deleted object with id %@ on schema %@", theObjectId, schema);
-                success = YES;
-                syncReturn(semaphore);
+                completionBlock(nil);
             } onFailure:^(NSError *theError, NSString *theObjectId, NSString *schema) {
                 DLog(@"SMIncrementalStore failed to delete object with id %@ on schema %@", theObjectId, schema);
                 DLog(@"the error userInfo is %@", [theError userInfo]);
-                success = NO;
-                *error = (__bridge id)(__bridge_retained CFTypeRef)theError;
-                syncReturn(semaphore);
+                completionBlock(theError);
             }];
-            if (success) {
-                // TO-DO OFFLINE-SUPPORT
-                //[self cachePurge:[obj objectID]];
+        };
+        [requests addObject:[request copy]];
+    }
+    return requests;
+}
+
+#pragma mark - Write-behind saves
+
+/*
+ Serializes the changes of a save into outbox entries, in the order an ordinary save sends them, and appends them to the outbox, which flushes them in the background.  Updated objects with relationships are created again with relationship headers, as ordinary saves do.
+ 
+ StackMob won't have inserted and updated objects until the outbox is flushed, so their saved rows are pinned in the row cache, and faults are fulfilled with them rather than with a read.
+ */
+- (BOOL)handleWriteBehindSaveRequest:(NSSaveChangesRequest *)saveRequest error:(NSError *__autoreleasing *)error {
+    NSMutableArray *entries = [NSMutableArray array];
+    for (id obj in [saveRequest insertedObjects]) {
+        NSDictionary *objDict = [obj sm_dictionarySerialization];
+        NSDictionary *headerDict = nil;
+        if ([self relationshipsPresentInSerializedDict:objDict object:obj]) {
+            headerDict = [NSDictionary dictionaryWithObject:[obj sm_relationshipHeader] forKey:@"X-StackMob-Relations"];
+        }
+        [entries addObject:[SMOutbox entryToCreateObject:objDict inSchema:[obj sm_schema] headers:headerDict]];
+        NSDictionary *savedRow = [self rowForSavedObject:obj serialization:objDict];
+        [self cacheInsert:savedRow forEntity:[obj entity] pinned:YES];
+        [self storeSavedRow:savedRow response:nil inSchema:[obj sm_schema] primaryKeyField:[obj sm_primaryKeyField]];
+    }
+    for (id obj in [saveRequest updatedObjects]) {
+        NSDictionary *objDict = [obj sm_dictionarySerialization];
+        NSDictionary *savedRow = [self rowForSavedObject:obj serialization:objDict];
+        [self cacheInsert:savedRow forEntity:[obj entity] pinned:YES];
+        [self storeSavedRow:savedRow response:nil inSchema:[obj sm_schema] primaryKeyField:[obj sm_primaryKeyField]];
+        if ([self relationshipsPresentInSerializedDict:objDict object:obj]) {
+            NSDictionary *headerDict = [NSDictionary dictionaryWithObject:[obj sm_relationshipHeader] forKey:@"X-StackMob-Relations"];
+            [entries addObject:[SMOutbox entryToCreateObject:objDict inSchema:[obj sm_schema] headers:headerDict]];
+        } else {
+            [entries addObject:[SMOutbox entryToUpdateObjectWithId:[obj sm_objectId] object:objDict inSchema:[obj sm_schema]]];
+        }
+    }
+    for (id obj in [saveRequest deletedObjects]) {
+        [self cachePurge:[obj objectID]];
+        [self.offlineStore removeRowWithPrimaryKey:[obj sm_objectId] inSchema:[obj sm_schema]];
+        [entries addObject:[SMOutbox entryToDeleteObjectWithId:[obj sm_objectId] inSchema:[obj sm_schema]]];
+    }
+    return [self.outbox appendEntries:entries error:error];
+}
+
+#pragma mark - Batched saves
+
+/*
+ Inserted objects are grouped by schema, and by whether they need relationship headers, then sent with one createObjects:inSchema: request per SM_MAX_OBJECTS_PER_BATCH objects.  The batches share the same bounded pool of in-flight requests as unbatched saves.
+ 
+ Any object which is not in the succeeded list of its batch, or whose batch failed outright, is reported through the returned error.
+ */
+- (BOOL)handleBatchedInsertedObjects:(NSSet *)insertedObjects inContext:(NSManagedObjectContext *)context error:(NSError *__autoreleasing *)error {
+    DLog(@"objects to be inserted in batches are %@", insertedObjects);
+    
+    NSMutableDictionary *batchesForKey = [NSMutableDictionary dictionary];
+    NSMutableDictionary *headersForKey = [NSMutableDictionary dictionary];
+    [insertedObjects enumerateObjectsUsingBlock:^(id obj, BOOL *stop) {
+        NSDictionary *objDict = [obj sm_dictionarySerialization];
+        NSString *schemaName = [obj sm_schema];
+        BOOL needsRelationshipHeader = [self relationshipsPresentInSerializedDict:objDict object:obj];
+        NSString *batchKey = [NSString stringWithFormat:@"%@:%d", schemaName, needsRelationshipHeader];
+        
+        NSMutableArray *batches = [batchesForKey objectForKey:batchKey];
+        if (batches == nil) {
+            batches = [NSMutableArray array];
+            [batchesForKey setObject:batches forKey:batchKey];
+            NSMutableDictionary *headerDict = [NSMutableDictionary dictionary];
+            if (needsRelationshipHeader) {
+                [headerDict setObject:[obj sm_relationshipHeader] forKey:@"X-StackMob-Relations"];
             }
-        });
-        if (success == NO)
-            *stop = YES;
+            [headersForKey setObject:headerDict forKey:batchKey];
+        }
+        if ([batches count] == 0 || [[batches lastObject] count] == SM_MAX_OBJECTS_PER_BATCH) {
+            [batches addObject:[NSMutableArray array]];
+        }
+        NSMutableDictionary *entry = [NSMutableDictionary dictionaryWithObjectsAndKeys:obj, @"object", objDict, @"dictionary", [obj sm_objectId], @"objectId", schemaName, @"schema", batchKey, @"batchKey", [obj sm_primaryKeyField], @"primaryKeyField", nil];
+        [entry setValue:self.offlineStore ? [self rowForSavedObject:obj serialization:objDict] : nil forKey:@"savedRow"];
+        [[batches lastObject] addObject:entry];
+    }];
+    
+    NSMutableArray *allBatches = [NSMutableArray array];
+    for (NSArray *batches in [batchesForKey allValues]) {
+        [allBatches addObjectsFromArray:batches];
+    }
+    
+    // Ids the server left out of a batch's succeeded list; the batch request itself still succeeded.
+    NSMutableSet *unsavedIds = [NSMutableSet set];
+    NSMutableArray *requests = [NSMutableArray arrayWithCapacity:[allBatches count]];
+    for (NSArray *batch in allBatches) {
+        NSString *schemaName = [[batch lastObject] objectForKey:@"schema"];
+        NSArray *objectDicts = [batch valueForKey:@"dictionary"];
+        NSArray *objectIds = [batch valueForKey:@"objectId"];
+        NSArray *savedRows = [batch valueForKey:@"savedRow"];
+        NSString *primaryKeyField = [[batch lastObject] objectForKey:@"primaryKeyField"];
+        NSDictionary *headerDict = [headersForKey objectForKey:[[batch lastObject] objectForKey:@"batchKey"]];
+        SynchronousRequestBlock request = ^(SynchronousRequestCompletionBlock completionBlock) {
+            [self.smDataStore createObjects:objectDicts inSchema:schemaName options:[self requestOptionsWithHeaders:headerDict] onSuccess:^(NSArray *succeeded, NSArray *failed, NSString *schema) {
+                DLog(@"SMIncrementalStore inserted objects with ids %@ on schema %@", succeeded, schema);
+                NSMutableSet *missingIds = [NSMutableSet setWithArray:objectIds];
+                [missingIds minusSet:[NSSet setWithArray:succeeded]];
+                [objectIds enumerateObjectsUsingBlock:^(id objectId, NSUInteger idx, BOOL *stop) {
+                    if (![missingIds containsObject:objectId]) {
+                        [self storeSavedRow:[savedRows objectAtIndex:idx] response:nil inSchema:schemaName primaryKeyField:primaryKeyField];
+                    }
+                }];
+                @synchronized(unsavedIds) {
+                    [unsavedIds unionSet:missingIds];
+                }
+                completionBlock(nil);
+            } onFailure:^(NSError *theError, NSArray *objects, NSString *schema) {
+                DLog(@"SMIncrementalStore failed to insert objects on schema %@, the error userInfo is %@", schema, [theError userInfo]);
+                completionBlock(theError);
+            }];
+        };
+        [requests addObject:[request copy]];
+    }
+    
+    NSArray *batchErrors = nil;
+    synchronousRequests(requests, self.maxConcurrentSaveRequests, &batchErrors);
+    
+    NSMutableArray *failures = [NSMutableArray array];
+    [allBatches enumerateObjectsUsingBlock:^(id batch, NSUInteger idx, BOOL *stop) {
+        id batchError = [batchErrors objectAtIndex:idx];
+        for (NSDictionary *entry in batch) {
+            if (batchError != [NSNull null]) {
+                [failures addObject:[self errorForObject:[entry objectForKey:@"object"] underlyingError:batchError]];
+            } else if ([unsavedIds containsObject:[entry objectForKey:@"objectId"]]) {
+                NSError *objectError = [[NSError alloc] initWithDomain:SMErrorDomain code:SMErrorBatchSaveFailed userInfo:nil];
+                [failures addObject:[self errorForObject:[entry objectForKey:@"object"] underlyingError:objectError]];
+            }
+        }
+    }];
+    
+    return [self batchSaveSucceededWithFailures:failures error:error];
+}
+
+/*
+ StackMob only accepts multiple objects in one request when creating them, so updates are sent one request per object and every failure is collected, rather than stopping at the first.
+ */
+- (BOOL)handleBatchedUpdatedObjects:(NSSet *)updatedObjects inContext:(NSManagedObjectContext *)context error:(NSError *__autoreleasing *)error {
+    DLog(@"objects to be updated in batches are %@", updatedObjects);
+    NSArray *objects = [updatedObjects allObjects];
+    NSArray *errors = nil;
+    synchronousRequests([self updateRequestsForObjects:objects], self.maxConcurrentSaveRequests, &errors);
+    return [self batchSaveSucceededWithFailures:[self failuresForObjects:objects errors:errors] error:error];
+}
+
+/*
+ As with updates, deletes are one request per object and every failure is collected.
+ */
+- (BOOL)handleBatchedDeletedObjects:(NSSet *)deletedObjects inContext:(NSManagedObjectContext *)context error:(NSError *__autoreleasing *)error {
+    DLog(@"objects to be deleted in batches are %@", deletedObjects);
+    NSArray *objects = [deletedObjects allObjects];
+    NSArray *errors = nil;
+    synchronousRequests([self deleteRequestsForObjects:objects], self.maxConcurrentSaveRequests, &errors);
+    return [self batchSaveSucceededWithFailures:[self failuresForObjects:objects errors:errors] error:error];
+}
+
+/*
+ Pairs each object with the result of its request, as returned by synchronousRequests, and returns an error for each one that failed.
+ */
+- (NSArray *)failuresForObjects:(NSArray *)objects errors:(NSArray *)errors
+{
+    NSMutableArray *failures = [NSMutableArray array];
+    [objects enumerateObjectsUsingBlock:^(id obj, NSUInteger idx, BOOL *stop) {
+        id theError = [errors objectAtIndex:idx];
+        if (theError != [NSNull null]) {
+            [failures addObject:[self errorForObject:obj underlyingError:theError]];
+        }
     }];
-    return success;
+    return failures;
+}
+
+/*
+ Returns a copy of theError with the failed object attached under NSAffectedObjectsErrorKey, the same way Core Data reports validation failures.
+ */
+- (NSError *)errorForObject:(NSManagedObject *)object underlyingError:(NSError *)theError
+{
+    NSMutableDictionary *userInfo = [NSMutableDictionary dictionary];
+    if ([[theError userInfo] isKindOfClass:[NSDictionary class]]) {
+        [userInfo addEntriesFromDictionary:[theError userInfo]];
+    }
+    [userInfo setObject:[NSArray arrayWithObject:object] forKey:NSAffectedObjectsErrorKey];
+    return [[NSError alloc] initWithDomain:[theError domain] code:[theError code] userInfo:userInfo];
+}
+
+/*
+ If any objects failed to save, sets error to an SMErrorBatchSaveFailed error holding the per-object errors under NSDetailedErrorsKey and returns NO.
+ */
+- (BOOL)batchSaveSucceededWithFailures:(NSArray *)failures error:(NSError *__autoreleasing *)error
+{
+    if ([failures count] == 0) {
+        return YES;
+    }
+    if (error != NULL) {
+        NSDictionary *userInfo = [NSDictionary dictionaryWithObject:failures forKey:NSDetailedErrorsKey];
+        *error = [[NSError alloc] initWithDomain:SMErrorDomain code:SMErrorBatchSaveFailed userInfo:userInfo];
+    }
+    return NO;
 }
 
 /*
@@ -306,10 +666,10 @@ You should implement this method conservatively, and expect that unknown request
             return [self fetchObjectIDs:fetchRequest withContext:context error:error];
             break;
         case NSDictionaryResultType:
-            NSAssert(false, @"Unimplemented result type requested."); 
+            return [self fetchDictionaries:fetchRequest withContext:context error:error];
             break;
         case NSCountResultType:
-            NSAssert(false, @"Unimplemented result type requested."); 
+            return [self fetchCount:fetchRequest withContext:context error:error];
             break;
         default:
             NSAssert(false, @"Unknown result type requested."); 
@@ -318,105 +678,725 @@ You should implement this method conservatively, and expect that unknown request
     return nil;
 }
 
+/*
+ Returns the elements of array from offset, at most limit of them, or all of them if limit is 0.
+ */
+static NSArray *arrayWithOffsetAndLimit(NSArray *array, NSUInteger offset, NSUInteger limit)
+{
+    if (array == nil) {
+        return nil;
+    }
+    offset = MIN(offset, [array count]);
+    NSUInteger length = [array count] - offset;
+    if (limit) {
+        length = MIN(length, limit);
+    }
+    return [array subarrayWithRange:NSMakeRange(offset, length)];
+}
+
 // Returns NSArray<NSManagedObject>
 
+/*
+ Whatever part of the predicate StackMob can't evaluate is left as a residual predicate, which filters the fetched objects on the device.  The queries then return every object matching the rest of the predicate, so the offset and limit are applied after filtering, and batching is not used.
+ */
 - (id)fetchObjects:(NSFetchRequest *)fetchRequest withContext:(NSManagedObjectContext *)context error:(NSError * __autoreleasing *)error {
     DLog();
-    SMQuery *query = [SMIncrementalStore queryForFetchRequest:fetchRequest error:error];
+    NSPredicate *residualPredicate = nil;
+    NSArray *queries = [SMIncrementalStore queriesForFetchRequest:fetchRequest residualPredicate:&residualPredicate error:error];
 
-    if (query == nil) {
+    if (queries == nil) {
         return nil;
     }
     
-    __block id resultsWithoutOID;
-    synchronousQuery(self.smDataStore, query, ^(NSArray *results) {
-        resultsWithoutOID = results;
-    }, ^(NSError *theError) {
-        *error = (__bridge id)(__bridge_retained CFTypeRef)theError;
-    });
+    if (residualPredicate != nil) {
+        NSFetchRequest *remoteFetchRequest = [fetchRequest copy];
+        [remoteFetchRequest setFetchOffset:0];
+        [remoteFetchRequest setFetchLimit:0];
+        NSArray *objects = [self fetchObjects:remoteFetchRequest queries:queries withContext:context error:error];
+        return arrayWithOffsetAndLimit([objects filteredArrayUsingPredicate:residualPredicate], fetchRequest.fetchOffset, fetchRequest.fetchLimit);
+    }
+    
+    if (fetchRequest.fetchBatchSize > 0) {
+        return [self fetchObjectsInBatches:fetchRequest queries:queries withContext:context error:error];
+    }
+    
+    return [self fetchObjects:fetchRequest queries:queries withContext:context error:error];
+}
 
-    return [resultsWithoutOID map:^(id item) {
-        // TO-DO OFFLINE-SUPPORT
-        //NSManagedObjectID *oid = [self cacheInsert:item forEntity:fetchRequest.entity inContext:context];
-        
-        
-        NSString *primaryKeyField = [fetchRequest.entity sm_primaryKeyField];
-        id remoteID = [item objectForKey:primaryKeyField];
-        if (!remoteID) {
-            [NSException raise:SMExceptionIncompatibleObject format:@"No key for remote name"];
+/*
+ Fetches and caches the full rows matching queries, the translation of fetchRequest.
+ 
+ With an offline store, the rows each fetch returns are also kept on disk.  The first time a fetch is made after the store is added, it is answered from disk if it can be, and repeated against StackMob in the background, through the coordinator on a private queue context; once that finishes, the disk and row cache are up to date and SMIncrementalStoreDidRevalidateFetchNotification is posted on the main thread so the caller can fetch again.  Later fetches go to StackMob as usual.
+ */
+- (NSArray *)fetchObjects:(NSFetchRequest *)fetchRequest queries:(NSArray *)queries withContext:(NSManagedObjectContext *)context error:(NSError * __autoreleasing *)error {
+    NSArray *objectIDs = nil;
+    SMOfflineStore *offlineStore = self.offlineStore;
+    NSString *offlineKey = offlineStore ? [self keyForFetchRequest:fetchRequest queries:queries] : nil;
+    NSString *schema = [[queries lastObject] schemaName];
+    
+    BOOL firstFetch = NO;
+    if (offlineKey) {
+        @synchronized(revalidatedFetchKeys) {
+            firstFetch = ![revalidatedFetchKeys containsObject:offlineKey];
+            [revalidatedFetchKeys addObject:offlineKey];
+        }
+    }
+    if (firstFetch) {
+        NSArray *offlineRows = [offlineStore rowsForKey:offlineKey inSchema:schema];
+        if (offlineRows) {
+            objectIDs = [offlineRows map:^(id item) {
+                return [self cacheInsert:item forEntity:fetchRequest.entity];
+            }];
+            // The fetch is no longer the first, so making it again through the coordinator goes to StackMob and stores the fresh rows.
+            NSFetchRequest *revalidationRequest = [fetchRequest copy];
+            [revalidationRequest setResultType:NSManagedObjectIDResultType];
+            NSManagedObjectContext *revalidationContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
+            [revalidationContext setPersistentStoreCoordinator:[self persistentStoreCoordinator]];
+            [revalidationContext performBlock:^{
+                NSError *revalidationError = nil;
+                if ([revalidationContext executeFetchRequest:revalidationRequest error:&revalidationError]) {
+                    NSDictionary *userInfo = [NSDictionary dictionaryWithObject:[revalidationRequest.entity name] forKey:SMIncrementalStoreEntityNameKey];
+                    dispatch_async(dispatch_get_main_queue(), ^{
+                        [[NSNotificationCenter defaultCenter] postNotificationName:SMIncrementalStoreDidRevalidateFetchNotification object:self userInfo:userInfo];
+                    });
+                } else {
+                    DLog(@"Revalidating an offline fetch failed with error %@", revalidationError);
+                }
+            }];
+        }
+    }
+    
+    if (objectIDs == nil) {
+        objectIDs = [self objectIDsForFetchRequest:fetchRequest queries:queries error:error];
+        if (objectIDs && offlineKey) {
+            [self storeRowsForObjectIDs:objectIDs inOfflineStore:offlineStore forKey:offlineKey inSchema:schema entity:fetchRequest.entity];
         }
-        NSManagedObjectID *oid = [self newObjectIDForEntity:fetchRequest.entity referenceObject:remoteID];
+    }
+    
+    if (objectIDs && [[fetchRequest relationshipKeyPathsForPrefetching] count] > 0) {
+        [self prefetchRelationshipKeyPaths:[fetchRequest relationshipKeyPathsForPrefetching] forObjectIDs:objectIDs ofEntity:fetchRequest.entity];
+    }
+    
+    return [objectIDs map:^(id oid) {
         return [context objectWithID:oid];
     }];
 }
 
-// Returns NSArray<NSManagedObjectID>
+/*
+ Downloads and caches the full rows matching queries, returning their object IDs.
+ */
+- (NSArray *)objectIDsForFetchRequest:(NSFetchRequest *)fetchRequest queries:(NSArray *)queries error:(NSError * __autoreleasing *)error {
+    SMQuery *query = [queries count] == 1 ? [queries lastObject] : nil;
+    NSArray *objectIDs = nil;
+    if (query == nil) {
+        NSArray *rows = [self rowsForQueries:queries entity:fetchRequest.entity fields:nil error:error];
+        objectIDs = [[self rows:rows sortedAndLimitedForFetchRequest:fetchRequest] map:^(id item) {
+            return [self cacheInsert:item forEntity:fetchRequest.entity];
+        }];
+    } else if (self.fetchPageSize > 0 && (fetchRequest.fetchLimit == 0 || fetchRequest.fetchLimit > self.fetchPageSize)) {
+        objectIDs = [self fetchObjectIDsInPages:fetchRequest query:query error:error];
+    } else {
+        __block id resultsWithoutOID;
+        synchronousQuery(self.smDataStore, query, [self requestOptionsWithHeaders:nil], ^(NSArray *results) {
+            resultsWithoutOID = results;
+        }, ^(NSError *theError) {
+            *error = (__bridge id)(__bridge_retained CFTypeRef)theError;
+        });
+        
+        // Cache the full rows so faulting the objects in later needs no request.
+        objectIDs = [resultsWithoutOID map:^(id item) {
+            return [self cacheInsert:item forEntity:fetchRequest.entity];
+        }];
+    }
+    return objectIDs;
+}
 
-- (id)fetchObjectIDs:(NSFetchRequest *)fetchRequest withContext:(NSManagedObjectContext *)context error:(NSError *__autoreleasing *)error {
-    DLog();
-    NSArray *objects = [self fetchObjects:fetchRequest withContext:context error:error];
-    return [objects map:^(id item) {
-        return [item objectID];
-    }];
+/*
+ Identifies a fetch, in the offline store and among batched fetches, by its queries, which carry its predicate, sort and range, and by the offset and limit applied on the device to merged queries.
+ */
+- (NSString *)keyForFetchRequest:(NSFetchRequest *)fetchRequest queries:(NSArray *)queries {
+    NSMutableArray *components = [NSMutableArray arrayWithObject:[fetchRequest.entity name]];
+    for (SMQuery *query in queries) {
+        [components addObject:[query fingerprint]];
+    }
+    [components addObject:[NSString stringWithFormat:@"%lu-%lu", (unsigned long)fetchRequest.fetchOffset, (unsigned long)fetchRequest.fetchLimit]];
+    return [components componentsJoinedByString:@"|"];
 }
 
 /*
- Returns an incremental store node encapsulating the persistent external values of the object with a given object ID.
- Return Value
-   An incremental store node encapsulating the persistent external values of the object with object ID objectID, or nil if the corresponding object cannot be found.
- 
- Discussion
- The returned node should include all attributes values and may include to-one relationship values as instances of NSManagedObjectID.
- 
- If an object with object ID objectID cannot be found, the method should return nil and—if error is not NULL—create and return an appropriate error object in error.
+ Copies the cached rows of objectIDs, the results of a fetch, to the offline store.
  */
+- (void)storeRowsForObjectIDs:(NSArray *)objectIDs inOfflineStore:(SMOfflineStore *)offlineStore forKey:(NSString *)key inSchema:(NSString *)schema entity:(NSEntityDescription *)entity {
+    NSMutableArray *rows = [NSMutableArray arrayWithCapacity:[objectIDs count]];
+    for (NSManagedObjectID *objectID in objectIDs) {
+        NSDictionary *values = [[self cachedRowForObjectID:objectID] objectForKey:SM_CacheValuesKey];
+        if (values) {
+            [rows addObject:values];
+        }
+    }
+    [offlineStore setRows:rows forKey:key inSchema:schema primaryKeyField:[entity sm_primaryKeyField]];
+}
 
-// NOTE:
-// Basically, this resolves a fault into the actual materialized object.
+/*
+ Returns a copy of query limited to the objects from fromIndex to toIndex, inclusive.
+ */
+static SMQuery *rangeOfQuery(SMQuery *query, NSUInteger fromIndex, NSUInteger toIndex)
+{
+    SMQuery *rangeQuery = [query copy];
+    [rangeQuery fromIndex:fromIndex toIndex:toIndex];
+    return rangeQuery;
+}
 
 /*
- * Returns an incremental store node encapsulating the persistent external values of the object with a given object ID.
- The returned node should include all attributes values and may include to-one relationship values as instances of NSManagedObjectID.
-    
+ Runs the queries a predicate was expanded into concurrently, merging their rows in order and dropping duplicates by primary key.  When fields is not nil, only those fields are returned, and it must include the primary key field.  Each query gets its own options, since the data store updates them while retrying a request.
  */
-- (NSIncrementalStoreNode *)newValuesForObjectWithID:(NSManagedObjectID *)objectID
-                                         withContext:(NSManagedObjectContext *)context 
-                                               error:(NSError *__autoreleasing *)error {
-    
-    DLog(@"new values for object with id %@", [context objectWithID:objectID]);
-    // TO DO OFFLINE SUPPORT
-    // NSDictionary *objectFields = [cache objectForKey:objectID];
-    // Make a GET call to SM and return the properties for the entity
-    __block NSManagedObject *theObj = [context objectWithID:objectID];
-    __block NSEntityDescription *objEntity = [theObj entity];
-    __block NSString *schemaName = [[objEntity name] lowercaseString];
-    __block NSString *objStringId = [self referenceObjectForObjectID:objectID];
-    __block BOOL success = NO;
-    __block NSDictionary *objectFields;
-    
-    
+- (NSArray *)rowsForQueries:(NSArray *)queries entity:(NSEntityDescription *)entity fields:(NSArray *)fields error:(NSError *__autoreleasing *)error {
+    NSMutableArray *resultsByQuery = [NSMutableArray arrayWithCapacity:[queries count]];
+    NSMutableArray *requests = [NSMutableArray arrayWithCapacity:[queries count]];
+    [queries enumerateObjectsUsingBlock:^(id query, NSUInteger idx, BOOL *stop) {
+        [resultsByQuery addObject:[NSArray array]];
+        SynchronousRequestBlock request = ^(SynchronousRequestCompletionBlock completionBlock) {
+            SMRequestOptions *options = [self requestOptionsWithHeaders:nil];
+            if (fields != nil) {
+                [options restrictReturnedFieldsTo:fields];
+            }
+            [self.smDataStore performQuery:query options:options onSuccess:^(NSArray *results) {
+                @synchronized(resultsByQuery) {
+                    [resultsByQuery replaceObjectAtIndex:idx withObject:results];
+                }
+                completionBlock(nil);
+            } onFailure:^(NSError *theError) {
+                completionBlock(theError);
+            }];
+        };
+        [requests addObject:[request copy]];
+    }];
     
-    syncWithSemaphore(^(dispatch_semaphore_t semaphore) {
-        [self.smDataStore readObjectWithId:objStringId inSchema:schemaName onSuccess:^(NSDictionary *theObject, NSString *schema) {
-            objectFields = [self sm_responseSerializationForDictionary:theObject schemaEntityDescription:objEntity managedObjectContext:context];
-            success = YES;
-            syncReturn(semaphore);
-        } onFailure:^(NSError *theError, NSString *theObjectId, NSString *schema) {
-            DLog(@"Could not read the object with objectId %@ and error userInfo %@", theObjectId, [theError userInfo]);
-            success = NO;
-            if (nil != error) {
-                // TO DO provide sm specific error
-                *error = [[NSError alloc] initWithDomain:[theError domain] code:[theError code] userInfo:[theError userInfo]];
+    NSError *firstError = synchronousRequests(requests, SM_MAX_CONCURRENT_FETCH_REQUESTS, NULL);
+    if (firstError != nil) {
+        *error = (__bridge id)(__bridge_retained CFTypeRef)firstError;
+        return nil;
+    }
+    
+    NSString *primaryKeyField = [entity sm_primaryKeyField];
+    NSMutableSet *primaryKeys = [NSMutableSet set];
+    NSMutableArray *rows = [NSMutableArray array];
+    for (NSArray *results in resultsByQuery) {
+        for (NSDictionary *row in results) {
+            id primaryKey = [row objectForKey:primaryKeyField];
+            if (primaryKey != nil) {
+                if ([primaryKeys containsObject:primaryKey]) {
+                    continue;
+                }
+                [primaryKeys addObject:primaryKey];
             }
-            syncReturn(semaphore);
+            [rows addObject:row];
+        }
+    }
+    return rows;
+}
+
+/*
+ Sorts merged rows by the fetch request's sort descriptors, translated to field names, then applies its offset and limit.
+ */
+- (NSArray *)rows:(NSArray *)rows sortedAndLimitedForFetchRequest:(NSFetchRequest *)fetchRequest {
+    if (rows == nil) {
+        return nil;
+    }
+    
+    NSEntityDescription *entity = fetchRequest.entity;
+    if ([fetchRequest.sortDescriptors count] > 0) {
+        NSArray *rowSortDescriptors = [fetchRequest.sortDescriptors map:^id(id sortDescriptor) {
+            NSPropertyDescription *property = [[entity propertiesByName] objectForKey:[sortDescriptor key]];
+            NSString *field = property ? [entity sm_fieldNameForProperty:property] : [sortDescriptor key];
+            return [NSSortDescriptor sortDescriptorWithKey:field ascending:[sortDescriptor ascending] selector:[sortDescriptor selector]];
         }];
+        rows = [rows sortedArrayUsingDescriptors:rowSortDescriptors];
+    }
+    
+    return arrayWithOffsetAndLimit(rows, fetchRequest.fetchOffset, fetchRequest.fetchLimit);
+}
+
+/*
+ The fields merged rows must include to be deduplicated and sorted: the primary key and any sort fields.
+ */
+- (NSArray *)fieldsToMergeRowsForFetchRequest:(NSFetchRequest *)fetchRequest {
+    NSEntityDescription *entity = fetchRequest.entity;
+    NSMutableArray *fields = [NSMutableArray arrayWithObject:[entity sm_primaryKeyField]];
+    for (NSSortDescriptor *sortDescriptor in fetchRequest.sortDescriptors) {
+        NSPropertyDescription *property = [[entity propertiesByName] objectForKey:[sortDescriptor key]];
+        [fields addObject:property ? [entity sm_fieldNameForProperty:property] : [sortDescriptor key]];
+    }
+    return fields;
+}
+
+/*
+ Downloads the results of query pageSize rows at a time, from index and stopping after limit rows if limit isn't 0, or at the first short page, passing each page's rows to block.  If fields isn't nil, only those fields are returned.  Returns NO, and sets error, if a page fails.
+ */
+- (BOOL)enumeratePagesOfQuery:(SMQuery *)query fromIndex:(NSUInteger)index limit:(NSUInteger)limit pageSize:(NSUInteger)pageSize fields:(NSArray *)fields error:(NSError *__autoreleasing *)error usingBlock:(void (^)(NSArray *rows))block {
+    NSUInteger remaining = limit ? limit : NSUIntegerMax;
+    
+    while (remaining > 0) {
+        NSUInteger rangeSize = MIN(pageSize, remaining);
+        SMRequestOptions *options = [self requestOptionsWithHeaders:nil];
+        if (fields) {
+            [options restrictReturnedFieldsTo:fields];
+        }
+        __block NSArray *rows = nil;
+        synchronousQuery(self.smDataStore, rangeOfQuery(query, index, index + rangeSize - 1), options, ^(NSArray *results) {
+            rows = results;
+        }, ^(NSError *theError) {
+            *error = (__bridge id)(__bridge_retained CFTypeRef)theError;
+        });
+        
+        if (rows == nil) {
+            return NO;
+        }
+        
+        @autoreleasepool {
+            block(rows);
+        }
+        
+        if ([rows count] < rangeSize) {
+            break;
+        }
+        index += rangeSize;
+        remaining -= rangeSize;
+    }
+    
+    return YES;
+}
+
+/*
+ Downloads the results of query fetchPageSize rows at a time, caching each page and keeping only the object ids, so that no single response holds the whole result.  Stops at the fetch limit, or at the first short page.
+ 
+ This only bounds the size of each response.  Every row still goes into the row cache, which holds at most SM_MAX_CACHED_ROWS of them, so the rows of a larger fetch are evicted and read again when faulted, and the ids of every object are returned at once, as Core Data expects.  Batched fetches are the way to keep a large result out of memory.
+ */
+- (NSArray *)fetchObjectIDsInPages:(NSFetchRequest *)fetchRequest query:(SMQuery *)query error:(NSError *__autoreleasing *)error {
+    NSMutableArray *objectIDs = [NSMutableArray array];
+    BOOL fetched = [self enumeratePagesOfQuery:query fromIndex:fetchRequest.fetchOffset limit:fetchRequest.fetchLimit pageSize:self.fetchPageSize fields:nil error:error usingBlock:^(NSArray *rows) {
+        for (NSDictionary *row in rows) {
+            [objectIDs addObject:[self cacheInsert:row forEntity:fetchRequest.entity]];
+        }
+    }];
+    return fetched ? objectIDs : nil;
+}
+
+/*
+ Batched fetches only download the primary keys of the matching objects, SM_MAX_IDS_PER_RANGE (or fetchPageSize) at a time, and return them as faults.  The objects are split into pages of fetchBatchSize, each remembered as the original query limited to the page's Range.  The first time an object of a page is faulted, rowForObjectID:error: loads the whole page with one request and caches its rows.
+ 
+ The pages still to be loaded are kept for the SM_MAX_BATCHED_FETCHES most recent batched fetches.  Making the same fetch again replaces its pages, and the pages of older fetches are dropped, leaving their objects to be read one at a time when faulted.
+ 
+ When the predicate needs more than one query, the merged results can't be addressed by Range, so each page is instead loaded with an isIn: query on its primary keys.
+ 
+ relationshipKeyPathsForPrefetching is not applied to batched fetches, since their rows are not downloaded up front.
+ */
+- (id)fetchObjectsInBatches:(NSFetchRequest *)fetchRequest queries:(NSArray *)queries withContext:(NSManagedObjectContext *)context error:(NSError *__autoreleasing *)error {
+    NSEntityDescription *entity = fetchRequest.entity;
+    NSString *primaryKeyField = [entity sm_primaryKeyField];
+    SMQuery *query = [queries count] == 1 ? [queries lastObject] : nil;
+    
+    __block NSArray *primaryKeys = nil;
+    if (query == nil) {
+        primaryKeys = [self rows:[self rowsForQueries:queries entity:entity fields:[self fieldsToMergeRowsForFetchRequest:fetchRequest] error:error] sortedAndLimitedForFetchRequest:fetchRequest];
+    } else {
+        NSMutableArray *rows = [NSMutableArray array];
+        NSUInteger rangeSize = self.fetchPageSize > 0 ? self.fetchPageSize : SM_MAX_IDS_PER_RANGE;
+        if ([self enumeratePagesOfQuery:query fromIndex:fetchRequest.fetchOffset limit:fetchRequest.fetchLimit pageSize:rangeSize fields:[NSArray arrayWithObject:primaryKeyField] error:error usingBlock:^(NSArray *page) {
+            [rows addObjectsFromArray:page];
+        }]) {
+            primaryKeys = rows;
+        }
+    }
+    
+    if (primaryKeys == nil) {
+        return nil;
+    }
+    
+    NSArray *objectIDs = [primaryKeys map:^id(id item) {
+        id remoteID = [item objectForKey:primaryKeyField];
+        if (!remoteID) {
+            [NSException raise:SMExceptionIncompatibleObject format:@"No key for remote name"];
+        }
+        return [self newObjectIDForEntity:entity referenceObject:remoteID];
+    }];
+    
+    NSMutableDictionary *pages = [NSMutableDictionary dictionaryWithCapacity:[objectIDs count]];
+    NSUInteger batchSize = fetchRequest.fetchBatchSize;
+    for (NSUInteger start = 0; start < [objectIDs count]; start += batchSize) {
+        NSRange range = NSMakeRange(start, MIN(batchSize, [objectIDs count] - start));
+        NSArray *pageObjectIDs = [objectIDs subarrayWithRange:range];
+        
+        SMQuery *pageQuery = nil;
+        if (query == nil) {
+            pageQuery = [[SMQuery alloc] initWithEntity:entity];
+            [pageQuery where:primaryKeyField isIn:[[primaryKeys subarrayWithRange:range] map:^id(id item) {
+                return [item objectForKey:primaryKeyField];
+            }]];
+        } else {
+            pageQuery = rangeOfQuery(query, fetchRequest.fetchOffset + range.location, fetchRequest.fetchOffset + NSMaxRange(range) - 1);
+        }
+        
+        NSDictionary *page = [NSDictionary dictionaryWithObjectsAndKeys:pageQuery, @"query", pageObjectIDs, @"objectIDs", entity, @"entity", nil];
+        for (NSManagedObjectID *objectID in pageObjectIDs) {
+            [pages setObject:page forKey:objectID];
+        }
+    }
+    
+    NSString *key = [self keyForFetchRequest:fetchRequest queries:queries];
+    @synchronized(batchedFetches) {
+        NSUInteger supersededIndex = [batchedFetches indexOfObjectPassingTest:^BOOL(id batchedFetch, NSUInteger idx, BOOL *stop) {
+            return [[batchedFetch objectForKey:@"key"] isEqualToString:key];
+        }];
+        if (supersededIndex != NSNotFound) {
+            [batchedFetches removeObjectAtIndex:supersededIndex];
+        }
+        if ([pages count] > 0) {
+            [batchedFetches addObject:[NSDictionary dictionaryWithObjectsAndKeys:key, @"key", pages, @"pages", nil]];
+        }
+        if ([batchedFetches count] > SM_MAX_BATCHED_FETCHES) {
+            [batchedFetches removeObjectAtIndex:0];
+        }
+    }
+    
+    return [objectIDs map:^(id oid) {
+        return [context objectWithID:oid];
+    }];
+}
+
+/*
+ Downloads a page of a batched fetch and caches its rows.  If the results have changed since the primary keys were fetched, objects missing from the page are simply read one at a time when faulted.
+ */
+- (void)loadPage:(NSDictionary *)page {
+    @synchronized(batchedFetches) {
+        for (NSDictionary *batchedFetch in [batchedFetches copy]) {
+            NSMutableDictionary *pages = [batchedFetch objectForKey:@"pages"];
+            for (NSManagedObjectID *objectID in [page objectForKey:@"objectIDs"]) {
+                if ([pages objectForKey:objectID] == page) {
+                    [pages removeObjectForKey:objectID];
+                }
+            }
+            if ([pages count] == 0) {
+                [batchedFetches removeObjectIdenticalTo:batchedFetch];
+            }
+        }
+    }
+    
+    __block NSArray *rows = nil;
+    synchronousQuery(self.smDataStore, [page objectForKey:@"query"], [self requestOptionsWithHeaders:nil], ^(NSArray *results) {
+        rows = results;
+    }, ^(NSError *theError) {
+        DLog(@"loading a page of a batched fetch failed with error userInfo %@", [theError userInfo]);
     });
+    for (NSDictionary *row in rows) {
+        [self cacheInsert:row forEntity:[page objectForKey:@"entity"]];
+    }
+}
+
+/*
+ Honors relationshipKeyPathsForPrefetching by loading related objects into the row cache ahead of time.  The related ids are read from the cached rows of objectIDs, and those without a cached row which can fulfill a fault are loaded with one isIn: query per destination schema (split every SM_MAX_IDS_PER_PREFETCH_QUERY ids), rather than one read per fault.  Nested key paths such as interests.person are then prefetched from the related objects in turn.
+ 
+ Prefetching is only an optimization, so a failed query is logged and the objects are left to fault in normally.
+ */
+- (void)prefetchRelationshipKeyPaths:(NSArray *)keyPaths forObjectIDs:(NSArray *)objectIDs ofEntity:(NSEntityDescription *)entity {
+    DLog(@"prefetching %@ for %d %@ objects", keyPaths, [objectIDs count], [entity name]);
     
-    if (!success) {
+    // split each key path into its first relationship and the rest
+    NSMutableDictionary *subKeyPathsByRelationship = [NSMutableDictionary dictionary];
+    for (NSString *keyPath in keyPaths) {
+        NSRange separator = [keyPath rangeOfString:@"."];
+        NSString *relationshipName = separator.location == NSNotFound ? keyPath : [keyPath substringToIndex:separator.location];
+        if ([[entity relationshipsByName] objectForKey:relationshipName] == nil) {
+            continue;
+        }
+        NSMutableArray *subKeyPaths = [subKeyPathsByRelationship objectForKey:relationshipName];
+        if (subKeyPaths == nil) {
+            subKeyPaths = [NSMutableArray array];
+            [subKeyPathsByRelationship setObject:subKeyPaths forKey:relationshipName];
+        }
+        if (separator.location != NSNotFound) {
+            [subKeyPaths addObject:[keyPath substringFromIndex:separator.location + 1]];
+        }
+    }
+    
+    // collect the related object ids of each relationship, and the uncached ones of each destination entity
+    NSMutableDictionary *relatedObjectIDsByRelationship = [NSMutableDictionary dictionary];
+    NSMutableDictionary *uncachedIdsByEntityName = [NSMutableDictionary dictionary];
+    [subKeyPathsByRelationship enumerateKeysAndObjectsUsingBlock:^(id relationshipName, id subKeyPaths, BOOL *stop) {
+        NSEntityDescription *destinationEntity = [[[entity relationshipsByName] objectForKey:relationshipName] destinationEntity];
+        NSMutableSet *relatedIds = [NSMutableSet set];
+        for (NSManagedObjectID *objectID in objectIDs) {
+            id relationshipContents = [[[self cachedRowForObjectID:objectID] objectForKey:SM_CacheValuesKey] objectForKey:relationshipName];
+            if ([relationshipContents isKindOfClass:[NSArray class]]) {
+                [relatedIds addObjectsFromArray:relationshipContents];
+            } else if ([relationshipContents isKindOfClass:[NSString class]]) {
+                [relatedIds addObject:relationshipContents];
+            }
+        }
+        
+        NSMutableSet *uncachedIds = [uncachedIdsByEntityName objectForKey:[destinationEntity name]];
+        if (uncachedIds == nil) {
+            uncachedIds = [NSMutableSet set];
+            [uncachedIdsByEntityName setObject:uncachedIds forKey:[destinationEntity name]];
+        }
+        NSMutableArray *relatedObjectIDs = [NSMutableArray arrayWithCapacity:[relatedIds count]];
+        for (NSString *relatedId in relatedIds) {
+            NSManagedObjectID *relatedObjectID = [self newObjectIDForEntity:destinationEntity referenceObject:relatedId];
+            if (![self cacheHasRowForFault:relatedObjectID]) {
+                [uncachedIds addObject:relatedId];
+            }
+            [relatedObjectIDs addObject:relatedObjectID];
+        }
+        [relatedObjectIDsByRelationship setObject:relatedObjectIDs forKey:relationshipName];
+    }];
+    
+    // load the uncached objects, one query per destination schema
+    [uncachedIdsByEntityName enumerateKeysAndObjectsUsingBlock:^(id entityName, id uncachedIds, BOOL *stop) {
+        NSEntityDescription *destinationEntity = [[[entity managedObjectModel] entitiesByName] objectForKey:entityName];
+        NSArray *allIds = [uncachedIds allObjects];
+        for (NSUInteger start = 0; start < [allIds count]; start += SM_MAX_IDS_PER_PREFETCH_QUERY) {
+            NSArray *ids = [allIds subarrayWithRange:NSMakeRange(start, MIN((NSUInteger)SM_MAX_IDS_PER_PREFETCH_QUERY, [allIds count] - start))];
+            SMQuery *query = [[SMQuery alloc] initWithEntity:destinationEntity];
+            [query where:[destinationEntity sm_primaryKeyField] isIn:ids];
+            
+            __block NSArray *rows = nil;
+            synchronousQuery(self.smDataStore, query, [self requestOptionsWithHeaders:nil], ^(NSArray *results) {
+                rows = results;
+            }, ^(NSError *theError) {
+                DLog(@"prefetching %@ objects failed with error userInfo %@", entityName, [theError userInfo]);
+            });
+            for (NSDictionary *row in rows) {
+                [self cacheInsert:row forEntity:destinationEntity];
+            }
+        }
+    }];
+    
+    // continue down nested key paths
+    [subKeyPathsByRelationship enumerateKeysAndObjectsUsingBlock:^(id relationshipName, id subKeyPaths, BOOL *stop) {
+        if ([subKeyPaths count] > 0) {
+            NSEntityDescription *destinationEntity = [[[entity relationshipsByName] objectForKey:relationshipName] destinationEntity];
+            [self prefetchRelationshipKeyPaths:subKeyPaths forObjectIDs:[relatedObjectIDsByRelationship objectForKey:relationshipName] ofEntity:destinationEntity];
+        }
+    }];
+}
+
+// Returns NSArray<NSManagedObjectID>
+
+- (id)fetchObjectIDs:(NSFetchRequest *)fetchRequest withContext:(NSManagedObjectContext *)context error:(NSError *__autoreleasing *)error {
+    DLog();
+    NSArray *objects = [self fetchObjects:fetchRequest withContext:context error:error];
+    return [objects map:^(id item) {
+        return [item objectID];
+    }];
+}
+
+/*
+ A copy of fetchRequest returning every matching managed object, for dictionary and count fetches whose predicate must be evaluated against the objects on the device.
+ */
+- (NSFetchRequest *)objectFetchRequestForFetchRequest:(NSFetchRequest *)fetchRequest {
+    NSFetchRequest *objectFetchRequest = [fetchRequest copy];
+    [objectFetchRequest setResultType:NSManagedObjectResultType];
+    [objectFetchRequest setPropertiesToFetch:nil];
+    [objectFetchRequest setReturnsDistinctResults:NO];
+    [objectFetchRequest setFetchOffset:0];
+    [objectFetchRequest setFetchLimit:0];
+    return objectFetchRequest;
+}
+
+// Returns NSArray<NSDictionary>
+
+/*
+ Dictionary fetches ask StackMob for only the fields of propertiesToFetch, or every attribute if it is nil, and return the rows as plain dictionaries keyed by property name.  No managed objects are created and the partial rows are not cached, unless the predicate has a residual part StackMob can't evaluate, in which case the full objects are fetched and filtered first.  To-one relationships are returned as object IDs; expressions are not supported.
+ */
+- (id)fetchDictionaries:(NSFetchRequest *)fetchRequest withContext:(NSManagedObjectContext *)context error:(NSError *__autoreleasing *)error {
+    DLog();
+    NSEntityDescription *entity = fetchRequest.entity;
+    NSMutableArray *properties = [NSMutableArray array];
+    if (fetchRequest.propertiesToFetch) {
+        for (id property in fetchRequest.propertiesToFetch) {
+            NSPropertyDescription *propertyDescription = [property isKindOfClass:[NSString class]] ? [[entity propertiesByName] objectForKey:property] : property;
+            BOOL isToOneRelationship = [propertyDescription isKindOfClass:[NSRelationshipDescription class]] && ![(NSRelationshipDescription *)propertyDescription isToMany];
+            if (![propertyDescription isKindOfClass:[NSAttributeDescription class]] && !isToOneRelationship) {
+                NSDictionary *userInfo = [NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"Unsupported property to fetch: %@", property] forKey:@"reason"];
+                *error = [[NSError alloc] initWithDomain:SMErrorDomain code:SMErrorInvalidArguments userInfo:userInfo];
+                return nil;
+            }
+            [properties addObject:propertyDescription];
+        }
+    } else {
+        [properties addObjectsFromArray:[[entity attributesByName] allValues]];
+    }
+    
+    NSPredicate *residualPredicate = nil;
+    NSArray *queries = [SMIncrementalStore queriesForFetchRequest:fetchRequest residualPredicate:&residualPredicate error:error];
+    if (queries == nil) {
+        return nil;
+    }
+    
+    if (residualPredicate != nil) {
+        NSArray *objects = [self fetchObjects:[self objectFetchRequestForFetchRequest:fetchRequest] withContext:context error:error];
+        if (objects == nil) {
+            return nil;
+        }
+        NSMutableArray *rows = [NSMutableArray arrayWithCapacity:[objects count]];
+        for (NSManagedObject *object in objects) {
+            // The row may have been evicted from the cache since it was fetched, in which case it is read again.
+            NSDictionary *row = [self rowForObjectID:[object objectID] error:error];
+            if (row == nil) {
+                return nil;
+            }
+            [rows addObject:[row objectForKey:SM_CacheValuesKey]];
+        }
+        NSArray *dictionaries = [self dictionariesWithProperties:properties fromRows:rows forFetchRequest:fetchRequest];
+        return arrayWithOffsetAndLimit(dictionaries, fetchRequest.fetchOffset, fetchRequest.fetchLimit);
+    }
+    
+    NSMutableArray *fields = [NSMutableArray arrayWithArray:[properties map:^id(id property) {
+        return [entity sm_fieldNameForProperty:property];
+    }]];
+    if ([queries count] != 1) {
+        [fields addObjectsFromArray:[self fieldsToMergeRowsForFetchRequest:fetchRequest]];
+    }
+    
+    __block NSArray *rows = nil;
+    if ([queries count] != 1) {
+        rows = [self rows:[self rowsForQueries:queries entity:entity fields:fields error:error] sortedAndLimitedForFetchRequest:fetchRequest];
+    } else {
+        SMRequestOptions *options = [self requestOptionsWithHeaders:nil];
+        [options restrictReturnedFieldsTo:fields];
+        syncWithSemaphore(^(dispatch_semaphore_t semaphore) {
+            [self.smDataStore performQuery:[queries lastObject] options:options onSuccess:^(NSArray *results) {
+                rows = results;
+                syncReturn(semaphore);
+            } onFailure:^(NSError *theError) {
+                *error = (__bridge id)(__bridge_retained CFTypeRef)theError;
+                syncReturn(semaphore);
+            }];
+        });
+    }
+    
+    if (rows == nil) {
         return nil;
     }
+    
+    return [self dictionariesWithProperties:properties fromRows:rows forFetchRequest:fetchRequest];
+}
 
-    NSIncrementalStoreNode *node = [[NSIncrementalStoreNode alloc] initWithObjectID:objectID withValues:objectFields version:1];
+/*
+ Turns rows into dictionaries of the given properties, keyed by property name, dropping duplicates if the fetch request asks for distinct results.
+ */
+- (NSArray *)dictionariesWithProperties:(NSArray *)properties fromRows:(NSArray *)rows forFetchRequest:(NSFetchRequest *)fetchRequest {
+    NSEntityDescription *entity = fetchRequest.entity;
+    NSMutableArray *dictionaries = [NSMutableArray arrayWithCapacity:[rows count]];
+    NSMutableSet *distinctDictionaries = fetchRequest.returnsDistinctResults ? [NSMutableSet set] : nil;
+    for (NSDictionary *row in rows) {
+        NSMutableDictionary *dictionary = [NSMutableDictionary dictionaryWithCapacity:[properties count]];
+        for (NSPropertyDescription *property in properties) {
+            id value = [row objectForKey:[entity sm_fieldNameForProperty:property]];
+            if (value == nil || value == [NSNull null]) {
+                continue;
+            }
+            if ([property isKindOfClass:[NSRelationshipDescription class]]) {
+                value = [self newObjectIDForEntity:[(NSRelationshipDescription *)property destinationEntity] referenceObject:value];
+            }
+            [dictionary setObject:value forKey:[property name]];
+        }
+        if (distinctDictionaries) {
+            if ([distinctDictionaries containsObject:dictionary]) {
+                continue;
+            }
+            [distinctDictionaries addObject:dictionary];
+        }
+        [dictionaries addObject:dictionary];
+    }
+    return dictionaries;
+}
+
+// Returns NSArray<NSNumber>, holding the single count
+
+/*
+ Counts with performCount:, which asks for a single object and reads the total from the Content-Range header, rather than downloading every match.  fetchOffset and fetchLimit are then applied to the total, since they don't change which objects match.
+ 
+ Predicates needing more than one query may match an object more than once, so their counts can't be added up.  Instead only the primary keys of the matches are downloaded and counted once each.  Predicates with a residual part StackMob can't evaluate are counted by fetching and filtering the objects.
+ */
+- (id)fetchCount:(NSFetchRequest *)fetchRequest withContext:(NSManagedObjectContext *)context error:(NSError *__autoreleasing *)error {
+    DLog();
+    NSPredicate *residualPredicate = nil;
+    NSArray *queries = [SMIncrementalStore queriesForEntity:fetchRequest.entity predicate:fetchRequest.predicate residualPredicate:&residualPredicate error:error];
+    
+    if (queries == nil) {
+        return nil;
+    }
+    
+    __block NSNumber *count = nil;
+    if (residualPredicate != nil) {
+        NSArray *objects = [self fetchObjects:[self objectFetchRequestForFetchRequest:fetchRequest] withContext:context error:error];
+        count = objects ? [NSNumber numberWithUnsignedInteger:[objects count]] : nil;
+    } else if ([queries count] != 1) {
+        NSArray *rows = [self rowsForQueries:queries entity:fetchRequest.entity fields:[NSArray arrayWithObject:[fetchRequest.entity sm_primaryKeyField]] error:error];
+        count = rows ? [NSNumber numberWithUnsignedInteger:[rows count]] : nil;
+    } else {
+        syncWithSemaphore(^(dispatch_semaphore_t semaphore) {
+            [self.smDataStore performCount:[queries lastObject] options:[self requestOptionsWithHeaders:nil] onSuccess:^(NSNumber *theCount) {
+                count = theCount;
+                syncReturn(semaphore);
+            } onFailure:^(NSError *theError) {
+                *error = (__bridge id)(__bridge_retained CFTypeRef)theError;
+                syncReturn(semaphore);
+            }];
+        });
+    }
+    
+    if (count == nil) {
+        return nil;
+    }
+    
+    NSUInteger total = [count unsignedIntegerValue];
+    NSUInteger result = total > fetchRequest.fetchOffset ? total - fetchRequest.fetchOffset : 0;
+    if (fetchRequest.fetchLimit) {
+        result = MIN(result, fetchRequest.fetchLimit);
+    }
+    return [NSArray arrayWithObject:[NSNumber numberWithUnsignedInteger:result]];
+}
+
+/*
+ Returns an incremental store node encapsulating the persistent external values of the object with a given object ID.
+ Return Value
+   An incremental store node encapsulating the persistent external values of the object with object ID objectID, or nil if the corresponding object cannot be found.
+ 
+ Discussion
+ The returned node should include all attributes values and may include to-one relationship values as instances of NSManagedObjectID.
+ 
+ If an object with object ID objectID cannot be found, the method should return nil and—if error is not NULL—create and return an appropriate error object in error.
+ */
+
+// NOTE:
+// Basically, this resolves a fault into the actual materialized object.
+
+/*
+ * Returns an incremental store node encapsulating the persistent external values of the object with a given object ID.
+ The returned node should include all attributes values and may include to-one relationship values as instances of NSManagedObjectID.
+    
+ */
+- (NSIncrementalStoreNode *)newValuesForObjectWithID:(NSManagedObjectID *)objectID
+                                         withContext:(NSManagedObjectContext *)context 
+                                               error:(NSError *__autoreleasing *)error {
+    
+    DLog(@"new values for object with id %@", objectID);
+    NSDictionary *row = [self cachedRowForFaultOfObjectID:objectID];
+    if (row == nil) {
+        row = [self readRowForObjectID:objectID error:error];
+        if (row == nil) {
+            return nil;
+        }
+        // The row just read fulfills this fault, so the next one reads the object again.
+        [self cacheMarkFaulted:objectID];
+    }
+    
+    NSDictionary *objectFields = [self sm_responseSerializationForDictionary:[row objectForKey:SM_CacheValuesKey] schemaEntityDescription:[objectID entity] managedObjectContext:context];
+    uint64_t version = [[row objectForKey:SM_CacheVersionKey] unsignedLongLongValue];
+    
+    NSIncrementalStoreNode *node = [[NSIncrementalStoreNode alloc] initWithObjectID:objectID withValues:objectFields version:version];
     
     return node;
 }
@@ -438,34 +1418,13 @@ You should implement this method conservatively, and expect that unknown request
                         error:(NSError *__autoreleasing *)error {
     DLog(@"new value for relationship %@ for object with id %@", relationship, objectID);
     
-    __block NSManagedObject *theObj = [context objectWithID:objectID];
-    __block NSEntityDescription *objEntity = [theObj entity];
-    __block NSString *schemaName = [[objEntity name] lowercaseString];
-    __block NSString *objStringId = [self referenceObjectForObjectID:objectID];
-    __block BOOL success = NO;
-    __block NSDictionary *objDict;
-
-    syncWithSemaphore(^(dispatch_semaphore_t semaphore) {
-        [self.smDataStore readObjectWithId:objStringId inSchema:schemaName onSuccess:^(NSDictionary *theObject, NSString *schema) {
-            objDict = theObject;
-            success = YES;
-            syncReturn(semaphore);
-        } onFailure:^(NSError *theError, NSString *theObjectId, NSString *schema) {
-            DLog(@"Could not read the object with objectId %@ and error userInfo %@", theObjectId, [theError userInfo]);
-            success = NO;
-            if (nil != error) {
-                // TO DO provide sm specific error
-                *error = [[NSError alloc] initWithDomain:[theError domain] code:[theError code] userInfo:[theError userInfo]];
-            }
-            syncReturn(semaphore);
-        }];
-    });
-    
-    if (!success) {
+    // The parent's row holds the ids of its related objects, so this only needs a request when the parent is not cached.
+    NSDictionary *row = [self rowForObjectID:objectID error:error];
+    if (row == nil) {
         return nil;
     }
     
-    id relationshipContents = [objDict valueForKey:[relationship name]];
+    id relationshipContents = [[row objectForKey:SM_CacheValuesKey] valueForKey:[relationship name]];
     if (relationshipContents) {
         if ([relationship isToMany]) {
             NSAssert([relationshipContents isKindOfClass:[NSArray class]], @"Relationship contents should be an array for a to-many relationship");
@@ -485,32 +1444,67 @@ You should implement this method conservatively, and expect that unknown request
     } else {
         return [NSNull null];
     }
-        
-    // TO DO OFFLINE SUPPORT
-    /*
-    id theObject = [cache objectForKey:objectID];
-    if (!theObject) {
-        // add an error here if needed
-        return nil;
+}
+
+/*
+ Returns the cached row for objectID, first reading the object from StackMob and caching it if needed.  Returns nil, and sets error, if the read fails.
+ */
+- (NSDictionary *)rowForObjectID:(NSManagedObjectID *)objectID error:(NSError *__autoreleasing *)error {
+    NSDictionary *row = [self cachedRowForObjectID:objectID];
+    if (row != nil) {
+        return row;
     }
-    if ([relationship isToMany]) {
+    return [self readRowForObjectID:objectID error:error];
+}
 
-        NSArray *relationshipInstances = [theObject valueForKey:[relationship name]];
-        
-        return relationshipInstances != nil ? relationshipInstances : [NSArray array];
-        
-    } else {
-        // to-one relationship
-        id relationshipInstance = [theObject valueForKey:[relationship name]];
-        
-        if (relationshipInstance == nil) {
-            return [NSNull null];
-        } else {
-            return relationshipInstance;
+/*
+ Reads the row for objectID from StackMob, with the rest of its page if it was returned by a batched fetch, and caches it.  Returns nil, and sets error, if the read fails.
+ */
+- (NSDictionary *)readRowForObjectID:(NSManagedObjectID *)objectID error:(NSError *__autoreleasing *)error {
+    NSDictionary *row = nil;
+    
+    // objects returned by a batched fetch are loaded a page at a time
+    NSDictionary *page = nil;
+    @synchronized(batchedFetches) {
+        for (NSDictionary *batchedFetch in [batchedFetches reverseObjectEnumerator]) {
+            page = [[batchedFetch objectForKey:@"pages"] objectForKey:objectID];
+            if (page != nil) {
+                break;
+            }
         }
     }
-     */
-
+    if (page != nil) {
+        [self loadPage:page];
+        row = [self cachedRowForObjectID:objectID];
+        if (row != nil) {
+            return row;
+        }
+    }
+    
+    NSEntityDescription *objEntity = [objectID entity];
+    NSString *schemaName = [[objEntity name] lowercaseString];
+    NSString *objStringId = [self referenceObjectForObjectID:objectID];
+    __block NSDictionary *theRemoteObject = nil;
+    
+    syncWithSemaphore(^(dispatch_semaphore_t semaphore) {
+        [self.smDataStore readObjectWithId:objStringId inSchema:schemaName options:[self requestOptionsWithHeaders:nil] onSuccess:^(NSDictionary *theObject, NSString *schema) {
+            theRemoteObject = theObject;
+            syncReturn(semaphore);
+        } onFailure:^(NSError *theError, NSString *theObjectId, NSString *schema) {
+            DLog(@"Could not read the object with objectId %@ and error userInfo %@", theObjectId, [theError userInfo]);
+            if (nil != error) {
+                // TO DO provide sm specific error
+                *error = [[NSError alloc] initWithDomain:[theError domain] code:[theError code] userInfo:[theError userInfo]];
+            }
+            syncReturn(semaphore);
+        }];
+    });
+    
+    if (theRemoteObject == nil) {
+        return nil;
+    }
+    [self cacheInsert:theRemoteObject forEntity:objEntity];
+    return [self cachedRowForObjectID:objectID];
 }
 
 /*
@@ -545,88 +1539,133 @@ You should implement this method conservatively, and expect that unknown request
      
 #pragma mark - Object store
 /*
- To be used for offline support.  This method takes a dictionary object from a StackMob response and places it in a dictionary cache, where the key is the returned NSManagedObjectID.  All primary key and relationship fields have their string ID representations casted to instances of NSManagedObjectID so Core Data can reference the corresponding objects.
+ The row cache holds the most recent StackMob dictionary for each object we have downloaded, keyed by its NSManagedObjectID, along with a version number for Core Data's optimistic locking.  fetchObjects: and newValuesForObjectWithID: fill it, faults are fulfilled from it without another request, and saves purge the rows they change.
+ 
+ The cache is an NSCache holding at most SM_MAX_CACHED_ROWS rows, so rows are evicted once it is full, and an object whose row was evicted is simply read again when faulted.  Each downloaded row fulfills a single fault.  Core Data only asks for an object's values again once it has been refreshed, or turned back into a fault, and then the object is read afresh from StackMob, so refreshObject:mergeChanges: sees changes made on the server.  Relationship faults and prefetching may still use a row which has fulfilled a fault.
+ 
+ Rows saved behind, which StackMob doesn't have yet, are instead pinned: they are never evicted, and fulfill any number of faults, until they are purged or replaced by a row downloaded from StackMob.
+ 
+ Rows are read and written from network callbacks as well as from Core Data's thread, so all access is synchronized on the cache.
  */
-- (NSManagedObjectID *)cacheInsert:(NSDictionary *)values forEntity:(NSEntityDescription *)entityDescription inContext:(NSManagedObjectContext *)context {
-    DLog();
-    
-    // TO-DO: GET THE PRIMARY FIELD KEY VS REMOTE KEY
-    
-    NSString *remoteKey = [self remoteKeyForEntityName:entityDescription.name];
-    id remoteID = [values objectForKey:remoteKey];
-    
-    // Get an object ID from NSIncrementalStore
+- (NSManagedObjectID *)cacheInsert:(NSDictionary *)values forEntity:(NSEntityDescription *)entityDescription {
+    return [self cacheInsert:values forEntity:entityDescription pinned:NO];
+}
+
+- (NSManagedObjectID *)cacheInsert:(NSDictionary *)values forEntity:(NSEntityDescription *)entityDescription pinned:(BOOL)pinned {
+    id remoteID = [values objectForKey:[entityDescription sm_primaryKeyField]];
+    if (!remoteID) {
+        [NSException raise:SMExceptionIncompatibleObject format:@"No key for remote name"];
+    }
     NSManagedObjectID *objectID = [self newObjectIDForEntity:entityDescription referenceObject:remoteID];
     
-    // if the object exists in the cache already, remove it and insert the new version from the server
-    if ([cache objectForKey:objectID] != nil) {
-        [self cachePurge:objectID];
-    }
-    __block NSMutableDictionary *mutableValues = [NSMutableDictionary dictionary];;
-    [entityDescription.propertiesByName enumerateKeysAndObjectsUsingBlock:^(id propertyName, id property, BOOL *stop) {
-        if ([property isKindOfClass:[NSAttributeDescription class]]) {
-            NSAttributeDescription *attributeDescription = (NSAttributeDescription *)property;
-            if (attributeDescription.attributeType != NSUndefinedAttributeType) {
-                id value = [values valueForKey:(NSString *)propertyName];
-                [mutableValues setObject:value forKey:propertyName];
+    // StackMob timestamps every write with lastmoddate, which makes a natural version.  Otherwise bump the version of the row we are replacing.
+    uint64_t version = [[values objectForKey:@"lastmoddate"] unsignedLongLongValue];
+    @synchronized(cache) {
+        if (version == 0) {
+            NSDictionary *previousRow = [pinnedRows objectForKey:objectID];
+            if (previousRow == nil) {
+                previousRow = [cache objectForKey:objectID];
             }
+            version = [[previousRow objectForKey:SM_CacheVersionKey] unsignedLongLongValue] + 1;
         }
-        else if ([property isKindOfClass:[NSRelationshipDescription class]]) {
-            NSRelationshipDescription *relationship = (NSRelationshipDescription *)property;
-            
-            // get the relationship contents for the property
-            id relationshipContents = [values valueForKey:propertyName];
-            if (relationshipContents) {
-                if ([relationship isToMany]) {
-                    NSMutableArray *relationshipIds = [NSMutableArray array];
-                    [(NSSet *)relationshipContents enumerateObjectsUsingBlock:^(id obj, BOOL *stop) {
-                        
-                        // if obj is string (reference to id), cast to NSManagedObjectId
-                        if ([obj isKindOfClass:[NSString class]]) {
-                            NSEntityDescription *entityDescriptionForRelationship = [NSEntityDescription entityForName:[[relationship destinationEntity] name] inManagedObjectContext:context];
-                            NSManagedObjectID *relationshipObjectID = [self newObjectIDForEntity:entityDescriptionForRelationship referenceObject:obj];
-                            [relationshipIds addObject:relationshipObjectID];
-                        }
-                        // else create the NSMangedObjectId from the primary key field
-                        else {
-                            NSEntityDescription *entityDescriptionForRelationship = [NSEntityDescription entityForName:[[obj entity] name] inManagedObjectContext:context];
-                            NSManagedObjectID *relationshipObjectID = [self newObjectIDForEntity:entityDescriptionForRelationship referenceObject:[obj valueForKey:[obj sm_primaryKeyField]]];
-                            [relationshipIds addObject:relationshipObjectID];
-                        }
-                    }];
-                    [mutableValues setObject:relationshipIds forKey:propertyName];
-                } else {
-                    NSEntityDescription *entityDescriptionForRelationship = [NSEntityDescription entityForName:[[property destinationEntity] name] inManagedObjectContext:context];
-                    
-                    // if relationshipContents is string (reference to id), cast to NSManagedObjectId
-                    if ([relationshipContents isKindOfClass:[NSString class]]) {
-                        NSManagedObjectID *relationshipObjectID = [self newObjectIDForEntity:entityDescriptionForRelationship referenceObject:relationshipContents];
-                        [mutableValues setObject:relationshipObjectID forKey:propertyName];
-                    }
-                    // else create the NSMangedObjectId from the primary key field
-                    else {
-                        NSManagedObjectID *relationshipObjectID = [self newObjectIDForEntity:entityDescriptionForRelationship referenceObject:[relationshipContents objectForKey:[self remoteKeyForEntityName:propertyName]]];
-                        [mutableValues setObject:relationshipObjectID forKey:propertyName];
-                    }
-                }
-            }
-            
+        NSDictionary *row = [NSDictionary dictionaryWithObjectsAndKeys:values, SM_CacheValuesKey, [NSNumber numberWithUnsignedLongLong:version], SM_CacheVersionKey, nil];
+        if (pinned) {
+            [pinnedRows setObject:row forKey:objectID];
+            [cache removeObjectForKey:objectID];
+        } else {
+            [pinnedRows removeObjectForKey:objectID];
+            [cache setObject:row forKey:objectID];
         }
-    }];
-    
-    [cache setObject:mutableValues forKey:objectID];
+    }
     return objectID;
 }
 
+/*
+ Returns the cached row for objectID, a dictionary with the StackMob values under SM_CacheValuesKey and the version under SM_CacheVersionKey, or nil if it is not cached.
+ */
+- (NSDictionary *)cachedRowForObjectID:(NSManagedObjectID *)objectID {
+    @synchronized(cache) {
+        NSDictionary *row = [pinnedRows objectForKey:objectID];
+        return row ? row : [cache objectForKey:objectID];
+    }
+}
+
+/*
+ Returns whether objectID has a cached row which hasn't yet fulfilled a fault, or is pinned.
+ */
+- (BOOL)cacheHasRowForFault:(NSManagedObjectID *)objectID {
+    NSDictionary *row = [self cachedRowForObjectID:objectID];
+    return row != nil && ![[row objectForKey:SM_CacheFaultedKey] boolValue];
+}
+
+/*
+ Returns the cached row for objectID to fulfill a fault with, and marks it as having fulfilled one, or returns nil if there is no row which can.
+ */
+- (NSDictionary *)cachedRowForFaultOfObjectID:(NSManagedObjectID *)objectID {
+    @synchronized(cache) {
+        if (![self cacheHasRowForFault:objectID]) {
+            return nil;
+        }
+        NSDictionary *row = [self cachedRowForObjectID:objectID];
+        [self cacheMarkFaulted:objectID];
+        return row;
+    }
+}
+
+/*
+ Marks the cached row for objectID, unless it is pinned, as having fulfilled a fault, so the next fault reads the object again.
+ */
+- (void)cacheMarkFaulted:(NSManagedObjectID *)objectID {
+    @synchronized(cache) {
+        NSDictionary *row = [cache objectForKey:objectID];
+        if (row == nil || [pinnedRows objectForKey:objectID]) {
+            return;
+        }
+        NSMutableDictionary *faultedRow = [row mutableCopy];
+        [faultedRow setObject:[NSNumber numberWithBool:YES] forKey:SM_CacheFaultedKey];
+        [cache setObject:faultedRow forKey:objectID];
+    }
+}
+
 /*
  Removes an object from the cache.
  */
 - (void)cachePurge:(NSManagedObjectID *)objectID {
-    [cache removeObjectForKey:objectID];
+    @synchronized(cache) {
+        [pinnedRows removeObjectForKey:objectID];
+        [cache removeObjectForKey:objectID];
+    }
+}
+
+/*
+ Returns the row StackMob holds for an object once it is saved: its serialization, with to-one relationships as the related object's id rather than its nested serialization, as StackMob returns them.
+ */
+- (NSDictionary *)rowForSavedObject:(NSManagedObject *)object serialization:(NSDictionary *)serialization
+{
+    NSMutableDictionary *row = [serialization mutableCopy];
+    NSEntityDescription *entity = [object entity];
+    [[entity relationshipsByName] enumerateKeysAndObjectsUsingBlock:^(id relationshipName, id relationship, BOOL *stop) {
+        id relatedObject = [object valueForKey:relationshipName];
+        if (![relationship isToMany] && relatedObject) {
+            [row setObject:[relatedObject sm_objectId] forKey:[entity sm_fieldNameForProperty:relationship]];
+        }
+    }];
+    return row;
 }
 
-- (NSString *)remoteKeyForEntityName:(NSString *)entityName {
-    return [[entityName lowercaseString] stringByAppendingString:@"_id"];
+/*
+ Keeps a saved row in the offline store, so the first fetch after the next launch doesn't answer with the row as it was before the save.  Fields in StackMob's response to the save, such as lastmoddate, win over the serialized row.
+ */
+- (void)storeSavedRow:(NSDictionary *)row response:(NSDictionary *)response inSchema:(NSString *)schema primaryKeyField:(NSString *)primaryKeyField
+{
+    if (self.offlineStore == nil || row == nil) {
+        return;
+    }
+    NSMutableDictionary *savedRow = [row mutableCopy];
+    if ([response isKindOfClass:[NSDictionary class]]) {
+        [savedRow addEntriesFromDictionary:response];
+    }
+    [self.offlineStore setRow:savedRow inSchema:schema primaryKeyField:primaryKeyField];
 }
 
 /*
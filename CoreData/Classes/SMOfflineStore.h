@@ -0,0 +1,79 @@
+/*
+ * Copyright 2012 StackMob
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#import <Foundation/Foundation.h>
+
+/**
+ `SMOfflineStore` keeps the last known rows of each schema on disk, keyed by primary key, together with the primary keys each fetch returned in order.  <SMIncrementalStore> uses it to answer the first fetch of a launch from disk while the fetch is repeated against StackMob in the background.
+ 
+ Each schema is stored in its own file under <path>, read the first time the schema is used and rewritten in the background after it changes.  Only the 50 most recently stored fetches of each schema are kept, along with the rows they return.  All methods may be called from any thread.
+ */
+@interface SMOfflineStore : NSObject
+
+/**
+ The directory holding the store's files.
+ */
+@property (nonatomic, readonly, copy) NSString *path;
+
+/**
+ Initializes an offline store, creating its directory if needed.
+ 
+ @param path The directory to keep the store's files in.
+ */
+- (id)initWithPath:(NSString *)path;
+
+/**
+ Returns the rows last stored for a fetch, in order, or nil if the fetch has not been stored.  Rows which have since been removed are left out.
+ 
+ @param key Identifies the fetch.
+ @param schema The schema of the rows.
+ */
+- (NSArray *)rowsForKey:(NSString *)key inSchema:(NSString *)schema;
+
+/**
+ Stores the rows a fetch returned, replacing any earlier rows with the same primary keys and the fetch's earlier results.  The oldest fetch of the schema is forgotten once more than 50 are stored.
+ 
+ @param rows The rows, which must include the primary key field.
+ @param key Identifies the fetch.
+ @param schema The schema of the rows.
+ @param primaryKeyField The primary key field of the schema.
+ */
+- (void)setRows:(NSArray *)rows forKey:(NSString *)key inSchema:(NSString *)schema primaryKeyField:(NSString *)primaryKeyField;
+
+/**
+ Updates a row which was saved in the fetches which return it.  No stored fetch includes a row which wasn't stored before, so a new row instead forgets the schema's fetches.
+ 
+ @param row The row, which must include the primary key field.
+ @param schema The schema of the row.
+ @param primaryKeyField The primary key field of the schema.
+ */
+- (void)setRow:(NSDictionary *)row inSchema:(NSString *)schema primaryKeyField:(NSString *)primaryKeyField;
+
+/**
+ Removes a row, such as one which was deleted, so no fetch returns it.
+ 
+ @param primaryKey The primary key of the row.
+ @param schema The schema of the row.
+ */
+- (void)removeRowWithPrimaryKey:(id)primaryKey inSchema:(NSString *)schema;
+
+/**
+ Removes every row and fetch, in memory and on disk.
+ */
+- (void)removeAllRows;
+
+@end
@@ -0,0 +1,225 @@
+/*
+ * Copyright 2012 StackMob
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#import "SMOfflineStore.h"
+
+#define SM_OfflineRowsKey @"rows"
+#define SM_OfflineResultsKey @"results"
+#define SM_OfflineResultKeysKey @"resultKeys"
+#define SM_MAX_OFFLINE_RESULTS_PER_SCHEMA 50
+
+@interface SMOfflineStore ()
+
+@property (nonatomic, readwrite, copy) NSString *path;
+// Maps each schema which has been read to a dictionary of its rows by primary key and its fetch results by key.
+@property (nonatomic, strong) NSMutableDictionary *schemas;
+// The schemas with a write to disk scheduled.
+@property (nonatomic, strong) NSMutableSet *unsavedSchemas;
+@property (nonatomic, readwrite, assign) dispatch_queue_t queue;
+
+@end
+
+@implementation SMOfflineStore
+
+@synthesize path = _path;
+@synthesize schemas = _schemas;
+@synthesize unsavedSchemas = _unsavedSchemas;
+@synthesize queue = _queue;
+
+- (id)initWithPath:(NSString *)path
+{
+    self = [super init];
+    if (self) {
+        self.path = path;
+        self.schemas = [NSMutableDictionary dictionary];
+        self.unsavedSchemas = [NSMutableSet set];
+        self.queue = dispatch_queue_create("com.stackmob.offlinestore", NULL);
+        [[NSFileManager defaultManager] createDirectoryAtPath:path withIntermediateDirectories:YES attributes:nil error:nil];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    if (_queue) {
+        dispatch_release(_queue);
+    }
+}
+
+- (NSString *)pathForSchema:(NSString *)schema
+{
+    return [self.path stringByAppendingPathComponent:[schema stringByAppendingPathExtension:@"archive"]];
+}
+
+/*
+ Returns the contents of a schema, reading them from disk the first time.  Must be called on the queue.
+ */
+- (NSMutableDictionary *)contentsOfSchema:(NSString *)schema
+{
+    NSMutableDictionary *contents = [self.schemas objectForKey:schema];
+    if (contents == nil) {
+        NSData *data = [NSData dataWithContentsOfFile:[self pathForSchema:schema] options:NSDataReadingMappedIfSafe error:nil];
+        NSDictionary *archived = nil;
+        if (data) {
+            @try {
+                archived = [NSKeyedUnarchiver unarchiveObjectWithData:data];
+            }
+            @catch (NSException *exception) {
+                archived = nil;
+            }
+        }
+        contents = [NSMutableDictionary dictionaryWithCapacity:2];
+        [contents setObject:[NSMutableDictionary dictionaryWithDictionary:[archived objectForKey:SM_OfflineRowsKey]] forKey:SM_OfflineRowsKey];
+        [contents setObject:[NSMutableDictionary dictionaryWithDictionary:[archived objectForKey:SM_OfflineResultsKey]] forKey:SM_OfflineResultsKey];
+        NSArray *resultKeys = [archived objectForKey:SM_OfflineResultKeysKey];
+        [contents setObject:[NSMutableArray arrayWithArray:resultKeys ? resultKeys : [[contents objectForKey:SM_OfflineResultsKey] allKeys]] forKey:SM_OfflineResultKeysKey];
+        [self.schemas setObject:contents forKey:schema];
+    }
+    return contents;
+}
+
+/*
+ Forgets all but the SM_MAX_OFFLINE_RESULTS_PER_SCHEMA most recently stored fetches of a schema, then drops the rows no remaining fetch returns.  Must be called on the queue.
+ */
+- (void)pruneContents:(NSMutableDictionary *)contents
+{
+    NSMutableDictionary *results = [contents objectForKey:SM_OfflineResultsKey];
+    NSMutableArray *resultKeys = [contents objectForKey:SM_OfflineResultKeysKey];
+    if ([resultKeys count] > SM_MAX_OFFLINE_RESULTS_PER_SCHEMA) {
+        NSRange oldestKeys = NSMakeRange(0, [resultKeys count] - SM_MAX_OFFLINE_RESULTS_PER_SCHEMA);
+        [results removeObjectsForKeys:[resultKeys subarrayWithRange:oldestKeys]];
+        [resultKeys removeObjectsInRange:oldestKeys];
+    }
+    NSMutableSet *referencedPrimaryKeys = [NSMutableSet set];
+    for (NSArray *primaryKeys in [results objectEnumerator]) {
+        [referencedPrimaryKeys addObjectsFromArray:primaryKeys];
+    }
+    NSMutableDictionary *rowsByPrimaryKey = [contents objectForKey:SM_OfflineRowsKey];
+    NSMutableArray *unreferencedPrimaryKeys = [NSMutableArray arrayWithArray:[rowsByPrimaryKey allKeys]];
+    [unreferencedPrimaryKeys filterUsingPredicate:[NSPredicate predicateWithBlock:^BOOL(id primaryKey, NSDictionary *bindings) {
+        return ![referencedPrimaryKeys containsObject:primaryKey];
+    }]];
+    [rowsByPrimaryKey removeObjectsForKeys:unreferencedPrimaryKeys];
+}
+
+/*
+ Schedules a write of a schema to disk.  Changes made before the write runs are saved with it.  Must be called on the queue.
+ */
+- (void)saveSchema:(NSString *)schema
+{
+    if ([self.unsavedSchemas containsObject:schema]) {
+        return;
+    }
+    [self.unsavedSchemas addObject:schema];
+    dispatch_async(self.queue, ^{
+        [self.unsavedSchemas removeObject:schema];
+        NSDictionary *contents = [self.schemas objectForKey:schema];
+        if (contents) {
+            [[NSKeyedArchiver archivedDataWithRootObject:contents] writeToFile:[self pathForSchema:schema] atomically:YES];
+        }
+    });
+}
+
+- (NSArray *)rowsForKey:(NSString *)key inSchema:(NSString *)schema
+{
+    __block NSArray *rows = nil;
+    dispatch_sync(self.queue, ^{
+        NSDictionary *contents = [self contentsOfSchema:schema];
+        NSArray *primaryKeys = [[contents objectForKey:SM_OfflineResultsKey] objectForKey:key];
+        if (primaryKeys) {
+            NSDictionary *rowsByPrimaryKey = [contents objectForKey:SM_OfflineRowsKey];
+            NSMutableArray *storedRows = [NSMutableArray arrayWithCapacity:[primaryKeys count]];
+            for (id primaryKey in primaryKeys) {
+                NSDictionary *row = [rowsByPrimaryKey objectForKey:primaryKey];
+                if (row) {
+                    [storedRows addObject:row];
+                }
+            }
+            rows = storedRows;
+        }
+    });
+    return rows;
+}
+
+- (void)setRows:(NSArray *)rows forKey:(NSString *)key inSchema:(NSString *)schema primaryKeyField:(NSString *)primaryKeyField
+{
+    dispatch_sync(self.queue, ^{
+        NSMutableDictionary *contents = [self contentsOfSchema:schema];
+        NSMutableDictionary *rowsByPrimaryKey = [contents objectForKey:SM_OfflineRowsKey];
+        NSMutableArray *primaryKeys = [NSMutableArray arrayWithCapacity:[rows count]];
+        for (NSDictionary *row in rows) {
+            id primaryKey = [row objectForKey:primaryKeyField];
+            if (primaryKey) {
+                [rowsByPrimaryKey setObject:row forKey:primaryKey];
+                [primaryKeys addObject:primaryKey];
+            }
+        }
+        [[contents objectForKey:SM_OfflineResultsKey] setObject:primaryKeys forKey:key];
+        NSMutableArray *resultKeys = [contents objectForKey:SM_OfflineResultKeysKey];
+        [resultKeys removeObject:key];
+        [resultKeys addObject:key];
+        [self pruneContents:contents];
+        [self saveSchema:schema];
+    });
+}
+
+- (void)setRow:(NSDictionary *)row inSchema:(NSString *)schema primaryKeyField:(NSString *)primaryKeyField
+{
+    id primaryKey = [row objectForKey:primaryKeyField];
+    if (primaryKey == nil) {
+        return;
+    }
+    dispatch_sync(self.queue, ^{
+        NSMutableDictionary *contents = [self contentsOfSchema:schema];
+        NSMutableDictionary *rowsByPrimaryKey = [contents objectForKey:SM_OfflineRowsKey];
+        if ([rowsByPrimaryKey objectForKey:primaryKey] == nil) {
+            // The new row may belong in any of the stored fetches, and without them no row is needed.
+            [[contents objectForKey:SM_OfflineResultsKey] removeAllObjects];
+            [[contents objectForKey:SM_OfflineResultKeysKey] removeAllObjects];
+            [rowsByPrimaryKey removeAllObjects];
+        } else {
+            [rowsByPrimaryKey setObject:row forKey:primaryKey];
+        }
+        [self saveSchema:schema];
+    });
+}
+
+- (void)removeRowWithPrimaryKey:(id)primaryKey inSchema:(NSString *)schema
+{
+    dispatch_sync(self.queue, ^{
+        NSMutableDictionary *contents = [self contentsOfSchema:schema];
+        if ([[contents objectForKey:SM_OfflineRowsKey] objectForKey:primaryKey]) {
+            // rowsForKey:inSchema: skips primary keys without a row, so the results can keep them.
+            [[contents objectForKey:SM_OfflineRowsKey] removeObjectForKey:primaryKey];
+            [self saveSchema:schema];
+        }
+    });
+}
+
+- (void)removeAllRows
+{
+    dispatch_sync(self.queue, ^{
+        [self.schemas removeAllObjects];
+        [self.unsavedSchemas removeAllObjects];
+        NSFileManager *fileManager = [NSFileManager defaultManager];
+        for (NSString *file in [fileManager contentsOfDirectoryAtPath:self.path error:nil]) {
+            [fileManager removeItemAtPath:[self.path stringByAppendingPathComponent:file] error:nil];
+        }
+    });
+}
+
+@end
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2012 StackMob
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#import <Foundation/Foundation.h>
+
+@class SMDataStore;
+
+typedef void (^SMOutboxFailureBlock)(NSDictionary *entry, NSError *error);
+
+/**
+ `SMOutbox` is the durable queue of writes behind <SMIncrementalStore>'s write-behind saves.  Entries are written to disk before <appendEntries:error:> returns, and replayed against StackMob in order, in the background, by a single flusher.
+ 
+ Consecutive creates in the same schema with the same headers are sent with one `createObjects:inSchema:` request, up to `SM_MAX_OUTBOX_ENTRIES_PER_BATCH` at a time.  An entry is only removed once StackMob has answered it.  When a request fails for a reason which may pass, such as the network being unavailable, a timeout or a 5xx response, flushing stops and is retried after a delay which doubles with each consecutive failure, so later writes never overtake an earlier one.  Other failures are passed to the <failureBlock> and the entry is dropped.
+ 
+ Each entry belongs to the user logged in to the data store's session when it was appended, and is only sent while that user is logged in.  Entries of a user who logged out are kept, and sent the next time the outbox is flushed with that user logged in again.
+ */
+@interface SMOutbox : NSObject
+
+/**
+ The file the outbox is kept in.
+ */
+@property (nonatomic, readonly, copy) NSString *path;
+
+/**
+ The data store entries are replayed through.  If nil, the outbox is never flushed.
+ */
+@property (nonatomic, readonly, strong) SMDataStore *dataStore;
+
+/**
+ Called, on the flusher's queue, for each entry StackMob rejected for good.
+ */
+@property (nonatomic, copy) SMOutboxFailureBlock failureBlock;
+
+/**
+ The number of entries not yet flushed.
+ */
+@property (readonly) NSUInteger count;
+
+/**
+ Initializes an outbox with any entries left in its file, and starts flushing them.
+ 
+ @param path The file to keep the outbox in.
+ @param dataStore The data store to replay entries through.
+ */
+- (id)initWithPath:(NSString *)path dataStore:(SMDataStore *)dataStore;
+
+/**
+ Returns an entry which creates an object.
+ 
+ @param object The serialized object.
+ @param schema The schema of the object.
+ @param headers Request headers, such as `X-StackMob-Relations`, or nil.
+ */
++ (NSDictionary *)entryToCreateObject:(NSDictionary *)object inSchema:(NSString *)schema headers:(NSDictionary *)headers;
+
+/**
+ Returns an entry which updates an object.
+ 
+ @param objectId The primary key of the object.
+ @param object The serialized fields to update.
+ @param schema The schema of the object.
+ */
++ (NSDictionary *)entryToUpdateObjectWithId:(NSString *)objectId object:(NSDictionary *)object inSchema:(NSString *)schema;
+
+/**
+ Returns an entry which deletes an object.
+ 
+ @param objectId The primary key of the object.
+ @param schema The schema of the object.
+ */
++ (NSDictionary *)entryToDeleteObjectWithId:(NSString *)objectId inSchema:(NSString *)schema;
+
+/**
+ Adds entries to the end of the outbox, writes the outbox to disk and schedules a flush.
+ 
+ @param entries The entries, made by the class methods above.
+ @param error Set if the outbox could not be written.
+ @return `YES` if the entries were written.
+ */
+- (BOOL)appendEntries:(NSArray *)entries error:(NSError *__autoreleasing *)error;
+
+/**
+ Schedules a flush, unless one is already running or waiting to retry.
+ */
+- (void)flush;
+
+@end
@@ -0,0 +1,345 @@
+/*
+ * Copyright 2012 StackMob
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#import "SMOutbox.h"
+#import "StackMob.h"
+
+#define SM_MAX_OUTBOX_ENTRIES_PER_BATCH 100
+
+#define SM_OUTBOX_INITIAL_RETRY_DELAY 1.0
+#define SM_OUTBOX_MAX_RETRY_DELAY 300.0
+
+#define SM_OutboxOperationKey @"operation"
+#define SM_OutboxSchemaKey @"schema"
+#define SM_OutboxObjectIdKey @"objectId"
+#define SM_OutboxObjectKey @"object"
+#define SM_OutboxHeadersKey @"headers"
+#define SM_OutboxUserKey @"user"
+
+#define SM_OutboxCreate @"create"
+#define SM_OutboxUpdate @"update"
+#define SM_OutboxDelete @"delete"
+
+@interface SMOutbox ()
+
+@property (nonatomic, readwrite, copy) NSString *path;
+@property (nonatomic, readwrite, strong) SMDataStore *dataStore;
+@property (nonatomic, strong) NSMutableArray *entries;
+@property (nonatomic) NSUInteger consecutiveFailures;
+@property (nonatomic) BOOL retryScheduled;
+@property (nonatomic, readwrite, assign) dispatch_queue_t flushQueue;
+
+@end
+
+@implementation SMOutbox
+
+@synthesize path = _path;
+@synthesize dataStore = _dataStore;
+@synthesize failureBlock = _failureBlock;
+@synthesize entries = _entries;
+@synthesize consecutiveFailures = _consecutiveFailures;
+@synthesize retryScheduled = _retryScheduled;
+@synthesize flushQueue = _flushQueue;
+
+- (id)initWithPath:(NSString *)path dataStore:(SMDataStore *)dataStore
+{
+    self = [super init];
+    if (self) {
+        self.path = path;
+        self.dataStore = dataStore;
+        self.flushQueue = dispatch_queue_create("com.stackmob.outbox", NULL);
+        NSArray *savedEntries = nil;
+        NSData *data = [NSData dataWithContentsOfFile:path];
+        if (data) {
+            @try {
+                savedEntries = [NSKeyedUnarchiver unarchiveObjectWithData:data];
+            }
+            @catch (NSException *exception) {
+                savedEntries = nil;
+            }
+        }
+        self.entries = [NSMutableArray arrayWithArray:savedEntries];
+        if ([self.entries count] > 0) {
+            [self flush];
+        }
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    if (_flushQueue) {
+        dispatch_release(_flushQueue);
+    }
+}
+
++ (NSDictionary *)entryToCreateObject:(NSDictionary *)object inSchema:(NSString *)schema headers:(NSDictionary *)headers
+{
+    NSMutableDictionary *entry = [NSMutableDictionary dictionaryWithObjectsAndKeys:SM_OutboxCreate, SM_OutboxOperationKey, schema, SM_OutboxSchemaKey, object, SM_OutboxObjectKey, nil];
+    if ([headers count] > 0) {
+        [entry setObject:headers forKey:SM_OutboxHeadersKey];
+    }
+    return entry;
+}
+
++ (NSDictionary *)entryToUpdateObjectWithId:(NSString *)objectId object:(NSDictionary *)object inSchema:(NSString *)schema
+{
+    return [NSDictionary dictionaryWithObjectsAndKeys:SM_OutboxUpdate, SM_OutboxOperationKey, schema, SM_OutboxSchemaKey, objectId, SM_OutboxObjectIdKey, object, SM_OutboxObjectKey, nil];
+}
+
++ (NSDictionary *)entryToDeleteObjectWithId:(NSString *)objectId inSchema:(NSString *)schema
+{
+    return [NSDictionary dictionaryWithObjectsAndKeys:SM_OutboxDelete, SM_OutboxOperationKey, schema, SM_OutboxSchemaKey, objectId, SM_OutboxObjectIdKey, nil];
+}
+
+- (NSUInteger)count
+{
+    @synchronized(self.entries) {
+        return [self.entries count];
+    }
+}
+
+/*
+ Writes the entries to disk.  Must be called while synchronized on the entries.
+ */
+- (BOOL)saveEntries:(NSError *__autoreleasing *)error
+{
+    NSData *data = [NSKeyedArchiver archivedDataWithRootObject:self.entries];
+    return [data writeToFile:self.path options:NSDataWritingAtomic error:error];
+}
+
+/*
+ The logged in user, or nil when no one is logged in.
+ */
+- (NSString *)currentUser
+{
+    return self.dataStore.session.userIdentifier;
+}
+
+static BOOL isSameUser(NSString *user, NSString *otherUser)
+{
+    return user == otherUser || [user isEqualToString:otherUser];
+}
+
+- (BOOL)appendEntries:(NSArray *)entries error:(NSError *__autoreleasing *)error
+{
+    if ([entries count] == 0) {
+        return YES;
+    }
+    // Each entry remembers who made it, so it is never sent with another user's token.
+    NSString *user = [self currentUser];
+    entries = [entries map:^id(id entry) {
+        NSMutableDictionary *ownedEntry = [entry mutableCopy];
+        [ownedEntry setValue:user forKey:SM_OutboxUserKey];
+        return ownedEntry;
+    }];
+    @synchronized(self.entries) {
+        [self.entries addObjectsFromArray:entries];
+        if (![self saveEntries:error]) {
+            [self.entries removeObjectsInRange:NSMakeRange([self.entries count] - [entries count], [entries count])];
+            return NO;
+        }
+    }
+    [self flush];
+    return YES;
+}
+
+- (void)removeEntries:(NSArray *)entries
+{
+    @synchronized(self.entries) {
+        for (NSDictionary *entry in entries) {
+            [self.entries removeObjectIdenticalTo:entry];
+        }
+        NSError *error = nil;
+        if (![self saveEntries:&error]) {
+            // The entries stay on disk and are sent again after a relaunch; sendBatch: treats repeated creates and deletes as done, and updates repeat harmlessly.
+            DLog(@"Failed to write the outbox: %@", error);
+        }
+    }
+}
+
+- (void)flush
+{
+    if (self.dataStore == nil) {
+        return;
+    }
+    dispatch_async(self.flushQueue, ^{
+        if (!self.retryScheduled) {
+            [self flushEntries];
+        }
+    });
+}
+
+#pragma mark - Flushing
+
+/*
+ Returns the first of the current user's entries which can be sent with one request: a run of creates in the same schema with the same headers, or a single update or delete.  Other users' entries stay in the outbox until they log in again.
+ */
+- (NSArray *)nextBatch
+{
+    NSString *user = [self currentUser];
+    @synchronized(self.entries) {
+        NSIndexSet *indexes = [self.entries indexesOfObjectsPassingTest:^BOOL(id entry, NSUInteger idx, BOOL *stop) {
+            return isSameUser([entry objectForKey:SM_OutboxUserKey], user);
+        }];
+        NSArray *userEntries = [self.entries objectsAtIndexes:indexes];
+        if ([userEntries count] == 0) {
+            return nil;
+        }
+        NSDictionary *first = [userEntries objectAtIndex:0];
+        if (![[first objectForKey:SM_OutboxOperationKey] isEqualToString:SM_OutboxCreate]) {
+            return [NSArray arrayWithObject:first];
+        }
+        NSUInteger length = 1;
+        while (length < MIN([userEntries count], (NSUInteger)SM_MAX_OUTBOX_ENTRIES_PER_BATCH)) {
+            NSDictionary *entry = [userEntries objectAtIndex:length];
+            BOOL sameHeaders = [entry objectForKey:SM_OutboxHeadersKey] == [first objectForKey:SM_OutboxHeadersKey] || [[entry objectForKey:SM_OutboxHeadersKey] isEqual:[first objectForKey:SM_OutboxHeadersKey]];
+            if (![[entry objectForKey:SM_OutboxOperationKey] isEqualToString:SM_OutboxCreate] || ![[entry objectForKey:SM_OutboxSchemaKey] isEqualToString:[first objectForKey:SM_OutboxSchemaKey]] || !sameHeaders) {
+                break;
+            }
+            length++;
+        }
+        return [userEntries subarrayWithRange:NSMakeRange(0, length)];
+    }
+}
+
+/*
+ Failures which may pass if the request is sent again later.  Requests which never reached StackMob fail with no status code.
+ */
+static BOOL isTransientError(NSError *error)
+{
+    if ([[error domain] isEqualToString:NSURLErrorDomain]) {
+        return YES;
+    }
+    NSInteger code = [error code];
+    return code == 0 || code == SMErrorUnauthorized || code == SMErrorTimeout || code == SMErrorRefreshTokenInProgress || code >= SMErrorInternalServerError;
+}
+
+/*
+ Sends a batch and waits for StackMob's answer.  Returns the error of a transient failure, after which the batch should be sent again, or nil once the batch is done with; entries StackMob rejected for good are passed to the failureBlock.  A batch of creates which conflicts is sent again one create at a time, since only some of it may have been made before.
+ */
+- (NSError *)sendBatch:(NSArray *)batch
+{
+    __block NSError *transientError = nil;
+    __block BOOL sendSeparately = NO;
+    NSMutableArray *rejections = [NSMutableArray array];
+    NSDictionary *first = [batch objectAtIndex:0];
+    NSString *operation = [first objectForKey:SM_OutboxOperationKey];
+    NSString *schema = [first objectForKey:SM_OutboxSchemaKey];
+    SMRequestOptions *options = [SMRequestOptions optionsWithHeaders:[first objectForKey:SM_OutboxHeadersKey]];
+    // The flush queue waits on the request below, so its callbacks can't need the flush queue, or the main thread, to be free.
+    options.completionQueue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+    
+    void (^failed)(NSError *, NSArray *) = ^(NSError *theError, NSArray *entries) {
+        BOOL conflict = [operation isEqualToString:SM_OutboxCreate] && [theError code] == SMErrorConflict;
+        if (isTransientError(theError)) {
+            transientError = theError;
+        } else if (conflict && [entries count] > 1) {
+            // Some of the batch conflicts, but not necessarily all of it.
+            sendSeparately = YES;
+        } else if (!conflict) {
+            // A single create which conflicts was already made by an earlier flush whose answer was lost.
+            for (NSDictionary *entry in entries) {
+                [rejections addObject:[NSArray arrayWithObjects:entry, theError, nil]];
+            }
+        }
+    };
+    
+    syncWithSemaphore(^(dispatch_semaphore_t semaphore) {
+        if ([operation isEqualToString:SM_OutboxCreate] && [batch count] > 1) {
+            NSArray *objects = [batch map:^(id entry) {
+                return [entry objectForKey:SM_OutboxObjectKey];
+            }];
+            [self.dataStore createObjects:objects inSchema:schema options:options onSuccess:^(NSArray *succeeded, NSArray *theFailed, NSString *theSchema) {
+                NSError *rejection = [NSError errorWithDomain:SMErrorDomain code:SMErrorBatchSaveFailed userInfo:nil];
+                for (NSDictionary *failedObject in theFailed) {
+                    [rejections addObject:[NSArray arrayWithObjects:[SMOutbox entryToCreateObject:failedObject inSchema:schema headers:[first objectForKey:SM_OutboxHeadersKey]], rejection, nil]];
+                }
+                syncReturn(semaphore);
+            } onFailure:^(NSError *theError, NSArray *theObjects, NSString *theSchema) {
+                failed(theError, batch);
+                syncReturn(semaphore);
+            }];
+        } else if ([operation isEqualToString:SM_OutboxCreate]) {
+            [self.dataStore createObject:[first objectForKey:SM_OutboxObjectKey] inSchema:schema options:options onSuccess:^(NSDictionary *theObject, NSString *theSchema) {
+                syncReturn(semaphore);
+            } onFailure:^(NSError *theError, NSDictionary *theObject, NSString *theSchema) {
+                failed(theError, batch);
+                syncReturn(semaphore);
+            }];
+        } else if ([operation isEqualToString:SM_OutboxUpdate]) {
+            [self.dataStore updateObjectWithId:[first objectForKey:SM_OutboxObjectIdKey] inSchema:schema update:[first objectForKey:SM_OutboxObjectKey] options:options onSuccess:^(NSDictionary *theObject, NSString *theSchema) {
+                syncReturn(semaphore);
+            } onFailure:^(NSError *theError, NSDictionary *theObject, NSString *theSchema) {
+                failed(theError, batch);
+                syncReturn(semaphore);
+            }];
+        } else {
+            [self.dataStore deleteObjectId:[first objectForKey:SM_OutboxObjectIdKey] inSchema:schema options:options onSuccess:^(NSString *theObjectId, NSString *theSchema) {
+                syncReturn(semaphore);
+            } onFailure:^(NSError *theError, NSString *theObjectId, NSString *theSchema) {
+                // The object is already gone.
+                if ([theError code] != SMErrorNotFound) {
+                    failed(theError, batch);
+                }
+                syncReturn(semaphore);
+            }];
+        }
+    });
+    
+    if (sendSeparately) {
+        for (NSDictionary *entry in batch) {
+            NSError *error = [self sendBatch:[NSArray arrayWithObject:entry]];
+            if (error) {
+                return error;
+            }
+        }
+        return nil;
+    }
+    if (transientError == nil && self.failureBlock) {
+        for (NSArray *rejection in rejections) {
+            self.failureBlock([rejection objectAtIndex:0], [rejection objectAtIndex:1]);
+        }
+    }
+    return transientError;
+}
+
+/*
+ Sends the outbox one batch at a time until it is empty, or a batch fails transiently, in which case the flush is retried after a delay.  Runs on the flush queue.
+ */
+- (void)flushEntries
+{
+    NSArray *batch = nil;
+    while ((batch = [self nextBatch])) {
+        NSError *transientError = [self sendBatch:batch];
+        if (transientError) {
+            NSTimeInterval delay = MIN(SM_OUTBOX_INITIAL_RETRY_DELAY * pow(2, self.consecutiveFailures), SM_OUTBOX_MAX_RETRY_DELAY);
+            self.consecutiveFailures++;
+            self.retryScheduled = YES;
+            DLog(@"Flushing the outbox failed with %@, retrying in %f seconds", transientError, delay);
+            dispatch_after(dispatch_time(DISPATCH_TIME_NOW, delay * NSEC_PER_SEC), self.flushQueue, ^{
+                self.retryScheduled = NO;
+                [self flushEntries];
+            });
+            return;
+        }
+        self.consecutiveFailures = 0;
+        [self removeEntries:batch];
+    }
+}
+
+@end
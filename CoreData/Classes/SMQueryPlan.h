@@ -0,0 +1,53 @@
+/*
+ * Copyright 2012 StackMob
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#import <Foundation/Foundation.h>
+
+/**
+ `SMQueryPlan` holds the translation of a predicate into queries with the predicate's constants left as parameters, so that predicates differing only in their constants need only be translated once.  Used by <SMIncrementalStore(Query)>, which translates a template of the predicate whose constants are replaced by the objects returned by <parameterForConstantAtIndex:element:>.
+ */
+@interface SMQueryPlan : NSObject
+
+/**
+ Returns the placeholder for a constant of a template predicate.
+ 
+ @param index The position of the constant among the predicate's constants.
+ @param element The position of the value within the constant if it is an array, or `NSNotFound`.
+ 
+ @return A placeholder to use in place of the value when translating the template.
+ */
++ (id)parameterForConstantAtIndex:(NSUInteger)index element:(NSUInteger)element;
+
+/**
+ Initializes a plan from the translation of a template predicate.
+ 
+ @param schema The schema the queries are run against.
+ @param queries The queries the template predicate translated to.
+ @param residualPredicate The part of the template predicate StackMob can't evaluate, or nil.
+ */
+- (id)initWithSchema:(NSString *)schema queries:(NSArray *)queries residualPredicate:(NSPredicate *)residualPredicate;
+
+/**
+ Returns new queries, with the placeholders replaced by the given constants.
+ 
+ @param constants The constants of the predicate, in the order of their placeholders' indexes.
+ @param residualPredicate If not `NULL`, set to the residual predicate with the placeholders replaced by the given constants.
+ 
+ @return An array of `SMQuery`.
+ */
+- (NSArray *)queriesWithConstants:(NSArray *)constants residualPredicate:(NSPredicate *__autoreleasing *)residualPredicate;
+
+@end
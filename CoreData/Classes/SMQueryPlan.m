@@ -0,0 +1,182 @@
+/*
+ * Copyright 2012 StackMob
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#import "SMQueryPlan.h"
+#import "SMQuery.h"
+
+#define SM_PARAMETER_PREFIX @"\x1eSMParameter:"
+
+/*
+ A placeholder for a constant.  Its description is a token which survives being joined into a string, as isIn: does with its values.
+ */
+@interface SMQueryPlanParameter : NSObject
+
+@property (nonatomic) NSUInteger index;
+@property (nonatomic) NSUInteger element;
+
+@end
+
+@implementation SMQueryPlanParameter
+
+@synthesize index = _index;
+@synthesize element = _element;
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"%@%lu.%lu", SM_PARAMETER_PREFIX, (unsigned long)self.index, (unsigned long)self.element];
+}
+
+@end
+
+@interface SMQueryPlan ()
+
+@property (nonatomic, copy) NSString *schema;
+@property (nonatomic, strong) NSArray *conditionTemplates;
+@property (nonatomic, strong) NSArray *headerTemplates;
+@property (nonatomic, strong) NSPredicate *residualPredicate;
+
+@end
+
+@implementation SMQueryPlan
+
+@synthesize schema = _schema;
+@synthesize conditionTemplates = _conditionTemplates;
+@synthesize headerTemplates = _headerTemplates;
+@synthesize residualPredicate = _residualPredicate;
+
++ (id)parameterForConstantAtIndex:(NSUInteger)index element:(NSUInteger)element
+{
+    SMQueryPlanParameter *parameter = [[SMQueryPlanParameter alloc] init];
+    parameter.index = index;
+    parameter.element = element;
+    return parameter;
+}
+
+/*
+ Replaces the placeholders in the residual predicate by variables, named after the index of their constant, so binding is a single predicateWithSubstitutionVariables:.
+ */
+static NSPredicate *predicateWithVariablesForParameters(NSPredicate *predicate)
+{
+    if ([predicate isKindOfClass:[NSCompoundPredicate class]]) {
+        NSCompoundPredicate *compoundPredicate = (NSCompoundPredicate *)predicate;
+        NSMutableArray *subpredicates = [NSMutableArray arrayWithCapacity:[[compoundPredicate subpredicates] count]];
+        for (NSPredicate *subpredicate in [compoundPredicate subpredicates]) {
+            [subpredicates addObject:predicateWithVariablesForParameters(subpredicate)];
+        }
+        return [[NSCompoundPredicate alloc] initWithType:[compoundPredicate compoundPredicateType] subpredicates:subpredicates];
+    }
+    
+    if ([predicate isKindOfClass:[NSComparisonPredicate class]]) {
+        NSComparisonPredicate *comparisonPredicate = (NSComparisonPredicate *)predicate;
+        if (comparisonPredicate.rightExpression.expressionType != NSConstantValueExpressionType) {
+            return predicate;
+        }
+        id rhs = comparisonPredicate.rightExpression.constantValue;
+        id parameter = [rhs isKindOfClass:[NSArray class]] ? [rhs lastObject] : rhs;
+        if (![parameter isKindOfClass:[SMQueryPlanParameter class]]) {
+            return predicate;
+        }
+        NSExpression *variable = [NSExpression expressionForVariable:[NSString stringWithFormat:@"SM%lu", (unsigned long)[parameter index]]];
+        if (comparisonPredicate.predicateOperatorType == NSCustomSelectorPredicateOperatorType) {
+            return [NSComparisonPredicate predicateWithLeftExpression:comparisonPredicate.leftExpression rightExpression:variable customSelector:comparisonPredicate.customSelector];
+        }
+        return [NSComparisonPredicate predicateWithLeftExpression:comparisonPredicate.leftExpression
+                                                  rightExpression:variable
+                                                         modifier:comparisonPredicate.comparisonPredicateModifier
+                                                             type:comparisonPredicate.predicateOperatorType
+                                                          options:comparisonPredicate.options];
+    }
+    
+    return predicate;
+}
+
+- (id)initWithSchema:(NSString *)schema queries:(NSArray *)queries residualPredicate:(NSPredicate *)residualPredicate
+{
+    self = [super init];
+    if (self) {
+        _schema = [schema copy];
+        NSMutableArray *conditionTemplates = [NSMutableArray arrayWithCapacity:[queries count]];
+        NSMutableArray *headerTemplates = [NSMutableArray arrayWithCapacity:[queries count]];
+        for (SMQuery *query in queries) {
+            [conditionTemplates addObject:query.conditions];
+            [headerTemplates addObject:[query.requestHeaders copy]];
+        }
+        _conditionTemplates = conditionTemplates;
+        _headerTemplates = headerTemplates;
+        _residualPredicate = residualPredicate ? predicateWithVariablesForParameters(residualPredicate) : nil;
+    }
+    return self;
+}
+
+static id constantForParameterToken(NSString *token, NSArray *constants)
+{
+    NSArray *indexes = [[token substringFromIndex:[SM_PARAMETER_PREFIX length]] componentsSeparatedByString:@"."];
+    id constant = [constants objectAtIndex:[[indexes objectAtIndex:0] integerValue]];
+    NSUInteger element = (NSUInteger)[[indexes objectAtIndex:1] longLongValue];
+    return element == NSNotFound ? constant : [constant objectAtIndex:element];
+}
+
+static id bindValue(id value, NSArray *constants)
+{
+    if ([value isKindOfClass:[SMQueryPlanParameter class]]) {
+        return constantForParameterToken([value description], constants);
+    }
+    if ([value isKindOfClass:[NSArray class]]) {
+        NSMutableArray *boundValues = [NSMutableArray arrayWithCapacity:[value count]];
+        for (id element in value) {
+            [boundValues addObject:bindValue(element, constants)];
+        }
+        return boundValues;
+    }
+    if ([value isKindOfClass:[NSString class]] && [value rangeOfString:SM_PARAMETER_PREFIX].location != NSNotFound) {
+        // a list of values joined with commas, as built by isIn:
+        NSMutableArray *boundValues = [NSMutableArray array];
+        for (NSString *token in [value componentsSeparatedByString:@","]) {
+            [boundValues addObject:[token hasPrefix:SM_PARAMETER_PREFIX] ? constantForParameterToken(token, constants) : token];
+        }
+        return [boundValues componentsJoinedByString:@","];
+    }
+    return value;
+}
+
+- (NSArray *)queriesWithConstants:(NSArray *)constants residualPredicate:(NSPredicate *__autoreleasing *)residualPredicate
+{
+    NSMutableArray *queries = [NSMutableArray arrayWithCapacity:[self.conditionTemplates count]];
+    [self.conditionTemplates enumerateObjectsUsingBlock:^(id conditionTemplate, NSUInteger idx, BOOL *stop) {
+        SMQuery *query = [[SMQuery alloc] initWithSchema:self.schema];
+        for (NSArray *condition in conditionTemplate) {
+            [query addConditionForKey:[condition objectAtIndex:0] value:bindValue([condition objectAtIndex:1], constants)];
+        }
+        query.requestHeaders = [[self.headerTemplates objectAtIndex:idx] mutableCopy];
+        [queries addObject:query];
+    }];
+    
+    if (residualPredicate != NULL) {
+        if (self.residualPredicate == nil) {
+            *residualPredicate = nil;
+        } else {
+            NSMutableDictionary *variables = [NSMutableDictionary dictionaryWithCapacity:[constants count]];
+            [constants enumerateObjectsUsingBlock:^(id constant, NSUInteger idx, BOOL *stop) {
+                [variables setObject:constant forKey:[NSString stringWithFormat:@"SM%lu", (unsigned long)idx]];
+            }];
+            *residualPredicate = [self.residualPredicate predicateWithSubstitutionVariables:variables];
+        }
+    }
+    
+    return queries;
+}
+
+@end
@@ -68,6 +68,9 @@ describe(@"SMCoreDataStore", ^{
                     [[theValue([[[psc persistentStores] objectAtIndex:0] class]) should] equal:theValue([SMIncrementalStore class])];
                 });
             });
+            it(@"delivers its own callbacks on the main queue like any data store", ^{
+                [[theValue(coreDataStore.completionQueue == NULL) should] beYes];
+            });
 
         });
         describe(@"after initializing, can set merge policy", ^{
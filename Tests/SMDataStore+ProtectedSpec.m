@@ -17,6 +17,10 @@
 #import <Kiwi/Kiwi.h>
 #import "SMClient.h"
 #import "SMDataStore+Protected.h"
+#import "SMJSONRequestOperation.h"
+#import "SMOAuth2Client.h"
+#import "SMRequestOptions.h"
+#import "SMUserSession.h"
 
 SPEC_BEGIN(SMDataStore_CompletionBlocksSpec)
 __block SMDataStore *dataStore = nil;
@@ -50,6 +54,33 @@ describe(@"SMFullResponseSuccessBlockForSchema:withSuccessBlock:", ^{
     });
 });
 
+describe(@"SMFullResponseSuccessBlockForSchema:withBulkSuccessBlock:", ^{
+    it(@"returns a block which calls the success block with the succeeded and failed objects", ^{
+        NSArray *succeeded = [NSArray arrayWithObjects:@"1234", @"5678", nil];
+        NSArray *failed = [NSArray arrayWithObject:[NSDictionary dictionaryWithObject:@"9012" forKey:@"book_id"]];
+        NSDictionary *responseObject = [NSDictionary dictionaryWithObjectsAndKeys:
+                                        succeeded, @"succeeded",
+                                        failed, @"failed",
+                                        nil];
+        NSURL *url = [NSURL URLWithString:@"http://mob1.stackmob.com/books"];
+        NSURLRequest *request = [NSURLRequest requestWithURL:url];
+        NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:url statusCode:200 HTTPVersion:@"1.1" headerFields:nil];
+
+        __block BOOL completionBlockDidExecute = NO;
+        SMDataStoreBulkSuccessBlock successBlock = ^(NSArray *theSucceeded, NSArray *theFailed, NSString *schema) {
+            [[schema should] equal:@"book"];
+            [[theSucceeded should] equal:succeeded];
+            [[theFailed should] equal:failed];
+            completionBlockDidExecute = YES;
+        };
+
+        SMFullResponseSuccessBlock success = [dataStore SMFullResponseSuccessBlockForSchema:@"book" withBulkSuccessBlock:successBlock];
+        success(request, response, responseObject);
+
+        [[theValue(completionBlockDidExecute) should] beYes];
+    });
+});
+
 describe(@"-SMFullResponseFailureBlockForObject:ofSchema:withFailureBlock:", ^{
     it(@"returns a block which calls the failure block with appropriate arguments", ^{
         NSDictionary *requestObject = [NSDictionary dictionaryWithObjectsAndKeys:
@@ -98,4 +129,61 @@ describe(@"countFromRangeHeader", ^{
     });
 });
 
-SPEC_END
\ No newline at end of file
+describe(@"queueRequest:options:onSuccess:onFailure:", ^{
+    it(@"signs requests as their operation starts", ^{
+        NSURLRequest *request = [NSURLRequest requestWithURL:[NSURL URLWithString:@"http://api.stackmob.com/book"]];
+        SMJSONRequestOperation *operation = [[SMJSONRequestOperation alloc] initWithRequest:request];
+        [[[SMJSONRequestOperation should] receiveAndReturn:operation] JSONRequestOperationWithRequest:[KWAny any] success:[KWAny any] failure:[KWAny any]];
+        dataStore.session.regularOAuthClient = [SMOAuth2Client nullMock];
+        [dataStore queueRequest:request options:[SMRequestOptions options] onSuccess:nil onFailure:nil];
+        [[operation.signingClient should] equal:dataStore.session.regularOAuthClient];
+    });
+});
+
+describe(@"conditional requests", ^{
+    __block NSMutableURLRequest *request = nil;
+    __block NSDictionary *responseObject = nil;
+    beforeEach(^{
+        request = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:@"http://api.stackmob.com/book/1234"]];
+        [request setValue:@"MAC id=\"1\"" forHTTPHeaderField:@"Authorization"];
+        responseObject = [NSDictionary dictionaryWithObjectsAndKeys:@"1234", @"book_id", nil];
+    });
+    it(@"leaves requests it hasn't seen a response to alone", ^{
+        [[[dataStore conditionalRequestForRequest:request] should] equal:request];
+        [[dataStore rememberedJSONForRequest:request] shouldBeNil];
+    });
+    it(@"revalidates with the ETag of the last response", ^{
+        NSDictionary *headers = [NSDictionary dictionaryWithObject:@"\"abc\"" forKey:@"ETag"];
+        NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:[request URL] statusCode:200 HTTPVersion:@"1.1" headerFields:headers];
+        [dataStore rememberResponse:response JSON:responseObject forRequest:request];
+        
+        NSMutableURLRequest *resignedRequest = [request mutableCopy];
+        [resignedRequest setValue:@"MAC id=\"2\"" forHTTPHeaderField:@"Authorization"];
+        NSURLRequest *conditionalRequest = [dataStore conditionalRequestForRequest:resignedRequest];
+        [[[conditionalRequest valueForHTTPHeaderField:@"If-None-Match"] should] equal:@"\"abc\""];
+        [[[dataStore rememberedJSONForRequest:conditionalRequest] should] equal:responseObject];
+    });
+    it(@"revalidates objects with their lastmoddate", ^{
+        NSDictionary *object = [NSDictionary dictionaryWithObjectsAndKeys:@"1234", @"book_id", [NSNumber numberWithLongLong:1346198400000], @"lastmoddate", nil];
+        NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:[request URL] statusCode:200 HTTPVersion:@"1.1" headerFields:nil];
+        [dataStore rememberResponse:response JSON:object forRequest:request];
+        NSURLRequest *conditionalRequest = [dataStore conditionalRequestForRequest:request];
+        [[[conditionalRequest valueForHTTPHeaderField:@"If-Modified-Since"] should] equal:@"Wed, 29 Aug 2012 00:00:00 GMT"];
+    });
+    it(@"doesn't revalidate with a lastmoddate between seconds", ^{
+        NSDictionary *object = [NSDictionary dictionaryWithObjectsAndKeys:@"1234", @"book_id", [NSNumber numberWithLongLong:1346198400500], @"lastmoddate", nil];
+        NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:[request URL] statusCode:200 HTTPVersion:@"1.1" headerFields:nil];
+        [dataStore rememberResponse:response JSON:object forRequest:request];
+        [[[dataStore conditionalRequestForRequest:request] valueForHTTPHeaderField:@"If-Modified-Since"] shouldBeNil];
+    });
+    it(@"forgets responses without validators", ^{
+        NSDictionary *headers = [NSDictionary dictionaryWithObject:@"\"abc\"" forKey:@"ETag"];
+        NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:[request URL] statusCode:200 HTTPVersion:@"1.1" headerFields:headers];
+        [dataStore rememberResponse:response JSON:responseObject forRequest:request];
+        response = [[NSHTTPURLResponse alloc] initWithURL:[request URL] statusCode:200 HTTPVersion:@"1.1" headerFields:nil];
+        [dataStore rememberResponse:response JSON:responseObject forRequest:request];
+        [[dataStore rememberedJSONForRequest:request] shouldBeNil];
+    });
+});
+
+SPEC_END
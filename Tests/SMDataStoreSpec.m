@@ -16,6 +16,79 @@
 
 #import <Kiwi/Kiwi.h>
 #import "StackMob.h"
+#import "SMDataStore+Protected.h"
+
+/*
+ A data store which holds on to the requests it is asked to queue, so a spec can complete them.
+ */
+@interface SMRecordingDataStore : SMDataStore
+
+@property (nonatomic, strong) NSMutableArray *successBlocks;
+@property (nonatomic, strong) NSMutableArray *failureBlocks;
+
+@end
+
+@implementation SMRecordingDataStore
+
+@synthesize successBlocks = _successBlocks;
+@synthesize failureBlocks = _failureBlocks;
+
+- (void)queueRequest:(NSURLRequest *)request options:(SMRequestOptions *)options onSuccess:(SMFullResponseSuccessBlock)onSuccess onFailure:(SMFullResponseFailureBlock)onFailure
+{
+    if (self.successBlocks == nil) {
+        self.successBlocks = [NSMutableArray array];
+        self.failureBlocks = [NSMutableArray array];
+    }
+    [self.successBlocks addObject:[onSuccess copy]];
+    [self.failureBlocks addObject:[onFailure copy]];
+}
+
+@end
+
+/*
+ Answers every request to api.stackmob.com with one of 42 books, or with a 304 Not Modified when it revalidates that answer.
+ */
+@interface SMNotModifiedURLProtocol : NSURLProtocol
+
+@end
+
+@implementation SMNotModifiedURLProtocol
+
++ (BOOL)canInitWithRequest:(NSURLRequest *)request
+{
+    return [[[request URL] host] isEqualToString:@"api.stackmob.com"];
+}
+
++ (NSURLRequest *)canonicalRequestForRequest:(NSURLRequest *)request
+{
+    return request;
+}
+
+- (void)startLoading
+{
+    NSURLRequest *request = [self request];
+    NSMutableDictionary *headers = [NSMutableDictionary dictionaryWithObject:@"\"abc\"" forKey:@"ETag"];
+    NSData *data = nil;
+    NSInteger statusCode = 304;
+    if (![[request valueForHTTPHeaderField:@"If-None-Match"] isEqualToString:@"\"abc\""]) {
+        [headers setObject:@"application/vnd.stackmob+json" forKey:@"Content-Type"];
+        [headers setObject:@"0-0/42" forKey:@"Content-Range"];
+        data = [@"[{\"book_id\":\"1234\"}]" dataUsingEncoding:NSUTF8StringEncoding];
+        statusCode = 200;
+    }
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:[request URL] statusCode:statusCode HTTPVersion:@"HTTP/1.1" headerFields:headers];
+    [[self client] URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+    if (data) {
+        [[self client] URLProtocol:self didLoadData:data];
+    }
+    [[self client] URLProtocolDidFinishLoading:self];
+}
+
+- (void)stopLoading
+{
+}
+
+@end
 
 SPEC_BEGIN(SMDataStoreSpec)
 
@@ -103,6 +176,48 @@ describe(@"CRUD", ^{
             });
         });
     });
+    describe(@"-createObjects:inSchema:onSuccess:onFailure:", ^{
+        __block NSArray *objectsToCreate = nil;
+        beforeEach(^{
+            objectsToCreate = [NSArray arrayWithObjects:
+                               [NSDictionary dictionaryWithObjectsAndKeys:@"How to Write iOS Applications", @"title", nil],
+                               [NSDictionary dictionaryWithObjectsAndKeys:@"How to Write Android Applications", @"title", nil],
+                               nil];
+        });
+        context(@"given a valid schema and array of objects", ^{
+            it(@"adds a single request to the queue with the objects as the body", ^{
+                NSMutableURLRequest *request = [[NSMutableURLRequest alloc] initWithURL:[NSURL URLWithString:@"http://stackmob.com"]];
+                [[dataStore.session.regularOAuthClient should] receive:@selector(requestWithMethod:path:parameters:) andReturn:request];
+
+                AFJSONRequestOperation *operation = [[AFJSONRequestOperation alloc] init];
+                [[[SMJSONRequestOperation should] receiveAndReturn:operation] JSONRequestOperationWithRequest:request success:[KWAny any] failure:[KWAny any]];
+
+                [[[dataStore.session.regularOAuthClient should] receive] enqueueHTTPRequestOperation:operation];
+                [dataStore createObjects:objectsToCreate inSchema:@"book" onSuccess:nil onFailure:nil];
+
+                [[[NSJSONSerialization JSONObjectWithData:[request HTTPBody] options:0 error:nil] should] equal:objectsToCreate];
+            });
+        });
+        context(@"given a nil schema", ^{
+            it(@"should fail", ^{
+                __block BOOL failureBlockCalled = NO;
+                __block BOOL successBlockCalled = NO;
+                [dataStore createObjects:objectsToCreate inSchema:nil onSuccess:^(NSArray *succeeded, NSArray *failed, NSString *schema) {
+                    successBlockCalled = YES;
+                } onFailure:^(NSError *theError, NSArray *objects, NSString *schema) {
+                    [theError shouldNotBeNil];
+                    [[theError.domain should] equal:SMErrorDomain];
+                    [[theValue(theError.code) should] equal:theValue(SMErrorInvalidArguments)];
+
+                    [[objects should] equal:objectsToCreate];
+                    [schema shouldBeNil];
+                    failureBlockCalled = YES;
+                }];
+                [[theValue(successBlockCalled) should] beNo];
+                [[theValue(failureBlockCalled) should] beYes];
+            });
+        });
+    });
     describe(@"-readObject:inSchema:withPrimaryKey:onCompletion:", ^{
         context(@"given a valid schema and object id", ^{
             it(@"creates an OAuth signed READ request", ^{
@@ -300,6 +415,158 @@ describe(@"performing queries", ^{
         pending(@"passes a nil array to the result block", ^{});
         pending(@"passes an error object to the result block", ^{});
     });        
+    context(@"with a result cache", ^{
+        __block SMDataStore *dataStore = nil;
+        __block SMQuery *query = nil;
+        __block NSArray *results = nil;
+        __block dispatch_queue_t queue = NULL;
+        beforeEach(^{
+            SMClient *client = [[SMClient alloc] initWithAPIVersion:@"0" publicKey:@"public"];
+            dataStore = [[SMDataStore alloc] initWithAPIVersion:@"0" session:client.session];
+            dataStore.resultCache = [[SMResultCache alloc] initWithName:@"test" timeToLive:60];
+            [dataStore.resultCache removeAllResults];
+            queue = dispatch_queue_create("com.stackmob.tests.resultcache", NULL);
+            dataStore.completionQueue = queue;
+            query = [[SMQuery alloc] initWithSchema:@"book"];
+            [query where:@"author" isEqualTo:@"A. Developer"];
+            results = [NSArray arrayWithObject:[NSDictionary dictionaryWithObject:@"1234" forKey:@"book_id"]];
+        });
+        afterEach(^{
+            [dataStore.resultCache removeAllResults];
+            dataStore.completionQueue = NULL;
+            dispatch_release(queue);
+        });
+        it(@"serves cached results without a request", ^{
+            [dataStore.resultCache setResults:results forKey:[query fingerprint] inSchema:@"book"];
+            [[dataStore shouldNot] receive:@selector(queueRequest:options:onSuccess:onFailure:)];
+            __block NSArray *served = nil;
+            [dataStore performQuery:query onSuccess:^(NSArray *theResults) {
+                served = theResults;
+            } onFailure:nil];
+            dispatch_sync(queue, ^{});
+            [[served should] equal:results];
+            [[theValue(dataStore.resultCache.hitCount) should] equal:theValue(1)];
+        });
+        it(@"sends the query on a miss", ^{
+            [[dataStore should] receive:@selector(queueRequest:options:onSuccess:onFailure:)];
+            [dataStore performQuery:query onSuccess:nil onFailure:nil];
+            [[theValue(dataStore.resultCache.missCount) should] equal:theValue(1)];
+        });
+        it(@"keys results by the request headers of the options", ^{
+            [dataStore.resultCache setResults:results forKey:[query fingerprint] inSchema:@"book"];
+            [[dataStore should] receive:@selector(queueRequest:options:onSuccess:onFailure:)];
+            [dataStore performQuery:query options:[SMRequestOptions optionsWithExpandDepth:1] onSuccess:nil onFailure:nil];
+        });
+        it(@"drops the cached results of a schema when writing to it", ^{
+            [dataStore.resultCache setResults:results forKey:[query fingerprint] inSchema:@"book"];
+            [dataStore stub:@selector(queueRequest:options:onSuccess:onFailure:)];
+            [dataStore deleteObjectId:@"1234" inSchema:@"book" onSuccess:nil onFailure:nil];
+            [[dataStore.resultCache resultsForKey:[query fingerprint] inSchema:@"book"] shouldBeNil];
+        });
+        it(@"keeps the results of each user apart", ^{
+            [dataStore.resultCache setResults:results forKey:[query fingerprint] inSchema:@"book"];
+            dataStore.session.userIdentifier = @"alice";
+            [[dataStore should] receive:@selector(queueRequest:options:onSuccess:onFailure:)];
+            [dataStore performQuery:query onSuccess:nil onFailure:nil];
+            dataStore.session.userIdentifier = nil;
+        });
+        it(@"drops the cached results of the schemas of related objects created with a write", ^{
+            SMQuery *authorQuery = [[SMQuery alloc] initWithSchema:@"author"];
+            [dataStore.resultCache setResults:results forKey:[authorQuery fingerprint] inSchema:@"author"];
+            [dataStore stub:@selector(queueRequest:options:onSuccess:onFailure:)];
+            SMRequestOptions *options = [SMRequestOptions optionsWithHeaders:[NSDictionary dictionaryWithObject:@"author=author" forKey:@"X-StackMob-Relations"]];
+            [dataStore createObject:[NSDictionary dictionaryWithObject:@"1234" forKey:@"book_id"] inSchema:@"book" options:options onSuccess:nil onFailure:nil];
+            [[dataStore.resultCache resultsForKey:[authorQuery fingerprint] inSchema:@"author"] shouldBeNil];
+        });
+        it(@"doesn't cache the results of a query which overlapped a write", ^{
+            SMRecordingDataStore *recordingDataStore = [[SMRecordingDataStore alloc] initWithAPIVersion:@"0" session:dataStore.session];
+            recordingDataStore.resultCache = dataStore.resultCache;
+            recordingDataStore.completionQueue = queue;
+            [recordingDataStore performQuery:query onSuccess:^(NSArray *theResults) {} onFailure:nil];
+            [recordingDataStore deleteObjectId:@"1234" inSchema:@"book" onSuccess:nil onFailure:nil];
+            SMFullResponseSuccessBlock querySuccess = [recordingDataStore.successBlocks objectAtIndex:0];
+            SMFullResponseSuccessBlock deleteSuccess = [recordingDataStore.successBlocks objectAtIndex:1];
+            querySuccess(nil, nil, results);
+            dispatch_sync(queue, ^{});
+            deleteSuccess(nil, nil, nil);
+            [[dataStore.resultCache resultsForKey:[query fingerprint] inSchema:@"book"] shouldBeNil];
+        });
+    });
+});
+
+describe(@"coalescing identical reads", ^{
+    __block SMRecordingDataStore *dataStore = nil;
+    __block dispatch_queue_t queue = NULL;
+    __block SMQuery *query = nil;
+    beforeEach(^{
+        SMClient *client = [[SMClient alloc] initWithAPIVersion:@"0" publicKey:@"public"];
+        dataStore = [[SMRecordingDataStore alloc] initWithAPIVersion:@"0" session:client.session];
+        queue = dispatch_queue_create("com.stackmob.tests.coalescing", NULL);
+        dataStore.completionQueue = queue;
+        query = [[SMQuery alloc] initWithSchema:@"book"];
+        [query where:@"author" isEqualTo:@"A. Developer"];
+    });
+    afterEach(^{
+        dataStore.completionQueue = NULL;
+        dispatch_release(queue);
+    });
+    it(@"sends one request for identical queries in flight and gives every caller the results", ^{
+        NSArray *results = [NSArray arrayWithObject:[NSDictionary dictionaryWithObject:@"1234" forKey:@"book_id"]];
+        __block NSUInteger callbacks = 0;
+        for (int i = 0; i < 3; i++) {
+            [dataStore performQuery:query onSuccess:^(NSArray *theResults) {
+                [[theResults should] equal:results];
+                callbacks++;
+            } onFailure:nil];
+        }
+        [[dataStore.successBlocks should] haveCountOf:1];
+        SMFullResponseSuccessBlock success = [dataStore.successBlocks objectAtIndex:0];
+        success(nil, nil, results);
+        dispatch_sync(queue, ^{});
+        [[theValue(callbacks) should] equal:theValue(3)];
+    });
+    it(@"sends a new request once the previous one has completed", ^{
+        [dataStore performQuery:query onSuccess:^(NSArray *theResults) {} onFailure:^(NSError *theError) {}];
+        SMFullResponseFailureBlock failure = [dataStore.failureBlocks objectAtIndex:0];
+        failure(nil, nil, nil, nil);
+        dispatch_sync(queue, ^{});
+        [dataStore performQuery:query onSuccess:^(NSArray *theResults) {} onFailure:^(NSError *theError) {}];
+        [[dataStore.successBlocks should] haveCountOf:2];
+    });
+    it(@"does not coalesce different reads", ^{
+        [dataStore readObjectWithId:@"1234" inSchema:@"book" onSuccess:nil onFailure:nil];
+        [dataStore readObjectWithId:@"1234" inSchema:@"book" onSuccess:nil onFailure:nil];
+        [dataStore readObjectWithId:@"5678" inSchema:@"book" onSuccess:nil onFailure:nil];
+        [dataStore readObjectWithId:@"1234" inSchema:@"book" options:[SMRequestOptions optionsWithExpandDepth:1] onSuccess:nil onFailure:nil];
+        [[dataStore.successBlocks should] haveCountOf:3];
+    });
+    it(@"does not coalesce reads which would be retried differently", ^{
+        SMRequestOptions *noRetries = [SMRequestOptions options];
+        noRetries.numberOfRetries = 0;
+        [dataStore readObjectWithId:@"1234" inSchema:@"book" onSuccess:nil onFailure:nil];
+        [dataStore readObjectWithId:@"1234" inSchema:@"book" options:noRetries onSuccess:nil onFailure:nil];
+        [[dataStore.successBlocks should] haveCountOf:2];
+    });
+    it(@"sends a new request for a read made after a write to its schema", ^{
+        NSArray *results = [NSArray arrayWithObject:[NSDictionary dictionaryWithObject:@"1234" forKey:@"book_id"]];
+        __block NSUInteger callbacks = 0;
+        SMResultsSuccessBlock countCallback = ^(NSArray *theResults) {
+            callbacks++;
+        };
+        [dataStore performQuery:query onSuccess:countCallback onFailure:nil];
+        [dataStore updateObjectWithId:@"1234" inSchema:@"book" update:[NSDictionary dictionaryWithObject:@"Title" forKey:@"title"] onSuccess:nil onFailure:nil];
+        [dataStore performQuery:query onSuccess:countCallback onFailure:nil];
+        [[dataStore.successBlocks should] haveCountOf:3];
+        
+        SMFullResponseSuccessBlock firstQuerySuccess = [dataStore.successBlocks objectAtIndex:0];
+        firstQuerySuccess(nil, nil, results);
+        dispatch_sync(queue, ^{});
+        [[theValue(callbacks) should] equal:theValue(1)];
+        SMFullResponseSuccessBlock secondQuerySuccess = [dataStore.successBlocks objectAtIndex:2];
+        secondQuerySuccess(nil, nil, results);
+        dispatch_sync(queue, ^{});
+        [[theValue(callbacks) should] equal:theValue(2)];
+    });
 });
 
 describe(@"performing counts", ^{
@@ -322,6 +589,30 @@ describe(@"performing counts", ^{
         pending(@"passes a nil array to the result block", ^{});
         pending(@"passes an error object to the result block", ^{});
     });        
+    context(@"when the count is revalidated", ^{
+        __block SMDataStore *dataStore = nil;
+        beforeEach(^{
+            [NSURLProtocol registerClass:[SMNotModifiedURLProtocol class]];
+            SMClient *client = [[SMClient alloc] initWithAPIVersion:@"0" publicKey:@"public"];
+            dataStore = [[SMDataStore alloc] initWithAPIVersion:@"0" session:client.session];
+        });
+        afterEach(^{
+            [NSURLProtocol unregisterClass:[SMNotModifiedURLProtocol class]];
+        });
+        it(@"counts from the remembered Content-Range of a 304 Not Modified", ^{
+            SMQuery *query = [[SMQuery alloc] initWithSchema:@"book"];
+            __block NSNumber *firstCount = nil;
+            __block NSNumber *secondCount = nil;
+            [dataStore performCount:query onSuccess:^(NSNumber *count) {
+                firstCount = count;
+                [dataStore performCount:query onSuccess:^(NSNumber *count) {
+                    secondCount = count;
+                } onFailure:nil];
+            } onFailure:nil];
+            [[expectFutureValue(secondCount) shouldEventually] equal:[NSNumber numberWithInt:42]];
+            [[firstCount should] equal:[NSNumber numberWithInt:42]];
+        });
+    });
 });
 
 describe(@"perform custom code request", ^{
@@ -347,5 +638,40 @@ describe(@"perform custom code request", ^{
 });
 
 
+describe(@"completion queue", ^{
+    __block SMDataStore *dataStore = nil;
+    __block dispatch_queue_t queue = NULL;
+    __block AFJSONRequestOperation *operation = nil;
+    beforeEach(^{
+        SMClient *client = [[SMClient alloc] initWithAPIVersion:@"0" publicKey:@"public"];
+        dataStore = [[SMDataStore alloc] initWithAPIVersion:@"0" session:client.session];
+        dataStore.session.regularOAuthClient = [SMOAuth2Client nullMock];
+        queue = dispatch_queue_create("com.stackmob.tests.completion", NULL);
+        operation = [[AFJSONRequestOperation alloc] init];
+        [[SMJSONRequestOperation stubAndReturn:operation] JSONRequestOperationWithRequest:[KWAny any] success:[KWAny any] failure:[KWAny any]];
+    });
+    afterEach(^{
+        dispatch_release(queue);
+    });
+    it(@"leaves the callbacks on the main queue by default", ^{
+        [dataStore createObject:[NSDictionary dictionary] inSchema:@"book" onSuccess:nil onFailure:nil];
+        [[theValue(operation.successCallbackQueue == NULL) should] beYes];
+        [[theValue(operation.failureCallbackQueue == NULL) should] beYes];
+    });
+    it(@"runs the callbacks on the data store's completion queue", ^{
+        dataStore.completionQueue = queue;
+        [dataStore createObject:[NSDictionary dictionary] inSchema:@"book" onSuccess:nil onFailure:nil];
+        [[theValue(operation.successCallbackQueue == queue) should] beYes];
+        [[theValue(operation.failureCallbackQueue == queue) should] beYes];
+    });
+    it(@"prefers the completion queue of the request options", ^{
+        dataStore.completionQueue = dispatch_get_main_queue();
+        SMRequestOptions *options = [SMRequestOptions options];
+        options.completionQueue = queue;
+        [dataStore createObject:[NSDictionary dictionary] inSchema:@"book" options:options onSuccess:nil onFailure:nil];
+        [[theValue(operation.successCallbackQueue == queue) should] beYes];
+    });
+});
+
 
 SPEC_END
\ No newline at end of file
@@ -189,6 +189,190 @@ describe(@"-queryForEntity:predicate:error", ^{
             [[[query requestParameters] should] haveValue:expectation forKey:@"first_name[in]"];
         });
     });
+    describe(@"OR", ^{
+        __block NSArray *queries;
+        beforeEach(^{
+            predicate = [NSPredicate predicateWithFormat:@"last_name == %@ OR armor_class > %@", @"Cooper", [NSNumber numberWithInt:16]];
+            queries = [SMIncrementalStore queriesForEntity:entity predicate:predicate error:&error];
+        });
+        it(@"returns one query per alternative", ^{
+            [error shouldBeNil];
+            [[queries should] haveCountOf:2];
+            [[[[queries objectAtIndex:0] requestParameters] should] equal:[NSDictionary dictionaryWithObject:@"Cooper" forKey:@"last_name"]];
+            [[[[queries objectAtIndex:1] requestParameters] should] equal:[NSDictionary dictionaryWithObject:[NSNumber numberWithInt:16] forKey:@"armor_class[gt]"]];
+        });
+        it(@"is rejected by queryForEntity:predicate:error:", ^{
+            query = [SMIncrementalStore queryForEntity:entity predicate:predicate error:&error];
+            [query shouldBeNil];
+            [[error should] beNonNil];
+        });
+    });
+    describe(@"AND over OR", ^{
+        it(@"distributes the AND over each alternative", ^{
+            predicate = [NSPredicate predicateWithFormat:@"first_name == %@ AND (last_name == %@ OR last_name == %@)", @"Sheldon", @"Cooper", @"Lee"];
+            NSArray *queries = [SMIncrementalStore queriesForEntity:entity predicate:predicate error:&error];
+            [error shouldBeNil];
+            [[queries should] haveCountOf:2];
+            [[[[queries objectAtIndex:1] requestParameters] should] equal:[NSDictionary dictionaryWithObjectsAndKeys:@"Sheldon", @"first_name", @"Lee", @"last_name", nil]];
+        });
+    });
+    describe(@"NOT", ^{
+        __block NSEntityDescription *knight;
+        beforeEach(^{
+            // Every attribute of the test model is optional, so the ordering comparisons use an entity whose armor_class is required
+            NSAttributeDescription *lastName = [[NSAttributeDescription alloc] init];
+            [lastName setName:@"last_name"];
+            [lastName setAttributeType:NSStringAttributeType];
+            NSAttributeDescription *armorClass = [[NSAttributeDescription alloc] init];
+            [armorClass setName:@"armor_class"];
+            [armorClass setAttributeType:NSInteger16AttributeType];
+            [armorClass setOptional:NO];
+            knight = [[NSEntityDescription alloc] init];
+            [knight setName:@"Knight"];
+            [knight setProperties:[NSArray arrayWithObjects:lastName, armorClass, nil]];
+        });
+        it(@"negates a comparison", ^{
+            predicate = [NSPredicate predicateWithFormat:@"NOT (armor_class < %@)", [NSNumber numberWithInt:16]];
+            query = [SMIncrementalStore queryForEntity:knight predicate:predicate error:&error];
+            [error shouldBeNil];
+            [[[query requestParameters] should] haveValue:[NSNumber numberWithInt:16] forKey:@"armor_class[gte]"];
+        });
+        it(@"returns an error for a negated ordering comparison on an optional attribute", ^{
+            predicate = [NSPredicate predicateWithFormat:@"NOT (armor_class < %@)", [NSNumber numberWithInt:16]];
+            [[SMIncrementalStore queriesForEntity:entity predicate:predicate error:&error] shouldBeNil];
+            [[error should] beNonNil];
+        });
+        it(@"turns a negated AND into an OR", ^{
+            predicate = [NSPredicate predicateWithFormat:@"NOT (last_name == %@ AND armor_class >= %@)", @"Cooper", [NSNumber numberWithInt:16]];
+            NSArray *queries = [SMIncrementalStore queriesForEntity:knight predicate:predicate error:&error];
+            [error shouldBeNil];
+            [[queries should] haveCountOf:2];
+            [[[[queries objectAtIndex:0] requestParameters] should] haveValue:@"Cooper" forKey:@"last_name[ne]"];
+            [[[[queries objectAtIndex:1] requestParameters] should] haveValue:[NSNumber numberWithInt:16] forKey:@"armor_class[lt]"];
+        });
+        it(@"turns NOT BETWEEN into the ranges outside the bounds", ^{
+            NSArray *range = [NSArray arrayWithObjects:[NSNumber numberWithInt:12], [NSNumber numberWithInt:16], nil];
+            predicate = [NSPredicate predicateWithFormat:@"NOT (armor_class BETWEEN %@)", range];
+            NSArray *queries = [SMIncrementalStore queriesForEntity:knight predicate:predicate error:&error];
+            [error shouldBeNil];
+            [[queries should] haveCountOf:2];
+            [[[[queries objectAtIndex:0] requestParameters] should] haveValue:[NSNumber numberWithInt:12] forKey:@"armor_class[lt]"];
+            [[[[queries objectAtIndex:1] requestParameters] should] haveValue:[NSNumber numberWithInt:16] forKey:@"armor_class[gt]"];
+        });
+        it(@"returns an error for NOT IN with several values", ^{
+            predicate = [NSPredicate predicateWithFormat:@"NOT (first_name IN %@)", [NSArray arrayWithObjects:@"Aaron", @"Bob", nil]];
+            [[SMIncrementalStore queriesForEntity:entity predicate:predicate error:&error] shouldBeNil];
+            [[error should] beNonNil];
+        });
+    });
+});
+
+describe(@"-queriesForEntity:predicate:residualPredicate:error:", ^{
+    __block NSArray *queries;
+    __block NSPredicate *residualPredicate;
+    beforeEach(^{
+        entity = [SMSpecHelpers entityForName:@"Person"];
+        error = nil;
+        residualPredicate = nil;
+    });
+    it(@"sends the supported terms of a conjunction and leaves the rest", ^{
+        predicate = [NSPredicate predicateWithFormat:@"last_name == %@ AND first_name BEGINSWITH %@", @"Cooper", @"S"];
+        queries = [SMIncrementalStore queriesForEntity:entity predicate:predicate residualPredicate:&residualPredicate error:&error];
+        [error shouldBeNil];
+        [[queries should] haveCountOf:1];
+        [[[[queries lastObject] requestParameters] should] equal:[NSDictionary dictionaryWithObject:@"Cooper" forKey:@"last_name"]];
+        [[residualPredicate should] equal:[NSPredicate predicateWithFormat:@"first_name BEGINSWITH %@", @"S"]];
+    });
+    it(@"leaves case insensitive and key path to key path comparisons", ^{
+        predicate = [NSPredicate predicateWithFormat:@"last_name ==[c] %@ AND first_name == last_name", @"cooper"];
+        queries = [SMIncrementalStore queriesForEntity:entity predicate:predicate residualPredicate:&residualPredicate error:&error];
+        [error shouldBeNil];
+        [[[[queries lastObject] requestParameters] should] haveCountOf:0];
+        [[residualPredicate should] equal:predicate];
+    });
+    it(@"leaves a disjunction with an unsupported alternative whole", ^{
+        predicate = [NSPredicate predicateWithFormat:@"armor_class > %@ AND (last_name == %@ OR first_name CONTAINS %@)", [NSNumber numberWithInt:16], @"Cooper", @"S"];
+        queries = [SMIncrementalStore queriesForEntity:entity predicate:predicate residualPredicate:&residualPredicate error:&error];
+        [error shouldBeNil];
+        [[queries should] haveCountOf:1];
+        [[[[queries lastObject] requestParameters] should] equal:[NSDictionary dictionaryWithObject:[NSNumber numberWithInt:16] forKey:@"armor_class[gt]"]];
+        [[residualPredicate should] equal:[NSPredicate predicateWithFormat:@"last_name == %@ OR first_name CONTAINS %@", @"Cooper", @"S"]];
+    });
+    it(@"leaves negated ordering comparisons on optional attributes", ^{
+        predicate = [NSPredicate predicateWithFormat:@"last_name == %@ AND NOT (armor_class < %@)", @"Cooper", [NSNumber numberWithInt:16]];
+        queries = [SMIncrementalStore queriesForEntity:entity predicate:predicate residualPredicate:&residualPredicate error:&error];
+        [error shouldBeNil];
+        [[[[queries lastObject] requestParameters] should] equal:[NSDictionary dictionaryWithObject:@"Cooper" forKey:@"last_name"]];
+        [[residualPredicate should] equal:[NSPredicate predicateWithFormat:@"NOT (armor_class < %@)", [NSNumber numberWithInt:16]]];
+    });
+    it(@"has no residual predicate when StackMob supports all of it", ^{
+        predicate = [NSPredicate predicateWithFormat:@"NOT (last_name == %@)", @"Cooper"];
+        queries = [SMIncrementalStore queriesForEntity:entity predicate:predicate residualPredicate:&residualPredicate error:&error];
+        [residualPredicate shouldBeNil];
+        [[[[queries lastObject] requestParameters] should] haveValue:@"Cooper" forKey:@"last_name[ne]"];
+    });
+});
+
+describe(@"query plan cache", ^{
+    beforeEach(^{
+        entity = [SMSpecHelpers entityForName:@"Person"];
+        error = nil;
+    });
+    it(@"binds the constants of each predicate into the plan for its structure", ^{
+        NSString *format = @"last_name == %@ AND armor_class > %@ AND first_name IN %@";
+        [SMIncrementalStore queryForEntity:entity predicate:[NSPredicate predicateWithFormat:format, @"Cooper", [NSNumber numberWithInt:1], [NSArray arrayWithObjects:@"Sheldon", @"Leonard", nil]] error:&error];
+        query = [SMIncrementalStore queryForEntity:entity predicate:[NSPredicate predicateWithFormat:format, @"Wolowitz", [NSNumber numberWithInt:2], [NSArray arrayWithObjects:@"Howard", @"Bernadette", nil]] error:&error];
+        [error shouldBeNil];
+        [[[query requestParameters] should] equal:[NSDictionary dictionaryWithObjectsAndKeys:
+                                                   @"Wolowitz", @"last_name",
+                                                   [NSNumber numberWithInt:2], @"armor_class[gt]",
+                                                   @"Howard,Bernadette", @"first_name[in]",
+                                                   nil]];
+    });
+    it(@"does not share plans between arrays of different sizes", ^{
+        NSPredicate *notInOne = [NSPredicate predicateWithFormat:@"NOT (first_name IN %@)", [NSArray arrayWithObject:@"Sheldon"]];
+        query = [SMIncrementalStore queryForEntity:entity predicate:notInOne error:&error];
+        [[[query requestParameters] should] haveValue:@"Sheldon" forKey:@"first_name[ne]"];
+        NSPredicate *notInTwo = [NSPredicate predicateWithFormat:@"NOT (first_name IN %@)", [NSArray arrayWithObjects:@"Sheldon", @"Leonard", nil]];
+        [[SMIncrementalStore queryForEntity:entity predicate:notInTwo error:&error] shouldBeNil];
+        [[error should] beNonNil];
+    });
+    it(@"binds the constants of the residual predicate", ^{
+        NSString *format = @"last_name == %@ AND first_name BEGINSWITH %@";
+        NSPredicate *residualPredicate = nil;
+        [SMIncrementalStore queriesForEntity:entity predicate:[NSPredicate predicateWithFormat:format, @"Cooper", @"S"] residualPredicate:&residualPredicate error:&error];
+        [SMIncrementalStore queriesForEntity:entity predicate:[NSPredicate predicateWithFormat:format, @"Hofstadter", @"L"] residualPredicate:&residualPredicate error:&error];
+        [[residualPredicate should] equal:[NSPredicate predicateWithFormat:@"first_name BEGINSWITH %@", @"L"]];
+    });
+    it(@"binds a cached plan faster than translating the predicate", ^{
+        // Translates conjunctions of depth comparisons, with new constants every time.  Unique key paths defeat the cache.
+        double (^nanosecondsPerTranslation)(NSUInteger, BOOL) = ^(NSUInteger depth, BOOL cached) {
+            NSUInteger iterations = 2000;
+            NSDate *start = [NSDate date];
+            for (NSUInteger i = 0; i < iterations; i++) {
+                @autoreleasepool {
+                    NSMutableArray *comparisons = [NSMutableArray arrayWithCapacity:depth];
+                    for (NSUInteger j = 0; j < depth; j++) {
+                        NSString *field = cached ? [NSString stringWithFormat:@"field%lu", (unsigned long)j] : [NSString stringWithFormat:@"field%lu_%lu", (unsigned long)j, (unsigned long)i];
+                        [comparisons addObject:[NSComparisonPredicate predicateWithLeftExpression:[NSExpression expressionForKeyPath:field]
+                                                                                  rightExpression:[NSExpression expressionForConstantValue:[NSNumber numberWithUnsignedInteger:i]]
+                                                                                         modifier:NSDirectPredicateModifier
+                                                                                             type:NSLessThanPredicateOperatorType
+                                                                                          options:0]];
+                    }
+                    NSPredicate *conjunction = [NSCompoundPredicate andPredicateWithSubpredicates:comparisons];
+                    NSPredicate *residualPredicate = nil;
+                    [SMIncrementalStore queriesForEntity:entity predicate:conjunction residualPredicate:&residualPredicate error:&error];
+                }
+            }
+            return -[start timeIntervalSinceNow] * 1e9 / iterations;
+        };
+        
+        double uncached16 = nanosecondsPerTranslation(16, NO);
+        double cached16 = nanosecondsPerTranslation(16, YES);
+        [error shouldBeNil];
+        [[theValue(cached16) should] beLessThan:theValue(uncached16)];
+    });
 });
 
 SPEC_END
\ No newline at end of file
@@ -0,0 +1,575 @@
+/**
+ * Copyright 2012 StackMob
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#import <Kiwi/Kiwi.h>
+#import "StackMob.h"
+
+/*
+ A data store which answers from canned rows instead of the network, counting the requests it is asked to make.
+ */
+@interface SMStubDataStore : SMDataStore
+
+@property (nonatomic, strong) NSMutableDictionary *rowsBySchema;
+@property (nonatomic) NSUInteger queryCount;
+@property (nonatomic) NSUInteger readCount;
+@property (nonatomic) NSUInteger rowCount;
+@property (nonatomic, strong) SMRequestOptions *lastOptions;
+@property (nonatomic) NSUInteger writeCount;
+@property (nonatomic) BOOL writesUnavailable;
+
+@end
+
+@implementation SMStubDataStore
+
+@synthesize rowsBySchema = _rowsBySchema;
+@synthesize queryCount = _queryCount;
+@synthesize readCount = _readCount;
+@synthesize rowCount = _rowCount;
+@synthesize lastOptions = _lastOptions;
+@synthesize writeCount = _writeCount;
+@synthesize writesUnavailable = _writesUnavailable;
+
+// Understands equality and isIn: conditions, ordering, Range headers, and selecting fields, which is all the specs below need.
+- (NSArray *)rowsMatchingQuery:(SMQuery *)query
+{
+    NSMutableArray *results = [NSMutableArray array];
+    for (NSDictionary *row in [self.rowsBySchema objectForKey:query.schemaName]) {
+        __block BOOL matches = YES;
+        [query.requestParameters enumerateKeysAndObjectsUsingBlock:^(id key, id value, BOOL *stop) {
+            if ([key hasSuffix:@"[in]"]) {
+                NSString *field = [key substringToIndex:[key length] - [@"[in]" length]];
+                matches = [[value componentsSeparatedByString:@","] containsObject:[row objectForKey:field]];
+            } else {
+                matches = [[row objectForKey:key] isEqual:value];
+            }
+            *stop = !matches;
+        }];
+        if (matches) {
+            [results addObject:row];
+        }
+    }
+    NSString *orderByHeader = [query.requestHeaders objectForKey:@"X-StackMob-OrderBy"];
+    if (orderByHeader) {
+        NSMutableArray *sortDescriptors = [NSMutableArray array];
+        for (NSString *ordering in [orderByHeader componentsSeparatedByString:@","]) {
+            NSArray *parts = [ordering componentsSeparatedByString:@":"];
+            [sortDescriptors addObject:[NSSortDescriptor sortDescriptorWithKey:[parts objectAtIndex:0] ascending:[[parts objectAtIndex:1] isEqualToString:@"asc"]]];
+        }
+        [results sortUsingDescriptors:sortDescriptors];
+    }
+    NSString *rangeHeader = [query.requestHeaders objectForKey:@"Range"];
+    if (rangeHeader) {
+        NSArray *bounds = [[rangeHeader stringByReplacingOccurrencesOfString:@"objects=" withString:@""] componentsSeparatedByString:@"-"];
+        NSUInteger from = MIN((NSUInteger)[[bounds objectAtIndex:0] integerValue], [results count]);
+        NSString *last = [bounds objectAtIndex:1];
+        NSUInteger to = [last length] ? MIN((NSUInteger)[last integerValue] + 1, [results count]) : [results count];
+        to = MAX(from, to);
+        return [results subarrayWithRange:NSMakeRange(from, to - from)];
+    }
+    return results;
+}
+
+- (void)performQuery:(SMQuery *)query options:(SMRequestOptions *)options onSuccess:(SMResultsSuccessBlock)successBlock onFailure:(SMFailureBlock)failureBlock
+{
+    self.queryCount++;
+    self.lastOptions = options;
+    NSArray *rows = [self rowsMatchingQuery:query];
+    NSString *selectHeader = [options.headers objectForKey:@"X-StackMob-Select"];
+    if (selectHeader) {
+        NSArray *fields = [selectHeader componentsSeparatedByString:@","];
+        NSMutableArray *selectedRows = [NSMutableArray arrayWithCapacity:[rows count]];
+        for (NSDictionary *row in rows) {
+            NSMutableDictionary *selectedRow = [NSMutableDictionary dictionary];
+            for (NSString *field in fields) {
+                [selectedRow setValue:[row objectForKey:field] forKey:field];
+            }
+            [selectedRows addObject:selectedRow];
+        }
+        rows = selectedRows;
+    }
+    self.rowCount += [rows count];
+    successBlock(rows);
+}
+
+- (void)performCount:(SMQuery *)query options:(SMRequestOptions *)options onSuccess:(SMCountSuccessBlock)successBlock onFailure:(SMFailureBlock)failureBlock
+{
+    self.queryCount++;
+    successBlock([NSNumber numberWithUnsignedInteger:[[self rowsMatchingQuery:query] count]]);
+}
+
+- (void)readObjectWithId:(NSString *)theObjectId inSchema:(NSString *)schema options:(SMRequestOptions *)options onSuccess:(SMDataStoreSuccessBlock)successBlock onFailure:(SMDataStoreObjectIdFailureBlock)failureBlock
+{
+    self.readCount++;
+    NSString *primaryKeyField = [schema stringByAppendingString:@"_id"];
+    for (NSDictionary *row in [self.rowsBySchema objectForKey:schema]) {
+        if ([[row objectForKey:primaryKeyField] isEqualToString:theObjectId]) {
+            successBlock(row, schema);
+            return;
+        }
+    }
+    failureBlock([NSError errorWithDomain:SMErrorDomain code:SMErrorNotFound userInfo:nil], theObjectId, schema);
+}
+
+// Writes are counted, and refused as if StackMob were down when writesUnavailable is set.
+- (void)createObject:(NSDictionary *)theObject inSchema:(NSString *)schema options:(SMRequestOptions *)options onSuccess:(SMDataStoreSuccessBlock)successBlock onFailure:(SMDataStoreFailureBlock)failureBlock
+{
+    self.writeCount++;
+    if (self.writesUnavailable) {
+        failureBlock([NSError errorWithDomain:HTTPErrorDomain code:SMErrorServiceUnavailable userInfo:nil], theObject, schema);
+    } else {
+        [[self.rowsBySchema objectForKey:schema] addObject:[theObject mutableCopy]];
+        successBlock(theObject, schema);
+    }
+}
+
+@end
+
+SPEC_BEGIN(SMIncrementalStoreSpec)
+
+describe(@"SMIncrementalStore", ^{
+    __block SMStubDataStore *dataStore = nil;
+    __block NSManagedObjectContext *context = nil;
+    beforeEach(^{
+        SMClient *client = [[SMClient alloc] initWithAPIVersion:@"0" publicKey:@"public"];
+        dataStore = [[SMStubDataStore alloc] initWithAPIVersion:@"0" session:client.session];
+        // 1000 people, each with two interests.  The first 50 also share 10 favorites between them, and the first 20 work at StackMob.
+        NSMutableArray *people = [NSMutableArray array];
+        NSMutableArray *interests = [NSMutableArray array];
+        NSMutableArray *favorites = [NSMutableArray array];
+        for (int i = 0; i < 10; i++) {
+            [favorites addObject:[NSMutableDictionary dictionaryWithObjectsAndKeys:
+                                  [NSString stringWithFormat:@"f%d", i], @"favorite_id",
+                                  [NSString stringWithFormat:@"Genre %d", i], @"genre",
+                                  [NSMutableArray array], @"persons",
+                                  nil]];
+        }
+        for (int i = 0; i < 1000; i++) {
+            NSString *personId = [NSString stringWithFormat:@"%d", i];
+            NSArray *interestIds = [NSArray arrayWithObjects:[NSString stringWithFormat:@"%d-a", i], [NSString stringWithFormat:@"%d-b", i], nil];
+            NSMutableDictionary *person = [NSMutableDictionary dictionaryWithObjectsAndKeys:
+                                           personId, @"person_id",
+                                           [NSString stringWithFormat:@"Person %d", i], @"first_name",
+                                           i < 20 ? @"StackMob" : @"Other", @"company",
+                                           interestIds, @"interests",
+                                           [NSNumber numberWithLongLong:1000 + i], @"lastmoddate",
+                                           nil];
+            if (i < 50) {
+                NSMutableDictionary *favorite = [favorites objectAtIndex:i % 10];
+                [person setObject:[NSArray arrayWithObject:[favorite objectForKey:@"favorite_id"]] forKey:@"favorites"];
+                [[favorite objectForKey:@"persons"] addObject:personId];
+            }
+            [people addObject:person];
+            for (NSString *interestId in interestIds) {
+                [interests addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+                                      interestId, @"interest_id",
+                                      [NSString stringWithFormat:@"Interest %@", interestId], @"name",
+                                      personId, @"person",
+                                      nil]];
+            }
+        }
+        dataStore.rowsBySchema = [NSMutableDictionary dictionaryWithObjectsAndKeys:people, @"person", interests, @"interest", favorites, @"favorite", nil];
+        
+        [NSPersistentStoreCoordinator registerStoreClass:[SMIncrementalStore class] forStoreType:SMIncrementalStoreType];
+        NSManagedObjectModel *mom = [NSManagedObjectModel mergedModelFromBundles:[NSBundle allBundles]];
+        NSPersistentStoreCoordinator *psc = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:mom];
+        [psc addPersistentStoreWithType:SMIncrementalStoreType configuration:nil URL:nil options:[NSDictionary dictionaryWithObject:dataStore forKey:SM_DataStoreKey] error:nil];
+        context = [[NSManagedObjectContext alloc] init];
+        [context setPersistentStoreCoordinator:psc];
+    });
+    
+    describe(@"row cache", ^{
+        it(@"fulfills faults for fetched objects without another request", ^{
+            NSFetchRequest *fetchRequest = [[NSFetchRequest alloc] initWithEntityName:@"Person"];
+            NSArray *results = [context executeFetchRequest:fetchRequest error:nil];
+            [[results should] haveCountOf:1000];
+            for (NSManagedObject *person in results) {
+                [[person valueForKey:@"first_name"] shouldNotBeNil];
+            }
+            [[theValue(dataStore.queryCount + dataStore.readCount) should] equal:theValue(1)];
+        });
+        it(@"reads an uncached object once", ^{
+            NSEntityDescription *entity = [NSEntityDescription entityForName:@"Person" inManagedObjectContext:context];
+            SMIncrementalStore *store = [[[context persistentStoreCoordinator] persistentStores] lastObject];
+            NSManagedObject *person = [context objectWithID:[store newObjectIDForEntity:entity referenceObject:@"7"]];
+            [[[person valueForKey:@"first_name"] should] equal:@"Person 7"];
+            [[[person valueForKey:@"company"] should] equal:@"Other"];
+            [[theValue(dataStore.readCount) should] equal:theValue(1)];
+        });
+        it(@"reads a refreshed object again and sees changes made on the server", ^{
+            NSFetchRequest *fetchRequest = [[NSFetchRequest alloc] initWithEntityName:@"Person"];
+            [fetchRequest setPredicate:[NSPredicate predicateWithFormat:@"person_id == %@", @"7"]];
+            NSManagedObject *person = [[context executeFetchRequest:fetchRequest error:nil] lastObject];
+            [[[person valueForKey:@"first_name"] should] equal:@"Person 7"];
+            NSMutableArray *people = [dataStore.rowsBySchema objectForKey:@"person"];
+            NSMutableDictionary *renamedPerson = [[people objectAtIndex:7] mutableCopy];
+            [renamedPerson setObject:@"Renamed" forKey:@"first_name"];
+            [people replaceObjectAtIndex:7 withObject:renamedPerson];
+            [context refreshObject:person mergeChanges:NO];
+            [[[person valueForKey:@"first_name"] should] equal:@"Renamed"];
+            [[theValue(dataStore.readCount) should] equal:theValue(1)];
+        });
+    });
+    
+    describe(@"relationship faults", ^{
+        it(@"resolve from the cached rows of fetched objects", ^{
+            NSFetchRequest *fetchRequest = [[NSFetchRequest alloc] initWithEntityName:@"Person"];
+            NSArray *results = [context executeFetchRequest:fetchRequest error:nil];
+            for (NSManagedObject *person in [results subarrayWithRange:NSMakeRange(0, 50)]) {
+                [[[person valueForKey:@"interests"] should] haveCountOf:2];
+            }
+            [[theValue(dataStore.queryCount) should] equal:theValue(1)];
+            [[theValue(dataStore.readCount) should] equal:theValue(0)];
+        });
+        it(@"read an uncached parent only once", ^{
+            NSEntityDescription *entity = [NSEntityDescription entityForName:@"Interest" inManagedObjectContext:context];
+            SMIncrementalStore *store = [[[context persistentStoreCoordinator] persistentStores] lastObject];
+            NSManagedObject *interest = [context objectWithID:[store newObjectIDForEntity:entity referenceObject:@"3-a"]];
+            [[[interest valueForKey:@"name"] should] equal:@"Interest 3-a"];
+            [[[[interest valueForKey:@"person"] valueForKey:@"person_id"] should] equal:@"3"];
+            [[theValue(dataStore.readCount) should] equal:theValue(2)];
+        });
+    });
+    
+    describe(@"NSCountResultType", ^{
+        __block NSFetchRequest *fetchRequest = nil;
+        beforeEach(^{
+            fetchRequest = [[NSFetchRequest alloc] initWithEntityName:@"Person"];
+            [fetchRequest setPredicate:[NSPredicate predicateWithFormat:@"company == %@", @"StackMob"]];
+        });
+        it(@"counts with a single count request", ^{
+            [[theValue([context countForFetchRequest:fetchRequest error:nil]) should] equal:theValue(20)];
+            [[theValue(dataStore.queryCount) should] equal:theValue(1)];
+        });
+        it(@"applies the fetch offset and limit to the count", ^{
+            [fetchRequest setFetchOffset:15];
+            [fetchRequest setFetchLimit:10];
+            [[theValue([context countForFetchRequest:fetchRequest error:nil]) should] equal:theValue(5)];
+        });
+    });
+    
+    describe(@"NSDictionaryResultType", ^{
+        __block NSFetchRequest *fetchRequest = nil;
+        beforeEach(^{
+            fetchRequest = [[NSFetchRequest alloc] initWithEntityName:@"Person"];
+            [fetchRequest setPredicate:[NSPredicate predicateWithFormat:@"company == %@", @"StackMob"]];
+            [fetchRequest setResultType:NSDictionaryResultType];
+        });
+        it(@"asks for and returns only the properties to fetch", ^{
+            [fetchRequest setPropertiesToFetch:[NSArray arrayWithObject:@"first_name"]];
+            NSArray *results = [context executeFetchRequest:fetchRequest error:nil];
+            [[results should] haveCountOf:20];
+            [[[results objectAtIndex:0] should] equal:[NSDictionary dictionaryWithObject:@"Person 0" forKey:@"first_name"]];
+            [[[dataStore.lastOptions.headers objectForKey:@"X-StackMob-Select"] should] equal:@"first_name"];
+            [[theValue([[context registeredObjects] count]) should] equal:theValue(0)];
+        });
+        it(@"runs the callbacks of its requests on its own queue", ^{
+            [context executeFetchRequest:fetchRequest error:nil];
+            [[theValue(dataStore.lastOptions.completionQueue != NULL) should] beYes];
+            [[theValue(dataStore.completionQueue == NULL) should] beYes];
+        });
+        it(@"removes duplicates when asked for distinct results", ^{
+            [fetchRequest setPropertiesToFetch:[NSArray arrayWithObject:@"company"]];
+            [fetchRequest setReturnsDistinctResults:YES];
+            NSArray *results = [context executeFetchRequest:fetchRequest error:nil];
+            [[results should] equal:[NSArray arrayWithObject:[NSDictionary dictionaryWithObject:@"StackMob" forKey:@"company"]]];
+        });
+    });
+    
+    describe(@"fetchOffset and fetchLimit", ^{
+        __block NSFetchRequest *fetchRequest = nil;
+        beforeEach(^{
+            fetchRequest = [[NSFetchRequest alloc] initWithEntityName:@"Person"];
+            [fetchRequest setFetchLimit:20];
+        });
+        it(@"downloads exactly the limit", ^{
+            NSArray *results = [context executeFetchRequest:fetchRequest error:nil];
+            [[results should] haveCountOf:20];
+            [[theValue(dataStore.rowCount) should] equal:theValue(20)];
+        });
+        it(@"downloads exactly the limit from the offset", ^{
+            [fetchRequest setFetchOffset:990];
+            NSArray *results = [context executeFetchRequest:fetchRequest error:nil];
+            [[results should] haveCountOf:10];
+            [[[[results objectAtIndex:0] valueForKey:@"first_name"] should] equal:@"Person 990"];
+            [[theValue(dataStore.rowCount) should] equal:theValue(10)];
+        });
+        describe(@"with a fetch page size", ^{
+            beforeEach(^{
+                NSDictionary *options = [NSDictionary dictionaryWithObjectsAndKeys:dataStore, SM_DataStoreKey, [NSNumber numberWithUnsignedInteger:100], SM_FetchPageSizeKey, nil];
+                NSPersistentStoreCoordinator *psc = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:[NSManagedObjectModel mergedModelFromBundles:[NSBundle allBundles]]];
+                [psc addPersistentStoreWithType:SMIncrementalStoreType configuration:nil URL:nil options:options error:nil];
+                context = [[NSManagedObjectContext alloc] init];
+                [context setPersistentStoreCoordinator:psc];
+            });
+            it(@"downloads a small limit in one request", ^{
+                [[[context executeFetchRequest:fetchRequest error:nil] should] haveCountOf:20];
+                [[theValue(dataStore.queryCount) should] equal:theValue(1)];
+            });
+            it(@"downloads an unlimited fetch one page at a time", ^{
+                [fetchRequest setFetchLimit:0];
+                [fetchRequest setFetchOffset:50];
+                NSArray *results = [context executeFetchRequest:fetchRequest error:nil];
+                [[results should] haveCountOf:950];
+                [[[[results lastObject] valueForKey:@"first_name"] should] equal:@"Person 999"];
+                [[theValue(dataStore.queryCount) should] equal:theValue(10)];
+                [[theValue(dataStore.rowCount) should] equal:theValue(950)];
+                [[theValue(dataStore.readCount) should] equal:theValue(0)];
+            });
+        });
+    });
+    
+    describe(@"OR and NOT predicates", ^{
+        __block NSFetchRequest *fetchRequest = nil;
+        beforeEach(^{
+            fetchRequest = [[NSFetchRequest alloc] initWithEntityName:@"Person"];
+            [fetchRequest setPredicate:[NSPredicate predicateWithFormat:@"company == %@ OR person_id IN %@", @"StackMob", [NSArray arrayWithObjects:@"5", @"500", nil]]];
+        });
+        it(@"merges the results of one query per alternative without duplicates", ^{
+            NSArray *results = [context executeFetchRequest:fetchRequest error:nil];
+            [[results should] haveCountOf:21];
+            [[[NSSet setWithArray:results] should] haveCountOf:21];
+            [[theValue(dataStore.queryCount) should] equal:theValue(2)];
+        });
+        it(@"sorts and limits the merged results", ^{
+            [fetchRequest setSortDescriptors:[NSArray arrayWithObject:[NSSortDescriptor sortDescriptorWithKey:@"first_name" ascending:NO]]];
+            [fetchRequest setFetchOffset:1];
+            [fetchRequest setFetchLimit:2];
+            NSArray *results = [context executeFetchRequest:fetchRequest error:nil];
+            [[[results valueForKey:@"first_name"] should] equal:[NSArray arrayWithObjects:@"Person 8", @"Person 7", nil]];
+        });
+        it(@"counts each match once", ^{
+            [[theValue([context countForFetchRequest:fetchRequest error:nil]) should] equal:theValue(21)];
+        });
+        it(@"returns distinct dictionaries", ^{
+            [fetchRequest setResultType:NSDictionaryResultType];
+            [fetchRequest setPropertiesToFetch:[NSArray arrayWithObject:@"first_name"]];
+            [[[context executeFetchRequest:fetchRequest error:nil] should] haveCountOf:21];
+        });
+        it(@"pages batched results by primary key", ^{
+            [fetchRequest setFetchBatchSize:10];
+            NSArray *results = [context executeFetchRequest:fetchRequest error:nil];
+            [[results should] haveCountOf:21];
+            for (NSManagedObject *person in results) {
+                [[person valueForKey:@"first_name"] shouldNotBeNil];
+            }
+            [[theValue(dataStore.queryCount) should] equal:theValue(5)];
+            [[theValue(dataStore.readCount) should] equal:theValue(0)];
+        });
+    });
+    
+    describe(@"predicates StackMob can't evaluate", ^{
+        __block NSFetchRequest *fetchRequest = nil;
+        beforeEach(^{
+            fetchRequest = [[NSFetchRequest alloc] initWithEntityName:@"Person"];
+            [fetchRequest setPredicate:[NSPredicate predicateWithFormat:@"company == %@ AND first_name ENDSWITH %@", @"StackMob", @"1"]];
+        });
+        it(@"are evaluated on the device over what StackMob returns", ^{
+            NSArray *results = [context executeFetchRequest:fetchRequest error:nil];
+            [[[results valueForKey:@"first_name"] should] equal:[NSArray arrayWithObjects:@"Person 1", @"Person 11", nil]];
+            [[theValue(dataStore.queryCount) should] equal:theValue(1)];
+            [[theValue(dataStore.rowCount) should] equal:theValue(20)];
+        });
+        it(@"are evaluated before the offset and limit", ^{
+            [fetchRequest setFetchOffset:1];
+            [fetchRequest setFetchLimit:1];
+            NSArray *results = [context executeFetchRequest:fetchRequest error:nil];
+            [[[results valueForKey:@"first_name"] should] equal:[NSArray arrayWithObject:@"Person 11"]];
+        });
+        it(@"are counted", ^{
+            [[theValue([context countForFetchRequest:fetchRequest error:nil]) should] equal:theValue(2)];
+        });
+        it(@"filter dictionary results", ^{
+            [fetchRequest setResultType:NSDictionaryResultType];
+            [fetchRequest setPropertiesToFetch:[NSArray arrayWithObject:@"first_name"]];
+            [[[context executeFetchRequest:fetchRequest error:nil] should] haveCountOf:2];
+        });
+    });
+    
+    describe(@"fetchBatchSize", ^{
+        __block NSFetchRequest *fetchRequest = nil;
+        beforeEach(^{
+            fetchRequest = [[NSFetchRequest alloc] initWithEntityName:@"Person"];
+            [fetchRequest setFetchBatchSize:50];
+        });
+        it(@"fetches only primary keys up front, a range at a time", ^{
+            NSArray *results = [context executeFetchRequest:fetchRequest error:nil];
+            [[results should] haveCountOf:1000];
+            [[[dataStore.lastOptions.headers objectForKey:@"X-StackMob-Select"] should] equal:@"person_id"];
+            // Two full ranges of 500 ids, then an empty one.
+            [[theValue(dataStore.queryCount) should] equal:theValue(3)];
+            [[theValue(dataStore.rowCount) should] equal:theValue(1000)];
+        });
+        it(@"loads a page of objects the first time one of them is faulted", ^{
+            NSArray *results = [context executeFetchRequest:fetchRequest error:nil];
+            for (NSManagedObject *person in [results subarrayWithRange:NSMakeRange(0, 50)]) {
+                [[person valueForKey:@"first_name"] shouldNotBeNil];
+            }
+            [[[[results objectAtIndex:510] valueForKey:@"first_name"] should] equal:@"Person 510"];
+            [[theValue(dataStore.queryCount) should] equal:theValue(5)];
+            [[theValue(dataStore.readCount) should] equal:theValue(0)];
+        });
+        it(@"keeps the pages of only the most recent fetches", ^{
+            NSArray *firstResults = [context executeFetchRequest:fetchRequest error:nil];
+            for (NSUInteger offset = 1; offset <= 8; offset++) {
+                [fetchRequest setFetchOffset:offset];
+                [context executeFetchRequest:fetchRequest error:nil];
+            }
+            [[[[firstResults objectAtIndex:0] valueForKey:@"first_name"] should] equal:@"Person 0"];
+            [[theValue(dataStore.readCount) should] equal:theValue(1)];
+        });
+        it(@"pages from the fetch offset", ^{
+            [fetchRequest setFetchOffset:100];
+            NSArray *results = [context executeFetchRequest:fetchRequest error:nil];
+            [[results should] haveCountOf:900];
+            [[[[results objectAtIndex:0] valueForKey:@"first_name"] should] equal:@"Person 100"];
+            [[theValue(dataStore.readCount) should] equal:theValue(0)];
+        });
+    });
+    
+    describe(@"relationshipKeyPathsForPrefetching", ^{
+        // Fetches the people working at StackMob, then walks their interests, their favorites, and everyone else sharing those favorites.  Returns the number of requests made.
+        NSUInteger (^requestsToTraverseGraph)(NSArray *) = ^(NSArray *keyPaths) {
+            NSFetchRequest *fetchRequest = [[NSFetchRequest alloc] initWithEntityName:@"Person"];
+            [fetchRequest setPredicate:[NSPredicate predicateWithFormat:@"company == %@", @"StackMob"]];
+            [fetchRequest setRelationshipKeyPathsForPrefetching:keyPaths];
+            NSArray *results = [context executeFetchRequest:fetchRequest error:nil];
+            [[results should] haveCountOf:20];
+            for (NSManagedObject *person in results) {
+                for (NSManagedObject *interest in [person valueForKey:@"interests"]) {
+                    [[interest valueForKey:@"name"] shouldNotBeNil];
+                }
+                for (NSManagedObject *favorite in [person valueForKey:@"favorites"]) {
+                    [[favorite valueForKey:@"genre"] shouldNotBeNil];
+                    for (NSManagedObject *fan in [favorite valueForKey:@"persons"]) {
+                        [[fan valueForKey:@"first_name"] shouldNotBeNil];
+                    }
+                }
+            }
+            return dataStore.queryCount + dataStore.readCount;
+        };
+        
+        it(@"loads a two level object graph with one query per level and schema", ^{
+            NSUInteger requests = requestsToTraverseGraph([NSArray arrayWithObjects:@"interests", @"favorites.persons", nil]);
+            [[theValue(requests) should] equal:theValue(4)];
+        });
+        it(@"faults the same graph in one object at a time without it", ^{
+            NSUInteger requests = requestsToTraverseGraph(nil);
+            [[theValue(requests) should] equal:theValue(81)];
+        });
+    });
+    
+    describe(@"write-behind saves", ^{
+        __block NSString *path = nil;
+        beforeEach(^{
+            path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"SMIncrementalStoreSpec.outbox"];
+            [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+            NSDictionary *options = [NSDictionary dictionaryWithObjectsAndKeys:dataStore, SM_DataStoreKey, path, SM_OutboxPathKey, nil];
+            NSPersistentStoreCoordinator *psc = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:[NSManagedObjectModel mergedModelFromBundles:[NSBundle allBundles]]];
+            [psc addPersistentStoreWithType:SMIncrementalStoreType configuration:nil URL:nil options:options error:nil];
+            context = [[NSManagedObjectContext alloc] init];
+            [context setPersistentStoreCoordinator:psc];
+        });
+        afterEach(^{
+            [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+        });
+        it(@"fulfills faults on saved objects before StackMob has them", ^{
+            dataStore.writesUnavailable = YES;
+            NSManagedObject *person = [NSEntityDescription insertNewObjectForEntityForName:@"Person" inManagedObjectContext:context];
+            [person setValue:[person sm_assignObjectId] forKey:[person sm_primaryKeyField]];
+            [person setValue:@"Written Behind" forKey:@"first_name"];
+            [[theValue([context save:nil]) should] beYes];
+            
+            [context refreshObject:person mergeChanges:NO];
+            [[[person valueForKey:@"first_name"] should] equal:@"Written Behind"];
+            [[theValue(dataStore.readCount) should] equal:theValue(0)];
+        });
+    });
+    
+    describe(@"offline store", ^{
+        __block NSString *path = nil;
+        __block NSFetchRequest *fetchRequest = nil;
+        NSManagedObjectContext *(^launch)(void) = ^{
+            NSDictionary *options = [NSDictionary dictionaryWithObjectsAndKeys:dataStore, SM_DataStoreKey, path, SM_OfflineStorePathKey, nil];
+            NSPersistentStoreCoordinator *psc = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:[NSManagedObjectModel mergedModelFromBundles:[NSBundle allBundles]]];
+            [psc addPersistentStoreWithType:SMIncrementalStoreType configuration:nil URL:nil options:options error:nil];
+            NSManagedObjectContext *newContext = [[NSManagedObjectContext alloc] init];
+            [newContext setPersistentStoreCoordinator:psc];
+            return newContext;
+        };
+        beforeEach(^{
+            path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"SMIncrementalStoreSpec"];
+            [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+            fetchRequest = [[NSFetchRequest alloc] initWithEntityName:@"Person"];
+            [fetchRequest setPredicate:[NSPredicate predicateWithFormat:@"company == %@", @"StackMob"]];
+            dataStore.session.userIdentifier = @"alice";
+            context = launch();
+        });
+        afterEach(^{
+            [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+        });
+        it(@"fetches from StackMob when nothing is on disk", ^{
+            [[[context executeFetchRequest:fetchRequest error:nil] should] haveCountOf:20];
+            [[theValue(dataStore.queryCount) should] equal:theValue(1)];
+        });
+        it(@"answers the first fetch after launch from disk and revalidates it in the background", ^{
+            [[[context executeFetchRequest:fetchRequest error:nil] should] haveCountOf:20];
+            NSString *file = [path stringByAppendingPathComponent:@"user-alice/person.archive"];
+            [[expectFutureValue(theValue([[NSFileManager defaultManager] fileExistsAtPath:file])) shouldEventually] beYes];
+            
+            // Half of StackMob's employees leave while the app isn't running.
+            for (NSMutableDictionary *person in [[dataStore.rowsBySchema objectForKey:@"person"] subarrayWithRange:NSMakeRange(0, 10)]) {
+                [person setObject:@"Other" forKey:@"company"];
+            }
+            dataStore.queryCount = 0;
+            __block NSString *revalidatedEntityName = nil;
+            id observer = [[NSNotificationCenter defaultCenter] addObserverForName:SMIncrementalStoreDidRevalidateFetchNotification object:nil queue:nil usingBlock:^(NSNotification *note) {
+                revalidatedEntityName = [[note userInfo] objectForKey:SMIncrementalStoreEntityNameKey];
+            }];
+            context = launch();
+            
+            [[[context executeFetchRequest:fetchRequest error:nil] should] haveCountOf:20];
+            [[expectFutureValue(revalidatedEntityName) shouldEventually] equal:@"Person"];
+            [[theValue(dataStore.queryCount) should] equal:theValue(1)];
+            [[NSNotificationCenter defaultCenter] removeObserver:observer];
+            
+            [[[context executeFetchRequest:fetchRequest error:nil] should] haveCountOf:10];
+        });
+        it(@"deletes a user's rows when they log out", ^{
+            [[[context executeFetchRequest:fetchRequest error:nil] should] haveCountOf:20];
+            NSString *directory = [path stringByAppendingPathComponent:@"user-alice"];
+            [[theValue([[NSFileManager defaultManager] fileExistsAtPath:directory]) should] beYes];
+            
+            dataStore.session.userIdentifier = nil;
+            [[theValue([[NSFileManager defaultManager] fileExistsAtPath:directory]) should] beNo];
+            
+            dataStore.queryCount = 0;
+            context = launch();
+            [[[context executeFetchRequest:fetchRequest error:nil] should] haveCountOf:20];
+            [[theValue(dataStore.queryCount) should] equal:theValue(1)];
+        });
+        it(@"doesn't answer one user's fetches with another user's rows", ^{
+            [[[context executeFetchRequest:fetchRequest error:nil] should] haveCountOf:20];
+            dataStore.session.userIdentifier = @"bob";
+            dataStore.queryCount = 0;
+            context = launch();
+            [[[context executeFetchRequest:fetchRequest error:nil] should] haveCountOf:20];
+            [[theValue(dataStore.queryCount) should] equal:theValue(1)];
+            [[theValue([[NSFileManager defaultManager] fileExistsAtPath:[path stringByAppendingPathComponent:@"user-alice"]]) should] beNo];
+        });
+    });
+});
+
+SPEC_END
@@ -16,6 +16,56 @@
 
 #import <Kiwi/Kiwi.h>
 #import "StackMob.h"
+#import <CommonCrypto/CommonHMAC.h>
+#import "Base64EncodedStringFromData.h"
+#import "SMDataStore+Protected.h"
+#import <malloc/malloc.h>
+
+#define SIGNING_ALLOCATION_CALLS 1000
+#define SIGNING_MAX_BLOCKS_PER_CALL 4
+
+// The MAC header as it was built before signing reused the key bytes, host and port.
+static NSString *referenceMACHeader(SMOAuth2Client *client, NSString *method, NSString *path, double timestamp, NSString *nonce)
+{
+    NSArray *baseArray = [NSArray arrayWithObjects:[NSString stringWithFormat:@"%.f", timestamp], nonce, method, path, [[client baseURL] host], [client getPort], nil];
+    NSString *baseString = [[baseArray componentsJoinedByString:@"\n"] stringByAppendingString:@"\n\n"];
+    const char *keyCString = [client.macKey cStringUsingEncoding:NSUTF8StringEncoding];
+    const char *baseCString = [baseString cStringUsingEncoding:NSUTF8StringEncoding];
+    char buffer[CC_SHA1_DIGEST_LENGTH];
+    CCHmac(kCCHmacAlgSHA1, keyCString, strlen(keyCString), baseCString, strlen(baseCString), buffer);
+    NSString *mac = Base64EncodedStringFromData([NSData dataWithBytes:buffer length:CC_SHA1_DIGEST_LENGTH]);
+    return [NSString stringWithFormat:@"MAC id=\"%@\",ts=\"%.f\",nonce=\"%@\",mac=\"%@\"", client.accessToken, timestamp, nonce, mac];
+}
+
+// The value of one of the quoted fields of a MAC header.
+static NSString *MACHeaderField(NSString *header, NSString *field)
+{
+    NSRange start = [header rangeOfString:[NSString stringWithFormat:@"%@=\"", field]];
+    NSRange end = [header rangeOfString:@"\"" options:0 range:NSMakeRange(NSMaxRange(start), [header length] - NSMaxRange(start))];
+    return [header substringWithRange:NSMakeRange(NSMaxRange(start), end.location - NSMaxRange(start))];
+}
+
+// The number of heap blocks allocated and not yet freed, across all malloc zones.
+static long heapBlocksInUse(void)
+{
+    malloc_statistics_t statistics;
+    malloc_zone_statistics(NULL, &statistics);
+    return (long)statistics.blocks_in_use;
+}
+
+// The heap blocks still held per call of sign just before its autorelease pool drains, which are the objects it autoreleased plus any it leaked.
+static double heapBlocksPerCall(void (^sign)(void))
+{
+    long blocks = 0;
+    @autoreleasepool {
+        long start = heapBlocksInUse();
+        for (NSUInteger i = 0; i < SIGNING_ALLOCATION_CALLS; i++) {
+            sign();
+        }
+        blocks = heapBlocksInUse() - start;
+    }
+    return (double)MAX(blocks, 0L) / SIGNING_ALLOCATION_CALLS;
+}
 
 SPEC_BEGIN(SMOAuth2ClientSpec)
 
@@ -59,6 +109,96 @@ describe(@"Generating a mac key", ^{
     });
 });
 
+describe(@"Signing with a cached signing context", ^{
+    __block SMOAuth2Client *client  = nil;
+    beforeEach(^{
+        client = [[SMOAuth2Client alloc] initWithAPIVersion:@"1" scheme:@"http" apiHost:@"host:8080" publicKey:@"foo"];
+        client.accessToken = @"accessToken";
+        client.macKey = @"macKey";
+    });
+    it(@"should match the header built from the whole base string", ^{
+        NSString *longPath = [@"/book?" stringByPaddingToLength:1000 withString:@"title=Ein%20Buch&" startingAtIndex:0];
+        NSArray *paths = [NSArray arrayWithObjects:@"/", @"/book/1234", @"/b\u00fccher/\u00e9t\u00e9", longPath, nil];
+        for (NSString *path in paths) {
+            [[[client createMACHeaderForHttpMethod:@"PUT" path:path timestamp:1346198400 nonce:@"n42"] should] equal:referenceMACHeader(client, @"PUT", path, 1346198400, @"n42")];
+        }
+    });
+    it(@"should pick up a new mac key", ^{
+        client.macKey = @"anotherMacKey";
+        [[[client createMACHeaderForHttpMethod:@"GET" path:@"/book" timestamp:1337 nonce:@"n1"] should] equal:referenceMACHeader(client, @"GET", @"/book", 1337, @"n1")];
+    });
+    it(@"should leave only the header itself to the autorelease pool", ^{
+        // Warm up the cached key bytes and base string suffix first, so they aren't counted.
+        [client createMACHeaderForHttpMethod:@"GET" path:@"/book/1234" timestamp:1337 nonce:@"n1"];
+        double cachedBlocks = heapBlocksPerCall(^{
+            [client createMACHeaderForHttpMethod:@"GET" path:@"/book/1234" timestamp:1337 nonce:@"n1"];
+        });
+        double referenceBlocks = heapBlocksPerCall(^{
+            referenceMACHeader(client, @"GET", @"/book/1234", 1337, @"n1");
+        });
+        [[theValue(cachedBlocks) should] beLessThan:theValue((double)SIGNING_MAX_BLOCKS_PER_CALL)];
+        [[theValue(cachedBlocks) should] beLessThan:theValue(referenceBlocks)];
+    });
+});
+
+describe(@"Signing requests as they are sent", ^{
+    __block SMClient *client = nil;
+    __block SMDataStore *dataStore = nil;
+    beforeEach(^{
+        client = [[SMClient alloc] initWithAPIVersion:@"0" publicKey:@"public key"];
+        for (SMOAuth2Client *oauthClient in [NSArray arrayWithObjects:client.session.regularOAuthClient, client.session.secureOAuthClient, nil]) {
+            oauthClient.accessToken = @"accessToken";
+            oauthClient.macKey = @"macKey";
+        }
+        dataStore = [[SMDataStore alloc] initWithAPIVersion:@"0" session:[client session]];
+    });
+    it(@"should sign https requests for port 443 when the operation starts", ^{
+        SMOAuth2Client *secureClient = client.session.secureOAuthClient;
+        client.session.regularOAuthClient = [SMOAuth2Client nullMock];
+        KWCaptureSpy *spy = [client.session.regularOAuthClient captureArgument:@selector(enqueueHTTPRequestOperation:) atIndex:0];
+        NSMutableURLRequest *request = [secureClient requestWithMethod:@"GET" path:@"book" parameters:nil];
+        [dataStore queueRequest:request options:[SMRequestOptions options] onSuccess:nil onFailure:nil];
+        
+        SMJSONRequestOperation *operation = spy.argument;
+        [[operation.request valueForHTTPHeaderField:@"Authorization"] shouldBeNil];
+        [operation start];
+        [operation cancel];
+        NSString *header = [operation.request valueForHTTPHeaderField:@"Authorization"];
+        [header shouldNotBeNil];
+        NSString *nonce = MACHeaderField(header, @"nonce");
+        double timestamp = [MACHeaderField(header, @"ts") doubleValue];
+        [[header should] equal:referenceMACHeader(secureClient, @"GET", @"/book", timestamp, nonce)];
+    });
+});
+
+describe(@"Generating nonces", ^{
+    __block SMOAuth2Client *client  = nil;
+    beforeEach(^{
+        client = [[SMOAuth2Client alloc] initWithAPIVersion:@"1" scheme:@"https" apiHost:@"host" publicKey:@"foo"];
+        client.accessToken = @"accessToken";
+        client.macKey = @"macKey";
+    });
+    it(@"should not repeat a nonce across 100k concurrently signed requests", ^{
+        NSUInteger requests = 100000;
+        NSMutableSet *nonces = [NSMutableSet setWithCapacity:requests];
+        SMOAuth2Client *secureClient = client;
+        SMOAuth2Client *regularClient = [[SMOAuth2Client alloc] initWithAPIVersion:@"1" scheme:@"http" apiHost:@"host" publicKey:@"foo"];
+        regularClient.accessToken = @"accessToken";
+        regularClient.macKey = @"macKey";
+        dispatch_apply(requests, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t i) {
+            @autoreleasepool {
+                SMOAuth2Client *signingClient = i % 2 ? secureClient : regularClient;
+                NSString *header = [signingClient createMACHeaderForHttpMethod:@"GET" path:@"/book"];
+                NSString *nonce = MACHeaderField(header, @"nonce");
+                @synchronized(nonces) {
+                    [nonces addObject:nonce];
+                }
+            }
+        });
+        [[theValue([nonces count]) should] equal:theValue(requests)];
+    });
+});
+
 describe(@"has valid credentials", ^{
     
 });
@@ -113,6 +253,9 @@ describe(@"Generating a request", ^{
     it(@"should have an accept header", ^{
         [[[req valueForHTTPHeaderField:@"Accept"] should] equal:@"application/vnd.stackmob+json; version=1"]; 
     });
+    it(@"should leave signing to the operation which sends it", ^{
+        [[req valueForHTTPHeaderField:@"Authorization"] shouldBeNil]; 
+    });
     it(@"should have an X-StackMob-API-Key header", ^{
         [[[req valueForHTTPHeaderField:@"X-StackMob-API-Key"] should] equal:publicKey]; 
     });
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2012 StackMob
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#import <Kiwi/Kiwi.h>
+#import "StackMob.h"
+#import "SMOfflineStore.h"
+
+SPEC_BEGIN(SMOfflineStoreSpec)
+
+describe(@"SMOfflineStore", ^{
+    __block NSString *path = nil;
+    __block SMOfflineStore *store = nil;
+    __block NSArray *rows = nil;
+    beforeEach(^{
+        path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"SMOfflineStoreSpec"];
+        store = [[SMOfflineStore alloc] initWithPath:path];
+        [store removeAllRows];
+        rows = [NSArray arrayWithObjects:
+                [NSDictionary dictionaryWithObjectsAndKeys:@"2", @"book_id", @"Second", @"title", nil],
+                [NSDictionary dictionaryWithObjectsAndKeys:@"1", @"book_id", @"First", @"title", nil],
+                nil];
+    });
+    afterEach(^{
+        [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+    });
+    it(@"returns nil for fetches it hasn't stored", ^{
+        [[store rowsForKey:@"all" inSchema:@"book"] shouldBeNil];
+    });
+    it(@"returns the rows of a fetch in order", ^{
+        [store setRows:rows forKey:@"all" inSchema:@"book" primaryKeyField:@"book_id"];
+        [[[store rowsForKey:@"all" inSchema:@"book"] should] equal:rows];
+    });
+    it(@"shares rows between fetches", ^{
+        [store setRows:rows forKey:@"all" inSchema:@"book" primaryKeyField:@"book_id"];
+        NSDictionary *updatedRow = [NSDictionary dictionaryWithObjectsAndKeys:@"1", @"book_id", @"Updated", @"title", nil];
+        [store setRows:[NSArray arrayWithObject:updatedRow] forKey:@"one" inSchema:@"book" primaryKeyField:@"book_id"];
+        [[[[store rowsForKey:@"all" inSchema:@"book"] lastObject] should] equal:updatedRow];
+    });
+    it(@"leaves out removed rows", ^{
+        [store setRows:rows forKey:@"all" inSchema:@"book" primaryKeyField:@"book_id"];
+        [store removeRowWithPrimaryKey:@"2" inSchema:@"book"];
+        [[[store rowsForKey:@"all" inSchema:@"book"] should] equal:[NSArray arrayWithObject:[rows lastObject]]];
+    });
+    it(@"updates a saved row in the fetches which include it", ^{
+        [store setRows:rows forKey:@"all" inSchema:@"book" primaryKeyField:@"book_id"];
+        NSDictionary *savedRow = [NSDictionary dictionaryWithObjectsAndKeys:@"1", @"book_id", @"Saved", @"title", nil];
+        [store setRow:savedRow inSchema:@"book" primaryKeyField:@"book_id"];
+        [[[[store rowsForKey:@"all" inSchema:@"book"] lastObject] should] equal:savedRow];
+    });
+    it(@"forgets fetches when a new row is saved", ^{
+        [store setRows:rows forKey:@"all" inSchema:@"book" primaryKeyField:@"book_id"];
+        NSDictionary *savedRow = [NSDictionary dictionaryWithObjectsAndKeys:@"3", @"book_id", @"Third", @"title", nil];
+        [store setRow:savedRow inSchema:@"book" primaryKeyField:@"book_id"];
+        [[store rowsForKey:@"all" inSchema:@"book"] shouldBeNil];
+    });
+    it(@"forgets the oldest fetches of a schema and the rows only they returned", ^{
+        for (int i = 0; i <= 50; i++) {
+            NSDictionary *row = [NSDictionary dictionaryWithObjectsAndKeys:[NSString stringWithFormat:@"%d", i], @"book_id", nil];
+            [store setRows:[NSArray arrayWithObject:row] forKey:[NSString stringWithFormat:@"fetch %d", i] inSchema:@"book" primaryKeyField:@"book_id"];
+        }
+        [[store rowsForKey:@"fetch 0" inSchema:@"book"] shouldBeNil];
+        [[[store rowsForKey:@"fetch 50" inSchema:@"book"] should] haveCountOf:1];
+        NSDictionary *savedRow = [NSDictionary dictionaryWithObjectsAndKeys:@"0", @"book_id", nil];
+        [store setRow:savedRow inSchema:@"book" primaryKeyField:@"book_id"];
+        [[store rowsForKey:@"fetch 50" inSchema:@"book"] shouldBeNil];
+    });
+    it(@"keeps rows on disk", ^{
+        [store setRows:rows forKey:@"all" inSchema:@"book" primaryKeyField:@"book_id"];
+        // Wait for the queued write to disk, which runs on the store's queue before this lookup.
+        [store rowsForKey:@"all" inSchema:@"book"];
+        SMOfflineStore *relaunchedStore = [[SMOfflineStore alloc] initWithPath:path];
+        [[[relaunchedStore rowsForKey:@"all" inSchema:@"book"] should] equal:rows];
+    });
+});
+
+SPEC_END
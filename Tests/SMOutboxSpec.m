@@ -0,0 +1,177 @@
+/*
+ * Copyright 2012 StackMob
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#import <Kiwi/Kiwi.h>
+#import "StackMob.h"
+#import "SMOutbox.h"
+
+@interface SMOutboxRecordingDataStore : SMDataStore
+
+@property (nonatomic, strong) NSMutableArray *requests;
+@property (nonatomic) NSInteger failuresLeft;
+@property (nonatomic) NSInteger failureCode;
+
+@end
+
+@implementation SMOutboxRecordingDataStore
+
+@synthesize requests = _requests;
+@synthesize failuresLeft = _failuresLeft;
+@synthesize failureCode = _failureCode;
+
+- (NSError *)nextError
+{
+    if (self.failuresLeft == 0) {
+        return nil;
+    }
+    self.failuresLeft--;
+    return [NSError errorWithDomain:HTTPErrorDomain code:self.failureCode userInfo:nil];
+}
+
+- (void)record:(NSString *)request
+{
+    @synchronized(self) {
+        [self.requests addObject:request];
+    }
+}
+
+- (void)createObject:(NSDictionary *)theObject inSchema:(NSString *)schema options:(SMRequestOptions *)options onSuccess:(SMDataStoreSuccessBlock)successBlock onFailure:(SMDataStoreFailureBlock)failureBlock
+{
+    [self record:[NSString stringWithFormat:@"create %@", [theObject objectForKey:@"title"]]];
+    NSError *error = [self nextError];
+    error ? failureBlock(error, theObject, schema) : successBlock(theObject, schema);
+}
+
+- (void)createObjects:(NSArray *)objects inSchema:(NSString *)schema options:(SMRequestOptions *)options onSuccess:(SMDataStoreBulkSuccessBlock)successBlock onFailure:(SMDataStoreBulkFailureBlock)failureBlock
+{
+    [self record:[NSString stringWithFormat:@"create %@", [[objects valueForKey:@"title"] componentsJoinedByString:@","]]];
+    NSError *error = [self nextError];
+    error ? failureBlock(error, objects, schema) : successBlock([objects valueForKey:@"title"], [NSArray array], schema);
+}
+
+- (void)updateObjectWithId:(NSString *)theObjectId inSchema:(NSString *)schema update:(NSDictionary *)updatedFields options:(SMRequestOptions *)options onSuccess:(SMDataStoreSuccessBlock)successBlock onFailure:(SMDataStoreFailureBlock)failureBlock
+{
+    [self record:[NSString stringWithFormat:@"update %@", theObjectId]];
+    NSError *error = [self nextError];
+    error ? failureBlock(error, updatedFields, schema) : successBlock(updatedFields, schema);
+}
+
+- (void)deleteObjectId:(NSString *)theObjectId inSchema:(NSString *)schema options:(SMRequestOptions *)options onSuccess:(SMDataStoreObjectIdSuccessBlock)successBlock onFailure:(SMDataStoreObjectIdFailureBlock)failureBlock
+{
+    [self record:[NSString stringWithFormat:@"delete %@", theObjectId]];
+    NSError *error = [self nextError];
+    error ? failureBlock(error, theObjectId, schema) : successBlock(theObjectId, schema);
+}
+
+@end
+
+SPEC_BEGIN(SMOutboxSpec)
+
+describe(@"SMOutbox", ^{
+    __block NSString *path = nil;
+    __block SMOutboxRecordingDataStore *dataStore = nil;
+    __block NSDictionary *(^book)(NSString *) = nil;
+    beforeEach(^{
+        path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"SMOutboxSpec"];
+        [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+        SMClient *client = [[SMClient alloc] initWithAPIVersion:@"0" publicKey:@"public"];
+        dataStore = [[SMOutboxRecordingDataStore alloc] initWithAPIVersion:@"0" session:[client session]];
+        dataStore.requests = [NSMutableArray array];
+        book = ^(NSString *title) {
+            return [NSDictionary dictionaryWithObject:title forKey:@"title"];
+        };
+    });
+    afterEach(^{
+        [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+    });
+    it(@"keeps entries on disk until they are flushed", ^{
+        SMOutbox *outbox = [[SMOutbox alloc] initWithPath:path dataStore:nil];
+        NSArray *entries = [NSArray arrayWithObjects:[SMOutbox entryToCreateObject:book(@"a") inSchema:@"book" headers:nil], [SMOutbox entryToDeleteObjectWithId:@"1" inSchema:@"book"], nil];
+        [[theValue([outbox appendEntries:entries error:nil]) should] beYes];
+        
+        SMOutbox *relaunchedOutbox = [[SMOutbox alloc] initWithPath:path dataStore:dataStore];
+        [[expectFutureValue(theValue(relaunchedOutbox.count)) shouldEventually] equal:theValue(0)];
+        [[dataStore.requests should] equal:[NSArray arrayWithObjects:@"create a", @"delete 1", nil]];
+    });
+    it(@"sends entries in order, batching consecutive creates in a schema", ^{
+        SMOutbox *outbox = [[SMOutbox alloc] initWithPath:path dataStore:dataStore];
+        NSArray *entries = [NSArray arrayWithObjects:
+                            [SMOutbox entryToCreateObject:book(@"a") inSchema:@"book" headers:nil],
+                            [SMOutbox entryToCreateObject:book(@"b") inSchema:@"book" headers:nil],
+                            [SMOutbox entryToUpdateObjectWithId:@"1" object:book(@"c") inSchema:@"book"],
+                            [SMOutbox entryToCreateObject:book(@"d") inSchema:@"book" headers:nil],
+                            [SMOutbox entryToCreateObject:book(@"e") inSchema:@"author" headers:nil],
+                            [SMOutbox entryToDeleteObjectWithId:@"1" inSchema:@"book"],
+                            nil];
+        [outbox appendEntries:entries error:nil];
+        [[expectFutureValue(theValue(outbox.count)) shouldEventually] equal:theValue(0)];
+        [[dataStore.requests should] equal:[NSArray arrayWithObjects:@"create a,b", @"update 1", @"create d", @"create e", @"delete 1", nil]];
+    });
+    it(@"retries transient failures without reordering", ^{
+        dataStore.failuresLeft = 1;
+        dataStore.failureCode = SMErrorServiceUnavailable;
+        SMOutbox *outbox = [[SMOutbox alloc] initWithPath:path dataStore:dataStore];
+        NSArray *entries = [NSArray arrayWithObjects:[SMOutbox entryToUpdateObjectWithId:@"1" object:book(@"a") inSchema:@"book"], [SMOutbox entryToDeleteObjectWithId:@"2" inSchema:@"book"], nil];
+        [outbox appendEntries:entries error:nil];
+        [[expectFutureValue(theValue(outbox.count)) shouldEventuallyBeforeTimingOutAfter(3.0)] equal:theValue(0)];
+        [[dataStore.requests should] equal:[NSArray arrayWithObjects:@"update 1", @"update 1", @"delete 2", nil]];
+    });
+    it(@"sends a batch of creates which conflicts one create at a time", ^{
+        dataStore.failuresLeft = 1;
+        dataStore.failureCode = SMErrorConflict;
+        SMOutbox *outbox = [[SMOutbox alloc] initWithPath:path dataStore:dataStore];
+        NSArray *entries = [NSArray arrayWithObjects:[SMOutbox entryToCreateObject:book(@"a") inSchema:@"book" headers:nil], [SMOutbox entryToCreateObject:book(@"b") inSchema:@"book" headers:nil], nil];
+        [outbox appendEntries:entries error:nil];
+        [[expectFutureValue(theValue(outbox.count)) shouldEventually] equal:theValue(0)];
+        [[dataStore.requests should] equal:[NSArray arrayWithObjects:@"create a,b", @"create a", @"create b", nil]];
+    });
+    it(@"only sends entries while the user who made them is logged in", ^{
+        dataStore.session.userIdentifier = @"a";
+        SMOutbox *outbox = [[SMOutbox alloc] initWithPath:path dataStore:dataStore];
+        dataStore.failuresLeft = 1;
+        dataStore.failureCode = SMErrorServiceUnavailable;
+        [outbox appendEntries:[NSArray arrayWithObject:[SMOutbox entryToDeleteObjectWithId:@"1" inSchema:@"book"]] error:nil];
+        [[expectFutureValue(dataStore.requests) shouldEventually] haveCountOf:1];
+        
+        // User b logs in before the retry.
+        dataStore.session.userIdentifier = @"b";
+        [outbox appendEntries:[NSArray arrayWithObject:[SMOutbox entryToDeleteObjectWithId:@"2" inSchema:@"book"]] error:nil];
+        [[expectFutureValue(theValue(outbox.count)) shouldEventuallyBeforeTimingOutAfter(3.0)] equal:theValue(1)];
+        [[dataStore.requests should] equal:[NSArray arrayWithObjects:@"delete 1", @"delete 2", nil]];
+        
+        dataStore.session.userIdentifier = @"a";
+        [outbox flush];
+        [[expectFutureValue(theValue(outbox.count)) shouldEventually] equal:theValue(0)];
+        [[dataStore.requests should] equal:[NSArray arrayWithObjects:@"delete 1", @"delete 2", @"delete 1", nil]];
+    });
+    it(@"reports and drops entries StackMob rejects", ^{
+        dataStore.failuresLeft = 1;
+        dataStore.failureCode = SMErrorBadRequest;
+        SMOutbox *outbox = [[SMOutbox alloc] initWithPath:path dataStore:dataStore];
+        __block NSError *rejection = nil;
+        outbox.failureBlock = ^(NSDictionary *entry, NSError *theError) {
+            rejection = theError;
+        };
+        NSArray *entries = [NSArray arrayWithObjects:[SMOutbox entryToUpdateObjectWithId:@"1" object:book(@"a") inSchema:@"book"], [SMOutbox entryToDeleteObjectWithId:@"2" inSchema:@"book"], nil];
+        [outbox appendEntries:entries error:nil];
+        [[expectFutureValue(theValue(outbox.count)) shouldEventually] equal:theValue(0)];
+        [[theValue([rejection code]) should] equal:theValue(SMErrorBadRequest)];
+        [[dataStore.requests should] equal:[NSArray arrayWithObjects:@"update 1", @"delete 2", nil]];
+    });
+});
+
+SPEC_END
@@ -111,6 +111,88 @@ describe(@"multiple where clauses", ^{
     });
 });
 
+describe(@"repeated conditions on a field", ^{
+    it(@"keeps the tighter of two upper bounds", ^{
+        [query where:@"field1" isLessThan:[NSNumber numberWithInt:5]];
+        [query where:@"field1" isLessThan:[NSNumber numberWithInt:3]];
+        [query where:@"field1" isLessThan:[NSNumber numberWithInt:4]];
+        [[[query conditions] should] equal:[NSArray arrayWithObject:[NSArray arrayWithObjects:@"field1[lt]", [NSNumber numberWithInt:3], nil]]];
+    });
+    it(@"keeps the tighter of two lower bounds", ^{
+        [query where:@"field1" isGreaterThanOrEqualTo:[NSNumber numberWithInt:3]];
+        [query where:@"field1" isGreaterThanOrEqualTo:[NSNumber numberWithInt:5]];
+        [[[query requestParameters] should] haveValue:[NSNumber numberWithInt:5] forKey:@"field1[gte]"];
+    });
+    it(@"keeps every repeated exclusion", ^{
+        [query where:@"field1" isNotEqualTo:@"value1"];
+        [query where:@"field1" isNotEqualTo:@"value2"];
+        [query where:@"field1" isNotEqualTo:@"value1"];
+        [[[query conditions] should] haveCountOf:2];
+        [[[query queryString] should] equal:@"field1[ne]=value1&field1[ne]=value2"];
+    });
+    it(@"replaces a repeated equality with the last value", ^{
+        [query where:@"field1" isEqualTo:@"value1"];
+        [query where:@"field1" isEqualTo:@"value2"];
+        [[[query queryString] should] equal:@"field1=value2"];
+    });
+    it(@"replaces a repeated isIn: with the last values", ^{
+        [query where:@"field1" isIn:[NSArray arrayWithObjects:@"a", @"b", nil]];
+        [query where:@"field1" isIn:[NSArray arrayWithObject:@"c"]];
+        [[[query conditions] should] haveCountOf:1];
+        [[[query requestParameters] should] haveValue:@"c" forKey:@"field1[in]"];
+    });
+});
+
+describe(@"-queryString", ^{
+    it(@"is the same however the query was built", ^{
+        SMQuery *otherQuery = [[SMQuery alloc] initWithSchema:TEST_SCHEMA];
+        [query where:@"field1" isEqualTo:@"value1"];
+        [query where:@"field2" isGreaterThan:[NSNumber numberWithInt:2]];
+        [otherQuery where:@"field2" isGreaterThan:[NSNumber numberWithInt:2]];
+        [otherQuery where:@"field1" isEqualTo:@"value1"];
+        [[[query queryString] should] equal:@"field1=value1&field2[gt]=2"];
+        [[[otherQuery queryString] should] equal:[query queryString]];
+    });
+    it(@"escapes values", ^{
+        [query where:@"field1" isEqualTo:@"a b&c"];
+        [[[query queryString] should] equal:@"field1=a%20b%26c"];
+    });
+});
+
+describe(@"-fingerprint", ^{
+    it(@"is the same however the query was built", ^{
+        SMQuery *otherQuery = [[SMQuery alloc] initWithSchema:TEST_SCHEMA];
+        [query where:@"field1" isEqualTo:@"value1"];
+        [query where:@"field2" isGreaterThan:[NSNumber numberWithInt:2]];
+        [query orderByField:@"field1" ascending:YES];
+        [query fromIndex:0 toIndex:9];
+        [otherQuery fromIndex:0 toIndex:9];
+        [otherQuery orderByField:@"field1" ascending:YES];
+        [otherQuery where:@"field2" isGreaterThan:[NSNumber numberWithInt:2]];
+        [otherQuery where:@"field1" isEqualTo:@"value1"];
+        [[theValue([[query fingerprint] length]) should] equal:theValue(40)];
+        [[[otherQuery fingerprint] should] equal:[query fingerprint]];
+    });
+    it(@"differs by schema", ^{
+        SMQuery *otherQuery = [[SMQuery alloc] initWithSchema:@"other"];
+        [[[otherQuery fingerprint] shouldNot] equal:[query fingerprint]];
+    });
+    it(@"differs by conditions", ^{
+        SMQuery *otherQuery = [query copy];
+        [otherQuery where:@"field1" isEqualTo:@"value1"];
+        [[[otherQuery fingerprint] shouldNot] equal:[query fingerprint]];
+    });
+    it(@"differs by range and order", ^{
+        SMQuery *rangedQuery = [query copy];
+        [rangedQuery fromIndex:0 toIndex:9];
+        SMQuery *orderedQuery = [query copy];
+        [orderedQuery orderByField:@"field1" ascending:NO];
+        [[[rangedQuery fingerprint] shouldNot] equal:[query fingerprint]];
+        [[[orderedQuery fingerprint] shouldNot] equal:[query fingerprint]];
+        [[[orderedQuery fingerprint] shouldNot] equal:[rangedQuery fingerprint]];
+    });
+});
+
 describe(@"field selection", ^{
     __block NSArray *selectFields;
     beforeEach(^{
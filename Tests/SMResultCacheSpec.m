@@ -0,0 +1,78 @@
+/*
+ * Copyright 2012 StackMob
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#import <Kiwi/Kiwi.h>
+#import "StackMob.h"
+
+SPEC_BEGIN(SMResultCacheSpec)
+
+describe(@"SMResultCache", ^{
+    __block SMResultCache *cache = nil;
+    __block NSArray *results = nil;
+    beforeEach(^{
+        cache = [[SMResultCache alloc] initWithName:@"test" timeToLive:60];
+        [cache removeAllResults];
+        results = [NSArray arrayWithObject:[NSDictionary dictionaryWithObject:@"1234" forKey:@"book_id"]];
+    });
+    afterEach(^{
+        [cache removeAllResults];
+    });
+    it(@"counts a miss for unknown keys", ^{
+        [[cache resultsForKey:@"key" inSchema:@"book"] shouldBeNil];
+        [[theValue(cache.missCount) should] equal:theValue(1)];
+        [[theValue(cache.hitCount) should] equal:theValue(0)];
+    });
+    it(@"returns stored results and counts a hit", ^{
+        [cache setResults:results forKey:@"key" inSchema:@"book"];
+        [[[cache resultsForKey:@"key" inSchema:@"book"] should] equal:results];
+        [[theValue(cache.hitCount) should] equal:theValue(1)];
+        [[theValue(cache.missCount) should] equal:theValue(0)];
+    });
+    it(@"keeps results on disk for another cache with the same name", ^{
+        [cache setResults:results forKey:@"key" inSchema:@"book"];
+        // Wait for the queued write to disk, which runs on the cache's queue before this lookup.
+        [cache resultsForKey:@"other" inSchema:@"book"];
+        SMResultCache *otherCache = [[SMResultCache alloc] initWithName:@"test" timeToLive:60];
+        [[[otherCache resultsForKey:@"key" inSchema:@"book"] should] equal:results];
+    });
+    it(@"does not serve expired results", ^{
+        SMResultCache *expiringCache = [[SMResultCache alloc] initWithName:@"test" timeToLive:0];
+        [expiringCache setResults:results forKey:@"key" inSchema:@"book"];
+        [NSThread sleepForTimeInterval:0.01];
+        [[expiringCache resultsForKey:@"key" inSchema:@"book"] shouldBeNil];
+        [[theValue(expiringCache.missCount) should] equal:theValue(1)];
+    });
+    it(@"removes the results of a schema", ^{
+        [cache setResults:results forKey:@"key" inSchema:@"book"];
+        [cache setResults:results forKey:@"key" inSchema:@"author"];
+        [cache removeResultsInSchema:@"book"];
+        [[cache resultsForKey:@"key" inSchema:@"book"] shouldBeNil];
+        [[[cache resultsForKey:@"key" inSchema:@"author"] should] equal:results];
+        SMResultCache *otherCache = [[SMResultCache alloc] initWithName:@"test" timeToLive:60];
+        [[otherCache resultsForKey:@"key" inSchema:@"book"] shouldBeNil];
+    });
+    it(@"drops results taken before the schema's results were removed", ^{
+        NSUInteger generation = [cache generationOfSchema:@"book"];
+        [cache removeResultsInSchema:@"book"];
+        [cache setResults:results forKey:@"key" inSchema:@"book" generation:generation];
+        [[cache resultsForKey:@"key" inSchema:@"book"] shouldBeNil];
+        [cache setResults:results forKey:@"key" inSchema:@"book" generation:[cache generationOfSchema:@"book"]];
+        [[[cache resultsForKey:@"key" inSchema:@"book"] should] equal:results];
+    });
+});
+
+SPEC_END
@@ -17,6 +17,26 @@
 #import <Kiwi/Kiwi.h>
 #import "StackMob.h"
 
+@interface SMDeferredTokenSession : SMUserSession
+
+@property (nonatomic) NSUInteger tokenRequestCount;
+@property (nonatomic, copy) void (^completeTokenRequest)(NSDictionary *userObject);
+
+@end
+
+@implementation SMDeferredTokenSession
+
+@synthesize tokenRequestCount = _tokenRequestCount;
+@synthesize completeTokenRequest = _completeTokenRequest;
+
+- (void)doTokenRequestWithEndpoint:(NSString *)endpoint credentials:(NSDictionary *)credentials options:(SMRequestOptions *)options onSuccess:(void (^)(NSDictionary *))successBlock onFailure:(void (^)(NSError *))failureBlock
+{
+    self.tokenRequestCount++;
+    self.completeTokenRequest = successBlock;
+}
+
+@end
+
 SPEC_BEGIN(SMUserSessionSpec)
 
 #pragma mark Authentication with StackMob
@@ -127,6 +147,83 @@ describe(@"perform an access token request", ^{
     
 });
 
+describe(@"refreshTokenOnSuccess:onFailure:", ^{
+    __block SMDeferredTokenSession *userSession = nil;
+    beforeEach(^{
+        userSession = [[SMDeferredTokenSession alloc] initWithAPIVersion:@"1" apiHost:@"host" publicKey:@"foo" userSchema:@"user"];
+        userSession.refreshToken = @"refresh";
+    });
+    it(@"makes one request for callers arriving during a refresh, and completes them all", ^{
+        __block NSUInteger completions = 0;
+        __block NSUInteger failures = 0;
+        for (int i = 0; i < 3; i++) {
+            [userSession refreshTokenOnSuccess:^(NSDictionary *userObject) {
+                completions++;
+            } onFailure:^(NSError *theError) {
+                failures++;
+            }];
+        }
+        [[theValue(userSession.tokenRequestCount) should] equal:theValue(1)];
+        [[theValue(userSession.refreshing) should] beYes];
+        
+        userSession.completeTokenRequest([NSDictionary dictionary]);
+        [[theValue(completions) should] equal:theValue(3)];
+        [[theValue(failures) should] equal:theValue(0)];
+        [[theValue(userSession.refreshing) should] beNo];
+    });
+    it(@"starts a new request once the refresh has completed", ^{
+        [userSession refreshTokenOnSuccess:nil onFailure:nil];
+        userSession.completeTokenRequest([NSDictionary dictionary]);
+        [userSession refreshTokenOnSuccess:nil onFailure:nil];
+        [[theValue(userSession.tokenRequestCount) should] equal:theValue(2)];
+    });
+});
+
+describe(@"tokenRefreshMargin", ^{
+    __block SMDeferredTokenSession *userSession = nil;
+    beforeEach(^{
+        userSession = [[SMDeferredTokenSession alloc] initWithAPIVersion:@"1" apiHost:@"host" publicKey:@"foo" userSchema:@"user"];
+    });
+    it(@"defaults to a minute", ^{
+        [[theValue(userSession.tokenRefreshMargin) should] equal:theValue(60.0)];
+    });
+    it(@"refreshes in the background that long before the access token expires", ^{
+        userSession.tokenRefreshMargin = 1.0;
+        NSDate *expiration = [NSDate dateWithTimeIntervalSinceNow:1.5];
+        [userSession saveAccessTokenInfo:[NSDictionary dictionaryWithObjectsAndKeys:@"1234", @"access_token", @"refresh", @"refresh_token", expiration, @"expires_in", @"abcd", @"mac_key", nil]];
+        [[theValue(userSession.tokenRequestCount) should] equal:theValue(0)];
+        [[expectFutureValue(theValue(userSession.tokenRequestCount)) shouldEventuallyBeforeTimingOutAfter(2.0)] equal:theValue(1)];
+    });
+    it(@"waits half the lifetime of tokens which live no longer than the margin", ^{
+        userSession.tokenRefreshMargin = 60.0;
+        NSDate *expiration = [NSDate dateWithTimeIntervalSinceNow:1.0];
+        [userSession saveAccessTokenInfo:[NSDictionary dictionaryWithObjectsAndKeys:@"1234", @"access_token", @"refresh", @"refresh_token", expiration, @"expires_in", @"abcd", @"mac_key", nil]];
+        [NSThread sleepForTimeInterval:0.2];
+        [[theValue(userSession.tokenRequestCount) should] equal:theValue(0)];
+        [[expectFutureValue(theValue(userSession.tokenRequestCount)) shouldEventuallyBeforeTimingOutAfter(2.0)] equal:theValue(1)];
+    });
+});
+
+describe(@"requestIsSignedWithCurrentToken:", ^{
+    __block SMUserSession *userSession = nil;
+    __block NSMutableURLRequest *request = nil;
+    beforeEach(^{
+        userSession = [[SMUserSession alloc] initWithAPIVersion:@"1" apiHost:@"host" publicKey:@"foo" userSchema:@"user"];
+        userSession.regularOAuthClient.accessToken = @"1234";
+        userSession.regularOAuthClient.macKey = @"abcd";
+        request = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:@"http://host/book"]];
+    });
+    it(@"accepts requests signed with the current token", ^{
+        [userSession.regularOAuthClient signRequest:request];
+        [[theValue([userSession requestIsSignedWithCurrentToken:request]) should] beYes];
+    });
+    it(@"rejects requests signed with an earlier token", ^{
+        [userSession.regularOAuthClient signRequest:request];
+        userSession.regularOAuthClient.accessToken = @"5678";
+        [[theValue([userSession requestIsSignedWithCurrentToken:request]) should] beNo];
+    });
+});
+
 describe(@"parseTokenResults", ^{
     __block SMUserSession *userSession  = nil;
     __block NSString *appAPIVersion = @"1";
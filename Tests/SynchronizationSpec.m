@@ -0,0 +1,140 @@
+/**
+ * Copyright 2012 StackMob
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#import <Kiwi/Kiwi.h>
+#import <mach/mach.h>
+#import "Synchronization.h"
+
+#define BENCHMARK_REQUESTS 20
+#define BENCHMARK_LATENCY_MSEC 25
+// A blocked thread only wakes to return, so it should use a small fraction of each request's latency.
+#define BENCHMARK_MAX_CPU_USEC_PER_REQUEST 1000
+
+// User plus system CPU time, in microseconds, used so far by the calling thread.
+static uint64_t threadCPUTime(void) {
+    struct thread_basic_info info;
+    mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+    mach_port_t thread = mach_thread_self();
+    thread_info(thread, THREAD_BASIC_INFO, (thread_info_t)&info, &count);
+    mach_port_deallocate(mach_task_self(), thread);
+    return (uint64_t)(info.user_time.seconds + info.system_time.seconds) * USEC_PER_SEC + info.user_time.microseconds + info.system_time.microseconds;
+}
+
+// Waits on BENCHMARK_REQUESTS simulated requests, one at a time, from a private queue and returns the CPU time spent per request by the waiting thread.
+static uint64_t cpuTimePerBlockedRequest(void) {
+    __block uint64_t cpuTime = 0;
+    dispatch_semaphore_t done = dispatch_semaphore_create(0);
+    dispatch_queue_t contextQueue = dispatch_queue_create("com.stackmob.tests.synchronization", NULL);
+    dispatch_async(contextQueue, ^{
+        uint64_t start = threadCPUTime();
+        for (int i = 0; i < BENCHMARK_REQUESTS; i++) {
+            syncWithSemaphore(^(dispatch_semaphore_t semaphore) {
+                dispatch_after(dispatch_time(DISPATCH_TIME_NOW, BENCHMARK_LATENCY_MSEC * NSEC_PER_MSEC), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+                    syncReturn(semaphore);
+                });
+            });
+        }
+        cpuTime = (threadCPUTime() - start) / BENCHMARK_REQUESTS;
+        dispatch_semaphore_signal(done);
+    });
+    dispatch_semaphore_wait(done, DISPATCH_TIME_FOREVER);
+    dispatch_release(done);
+    dispatch_release(contextQueue);
+    return cpuTime;
+}
+
+SPEC_BEGIN(SynchronizationSpec)
+
+describe(@"syncWithSemaphore", ^{
+    it(@"returns once a background queue calls syncReturn while waiting on the main thread", ^{
+        __block BOOL returned = NO;
+        syncWithSemaphore(^(dispatch_semaphore_t semaphore) {
+            dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+                returned = YES;
+                syncReturn(semaphore);
+            });
+        });
+        [[theValue(returned) should] beYes];
+    });
+    it(@"uses almost no CPU while blocked on a private queue", ^{
+        uint64_t blockingTime = cpuTimePerBlockedRequest();
+        [[theValue(blockingTime) should] beLessThan:theValue((uint64_t)BENCHMARK_MAX_CPU_USEC_PER_REQUEST)];
+    });
+});
+
+describe(@"synchronousRequests", ^{
+    __block NSMutableArray *requests = nil;
+    __block NSInteger inFlight = 0;
+    __block NSInteger maxInFlight = 0;
+    __block NSInteger started = 0;
+    beforeEach(^{
+        requests = [NSMutableArray array];
+        inFlight = 0;
+        maxInFlight = 0;
+        started = 0;
+    });
+    
+    // Each request completes asynchronously after a short delay, failing with code i when i is in failingIndexes.
+    void (^addRequests)(NSUInteger, NSIndexSet *) = ^(NSUInteger count, NSIndexSet *failingIndexes) {
+        for (NSUInteger i = 0; i < count; i++) {
+            SynchronousRequestBlock request = ^(SynchronousRequestCompletionBlock completionBlock) {
+                @synchronized(requests) {
+                    inFlight++;
+                    started++;
+                    maxInFlight = MAX(maxInFlight, inFlight);
+                }
+                dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)((count - i) * 10 * NSEC_PER_MSEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+                    @synchronized(requests) {
+                        inFlight--;
+                    }
+                    completionBlock([failingIndexes containsIndex:i] ? [NSError errorWithDomain:@"test" code:i userInfo:nil] : nil);
+                });
+            };
+            [requests addObject:[request copy]];
+        }
+    };
+    
+    it(@"returns nil when every request succeeds", ^{
+        addRequests(10, [NSIndexSet indexSet]);
+        NSArray *errors = nil;
+        NSError *error = synchronousRequests(requests, 4, &errors);
+        [error shouldBeNil];
+        [[errors should] haveCountOf:10];
+        [[[errors lastObject] should] equal:[NSNull null]];
+    });
+    it(@"never has more than the maximum number of requests in flight", ^{
+        addRequests(12, [NSIndexSet indexSet]);
+        synchronousRequests(requests, 3, NULL);
+        [[theValue(maxInFlight) should] equal:theValue(3)];
+    });
+    it(@"returns the error of the earliest failed request, not the first to fail", ^{
+        NSMutableIndexSet *failing = [NSMutableIndexSet indexSetWithIndex:2];
+        [failing addIndex:7];
+        addRequests(8, failing);
+        NSArray *errors = nil;
+        NSError *error = synchronousRequests(requests, 8, &errors);
+        [[theValue([error code]) should] equal:theValue(2)];
+        [[theValue([[errors objectAtIndex:7] code]) should] equal:theValue(7)];
+    });
+    it(@"starts no more requests once one fails when running until failure", ^{
+        addRequests(8, [NSIndexSet indexSetWithIndex:1]);
+        NSError *error = synchronousRequestsUntilFailure(requests, 1);
+        [[theValue([error code]) should] equal:theValue(1)];
+        [[theValue(started) should] equal:theValue(2)];
+    });
+});
+
+SPEC_END
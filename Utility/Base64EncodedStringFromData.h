@@ -16,4 +16,9 @@
 
 #import <Foundation/Foundation.h>
 
+#define Base64EncodedLength(length) ((((length) + 2) / 3) * 4)
+
 NSString * Base64EncodedStringFromData(NSData *data);
+
+// Writes Base64EncodedLength(length) characters, without a terminating NUL, to output.
+void Base64EncodeBytes(const uint8_t *input, NSUInteger length, char *output);
@@ -41,14 +41,8 @@
 // THE SOFTWARE.
 //
 
-NSString * Base64EncodedStringFromData(NSData *data)
+void Base64EncodeBytes(const uint8_t *input, NSUInteger length, char *output)
 {
-    NSUInteger length = [data length];
-    NSMutableData *mutableData = [NSMutableData dataWithLength:((length + 2) / 3) * 4];
-    
-    uint8_t *input = (uint8_t *)[data bytes];
-    uint8_t *output = (uint8_t *)[mutableData mutableBytes];
-    
     for (NSUInteger i = 0; i < length; i += 3) {
         NSUInteger value = 0;
         for (NSUInteger j = i; j < (i + 3); j++) {
@@ -64,6 +58,12 @@ NSString * Base64EncodedStringFromData(NSData *data)
         output[idx + 2] = (i + 1) < length ? kAFBase64EncodingTable[(value >> 6)  & 0x3F] : '=';
         output[idx + 3] = (i + 2) < length ? kAFBase64EncodingTable[(value >> 0)  & 0x3F] : '=';
     }
-    
+}
+
+NSString * Base64EncodedStringFromData(NSData *data)
+{
+    NSUInteger length = [data length];
+    NSMutableData *mutableData = [NSMutableData dataWithLength:Base64EncodedLength(length)];
+    Base64EncodeBytes((const uint8_t *)[data bytes], length, (char *)[mutableData mutableBytes]);
     return [[NSString alloc] initWithData:mutableData encoding:NSASCIIStringEncoding];
 }
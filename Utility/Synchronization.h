@@ -20,15 +20,25 @@
 
 typedef void (^SynchronousQuerySuccessBlock)(NSArray *results);
 typedef void (^SynchronousQueryFailureBlock)(NSError *error);
+typedef void (^SynchronousRequestCompletionBlock)(NSError *error);
+typedef void (^SynchronousRequestBlock)(SynchronousRequestCompletionBlock completionBlock);
 
-void synchronousQuery(SMDataStore *sm, SMQuery *query, SynchronousQuerySuccessBlock successBlock, SynchronousQueryFailureBlock failureBlock);
+void synchronousQuery(SMDataStore *sm, SMQuery *query, SMRequestOptions *options, SynchronousQuerySuccessBlock successBlock, SynchronousQueryFailureBlock failureBlock);
 
 void syncWithSemaphore(void (^block)(dispatch_semaphore_t semaphore));
 
 void syncReturn(dispatch_semaphore_t semaphore);
 
+NSError *synchronousRequests(NSArray *requests, NSUInteger maxConcurrentRequests, NSArray *__autoreleasing *errors);
+
+NSError *synchronousRequestsUntilFailure(NSArray *requests, NSUInteger maxConcurrentRequests);
+
 /**
  The `Synchronization` class provides helper methods for making synchronous calls to StackMob.  This is done because Core Data makes all calls to it's persistent store synchronously, therefore we must do the same with StackMob.
+ 
+ `syncWithSemaphore` blocks the calling thread until `syncReturn` is called on the semaphore.  Off the main thread it sleeps without using any CPU, so completion blocks must not be delivered on the waiting thread's own queue.  On the main thread it keeps running the run loop, since completion blocks are delivered on the main queue by default.
+ 
+ `synchronousRequests` runs an array of `SynchronousRequestBlock`s with at most `maxConcurrentRequests` of them in flight, starting the next one as each completes, and waits once for all of them.  It returns the first error in the order of the array, and optionally every result (an `NSError` or `NSNull`) in that order through `errors`.  `synchronousRequestsUntilFailure` does the same, except that once a request fails no more are started; those in flight are still waited for.  Request blocks may be started from a completion callback, so they must not touch managed objects.
  */
 @interface Synchronization : NSObject
 
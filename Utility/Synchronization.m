@@ -15,10 +15,12 @@
  */
 
 #import "Synchronization.h"
+#import "SMRequestOptions.h"
+#import <libkern/OSAtomic.h>
 
-void synchronousQuery(SMDataStore *sm, SMQuery *query, SynchronousQuerySuccessBlock successBlock, SynchronousQueryFailureBlock failureBlock) {    
+void synchronousQuery(SMDataStore *sm, SMQuery *query, SMRequestOptions *options, SynchronousQuerySuccessBlock successBlock, SynchronousQueryFailureBlock failureBlock) {    
     syncWithSemaphore(^(dispatch_semaphore_t semaphore) {
-        [sm performQuery:query onSuccess:^(NSArray *results) {
+        [sm performQuery:query options:options ? options : [SMRequestOptions options] onSuccess:^(NSArray *results) {
             successBlock(results);
             syncReturn(semaphore);
         } onFailure:^(NSError *error) {
@@ -28,15 +30,113 @@ void synchronousQuery(SMDataStore *sm, SMQuery *query, SynchronousQuerySuccessBl
     });
 }
 
+// The number of syncWithSemaphore calls currently waiting on the main thread.
+static volatile int32_t mainThreadWaiters = 0;
+
 void syncWithSemaphore(void (^block)(dispatch_semaphore_t semaphore)) {
     dispatch_semaphore_t s = dispatch_semaphore_create(0);
     block(s);
-    while(dispatch_semaphore_wait(s, DISPATCH_TIME_NOW)) {
-        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:10.0]];
+    if ([NSThread isMainThread]) {
+        // Completion blocks are delivered on the main queue by default, so the main thread has to keep servicing its run loop while it waits.
+        OSAtomicIncrement32Barrier(&mainThreadWaiters);
+        while(dispatch_semaphore_wait(s, DISPATCH_TIME_NOW)) {
+            [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:10.0]];
+        }
+        OSAtomicDecrement32Barrier(&mainThreadWaiters);
+    } else {
+        // Any other thread, such as a private queue context's, has nothing to service and can simply sleep until signalled.
+        dispatch_semaphore_wait(s, DISPATCH_TIME_FOREVER);
     }
     dispatch_release(s);
 }
 
 void syncReturn(dispatch_semaphore_t semaphore) {
     dispatch_semaphore_signal(semaphore);
-}
\ No newline at end of file
+    if (mainThreadWaiters > 0 && ![NSThread isMainThread]) {
+        // A waiting main thread only re-checks its semaphore once its run loop handles a source, so give it one.
+        dispatch_async(dispatch_get_main_queue(), ^{});
+    }
+}
+
+static NSError *runSynchronousRequests(NSArray *requests, NSUInteger maxConcurrentRequests, BOOL stopOnFailure, NSArray *__autoreleasing *errors) {
+    NSUInteger count = [requests count];
+    NSMutableArray *results = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        [results addObject:[NSNull null]];
+    }
+    
+    if (count > 0) {
+        __block NSUInteger nextRequest = 0;
+        __block BOOL failed = NO;
+        syncWithSemaphore(^(dispatch_semaphore_t semaphore) {
+            dispatch_group_t group = dispatch_group_create();
+            for (NSUInteger i = 0; i < count; i++) {
+                dispatch_group_enter(group);
+            }
+            
+            // Each completion starts the next pending request, so at most maxConcurrentRequests are ever in flight.
+            __block void (^startNextRequest)(void) = ^{
+                NSUInteger index;
+                NSUInteger skippedRequests = 0;
+                @synchronized(results) {
+                    if (failed && stopOnFailure) {
+                        // The requests never started are done as far as the group is concerned.
+                        skippedRequests = count - nextRequest;
+                        nextRequest = count;
+                    }
+                    index = nextRequest;
+                    if (index < count) {
+                        nextRequest++;
+                    }
+                }
+                for (NSUInteger i = 0; i < skippedRequests; i++) {
+                    dispatch_group_leave(group);
+                }
+                if (index == count) {
+                    return;
+                }
+                SynchronousRequestBlock request = [requests objectAtIndex:index];
+                request(^(NSError *error) {
+                    if (error != nil) {
+                        @synchronized(results) {
+                            [results replaceObjectAtIndex:index withObject:error];
+                            failed = YES;
+                        }
+                    }
+                    startNextRequest();
+                    dispatch_group_leave(group);
+                });
+            };
+            
+            NSUInteger initialRequests = MIN(MAX(maxConcurrentRequests, (NSUInteger)1), count);
+            for (NSUInteger i = 0; i < initialRequests; i++) {
+                startNextRequest();
+            }
+            
+            dispatch_group_notify(group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+                // Break the retain cycle between startNextRequest and the completion blocks it creates.
+                startNextRequest = nil;
+                syncReturn(semaphore);
+            });
+            dispatch_release(group);
+        });
+    }
+    
+    if (errors != NULL) {
+        *errors = results;
+    }
+    for (id result in results) {
+        if (result != [NSNull null]) {
+            return result;
+        }
+    }
+    return nil;
+}
+
+NSError *synchronousRequests(NSArray *requests, NSUInteger maxConcurrentRequests, NSArray *__autoreleasing *errors) {
+    return runSynchronousRequests(requests, maxConcurrentRequests, NO, errors);
+}
+
+NSError *synchronousRequestsUntilFailure(NSArray *requests, NSUInteger maxConcurrentRequests) {
+    return runSynchronousRequests(requests, maxConcurrentRequests, YES, NULL);
+}